@@ -1,5 +1,5 @@
 /*
- * Copyright © 2012,2016 Jason J.A. Stephenson <jason@sigio.com>
+ * Copyright © 2012,2016,2026 Jason J.A. Stephenson <jason@sigio.com>
  *
  * This file is part of wake.
  *
@@ -17,9 +17,14 @@
  * along with wake.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "broadcast.h"
+#include "netlink.h"
+#include "rawsend.h"
+#include "uring.h"
+#include "mcast6.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -27,142 +32,714 @@
 #include <net/if.h>
 #include <errno.h>
 
+/* How many messages we hand to sendmmsg at once. */
+#define BCAST_BATCH 1024
+
 /*
- * Broadcasts a UDP msg to all interfaces, except the loopback
- * interface.  Since IPv6 doesn't support broadcast, this only works
- * with IPv4.
+ * Opens the pool's socket for an interface: a UDP socket with
+ * broadcast enabled, bound to the interface called name and connected
+ * to its broadcast address, addr.  Once it is connected, the kernel
+ * does not have to look up a route for every message sent with it.
+ * Binding to a device needs privileges on older kernels; without it
+ * the socket is still connected.
  *
- * Returns the number of bytes broadcast or -1 on error.
+ * Returns the socket or -1 on error.
  */
-ssize_t
-broadcast_msg(const u_int16_t port, const char *msg, const size_t msglen)
+static int open_bcast_socket(const char *name, const struct sockaddr_in *addr)
 {
-  ssize_t rv = -1; /* Assume an error as this simplifies things below. */
   const int on = 1;
-  extern int errno;
+  int fd, error;
+
+  fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+#ifdef SO_BINDTODEVICE
+  if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, name, strlen(name)) == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Binding to %s: %s\n", name, strerror(errno));
+#endif
+  }
+#endif
+  if (connect(fd, (const struct sockaddr *) addr,
+        sizeof(struct sockaddr_in)) == -1) {
+    error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+
+  return fd;
+}
+
+/* Closes count sockets of the pool in fds and frees it with addrs. */
+static void free_bcast_pool(struct sockaddr_in *addrs, int *fds, size_t count)
+{
+  size_t k;
+
+  if (fds != NULL)
+    for (k = 0; k < count; k++)
+      close(fds[k]);
+  free(fds);
+  free(addrs);
+}
+
+/*
+ * Looks up the broadcast address of every interface that is up, is
+ * not the loopback interface and has the broadcast flag set, and opens
+ * a socket for each of them with open_bcast_socket.  The new pool
+ * replaces the one b had, which is left alone if this fails.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int scan_broadcaster(struct broadcaster *b)
+{
+  struct sockaddr_in *addrs = NULL;
+  int *fds = NULL;
+  size_t count = 0;
   int lastlen = 0; /* last length returned with SIOCGIFCONF below */
   int n = 30; /* number of interfaces? */
+  size_t max;
   void *t; /* temp for realloc */
   char lastname[IFNAMSIZ], *cptr; /* track interface names */
+  int error = 0;
 
   struct ifconf ifc;
   struct ifreq *ifr, ifrcopy;
-  struct sockaddr_in sa, *sin;
+  struct sockaddr_in *sin;
 
   /* Zero out our structs to clear up any garbage. */
   memset(&ifc, 0, sizeof(struct ifconf));
-  memset(&sa, 0, sizeof(struct sockaddr_in));
-
-  int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
-  if (sock_fd != -1) {
-    setsockopt(sock_fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
-    sa.sin_family = AF_INET;
-    sa.sin_port = htons(port);
+  memset(lastname, 0, IFNAMSIZ);
 
-    /*
-     * Find the available network interfaces.  We look for an
-     * arbitrary number of interfaces, starting with 30.  We keep
-     * going until ioctl returns OK and the size returned does not
-     * change.
-     */
-    for (;;) {
-      /* Setup our struct ifconf. */
-      ifc.ifc_len = sizeof(struct ifreq) * n;
-      t = realloc(ifc.ifc_buf, ifc.ifc_len);
-      if (t)
-        ifc.ifc_buf = t;
-      else {
+  /*
+   * Find the available network interfaces.  We look for an
+   * arbitrary number of interfaces, starting with 30.  We keep
+   * going until ioctl returns OK and the size returned does not
+   * change.
+   */
+  for (;;) {
+    /* Setup our struct ifconf. */
+    ifc.ifc_len = sizeof(struct ifreq) * n;
+    t = realloc(ifc.ifc_buf, ifc.ifc_len);
+    if (t)
+      ifc.ifc_buf = t;
+    else {
 #ifdef DEBUG
-        fprintf(stderr, "Allocating buffer\n");
+      fprintf(stderr, "Allocating buffer\n");
 #endif
-        fprintf(stderr, "%s\n", strerror(errno));
-        goto CLEAN_UP;
-      }
+      error = errno;
+      goto CLEAN_UP;
+    }
 
-      /* Request the interface configurations */
-      if (ioctl(sock_fd, SIOCGIFCONF, &ifc) == -1) {
-        /* 'Cause Solaris sets errno to EINVAL. */
-        if (errno != EINVAL || lastlen != 0) {
+    /* Request the interface configurations */
+    if (ioctl(b->sock_fd, SIOCGIFCONF, &ifc) == -1) {
+      /* 'Cause Solaris sets errno to EINVAL. */
+      if (errno != EINVAL || lastlen != 0) {
 #ifdef DEBUG
-          fprintf(stderr, "Getting configuration");
+        fprintf(stderr, "Getting configuration\n");
 #endif
-          fprintf(stderr, "%s\n", strerror(errno));
-          goto CLEAN_UP;
-        }
+        error = errno;
+        goto CLEAN_UP;
       }
-      else if (ifc.ifc_len == lastlen)
-        break;
-      /*
-       * We use lastlen because BSD-derived implementations may return
-       * a short len if another struct would not fit.
-       */
-      lastlen = ifc.ifc_len;
-      n += 10;
     }
-
+    else if (ifc.ifc_len == lastlen)
+      break;
     /*
-     * Loop through the interfaces and send our broadcast on each one,
-     * skipping the loopback interface.
+     * We use lastlen because BSD-derived implementations may return
+     * a short len if another struct would not fit.
      */
-    for (t = ifc.ifc_buf; t < (void *)ifc.ifc_buf + ifc.ifc_len;) {
-      /* Get the interface. */
-      ifr = (struct ifreq *) t;
-      /* Make a copy of it. */
-      ifrcopy = *ifr;
-      /* get the next one */
-      t += sizeof(struct ifreq);
-      /* Check for aliases. */
-      if ((cptr = strchr(ifr->ifr_name, ':')) != NULL)
-        *cptr = 0; /* replace colon with nul */
-      if (strncmp(lastname, ifr->ifr_name, IFNAMSIZ) == 0)
-        continue; /* Skip if we've seen this name before. */
-      /* Store the name if not. */
-      memcpy(lastname, ifr->ifr_name, IFNAMSIZ);
-      /* Get the interface flags. */
-      if (ioctl(sock_fd, SIOCGIFFLAGS, &ifrcopy) == -1) {
+    lastlen = ifc.ifc_len;
+    n += 10;
+  }
+
+  /* We can't have more broadcast addresses than interfaces. */
+  max = ifc.ifc_len / sizeof(struct ifreq);
+  if (max > 0) {
+    addrs = calloc(max, sizeof(struct sockaddr_in));
+    fds = calloc(max, sizeof(int));
+    if (addrs == NULL || fds == NULL) {
+      error = errno;
+      goto CLEAN_UP;
+    }
+  }
+
+  /*
+   * Loop through the interfaces and remember the broadcast address
+   * of each one, skipping the loopback interface.
+   */
+  for (t = ifc.ifc_buf; t < (void *)ifc.ifc_buf + ifc.ifc_len;) {
+    /* Get the interface. */
+    ifr = (struct ifreq *) t;
+    /* Make a copy of it. */
+    ifrcopy = *ifr;
+    /* get the next one */
+    t += sizeof(struct ifreq);
+    /* Check for aliases. */
+    if ((cptr = strchr(ifr->ifr_name, ':')) != NULL)
+      *cptr = 0; /* replace colon with nul */
+    if (strncmp(lastname, ifr->ifr_name, IFNAMSIZ) == 0)
+      continue; /* Skip if we've seen this name before. */
+    /* Store the name if not. */
+    memcpy(lastname, ifr->ifr_name, IFNAMSIZ);
+    /* Get the interface flags. */
+    if (ioctl(b->sock_fd, SIOCGIFFLAGS, &ifrcopy) == -1) {
 #ifdef DEBUG
-        fprintf(stderr, "Getting flags\n");
+      fprintf(stderr, "Getting flags\n");
 #endif
-        fprintf(stderr, "%s\n", strerror(errno));
-        goto CLEAN_UP;
-      }
-      /* Skip the interface if it is not up. */
-      if ((ifrcopy.ifr_flags & IFF_UP) == 0)
-        continue;
-      /* Skip the interface if it is the loopback interface. */
-      if ((ifrcopy.ifr_flags & IFF_LOOPBACK))
-        continue;
-      /* Skip the interface if the broadcast flag is not set. */
-      if ((ifrcopy.ifr_flags & IFF_BROADCAST) == 0)
-        continue;
-      if (ioctl(sock_fd, SIOCGIFBRDADDR, ifr) != -1) {
-        if (ifr->ifr_broadaddr.sa_family == AF_INET) {
-          sin = (struct sockaddr_in*) &ifr->ifr_broadaddr;
-          sa.sin_addr.s_addr = sin->sin_addr.s_addr;
-          rv = sendto(sock_fd, msg, msglen, 0,
-            (const struct sockaddr *) &sa,
-            sizeof(struct sockaddr_in)
-          );
-        }
-      } else {
+      error = errno;
+      goto CLEAN_UP;
+    }
+    /* Skip the interface if it is not up. */
+    if ((ifrcopy.ifr_flags & IFF_UP) == 0)
+      continue;
+    /* Skip the interface if it is the loopback interface. */
+    if ((ifrcopy.ifr_flags & IFF_LOOPBACK))
+      continue;
+    /* Skip the interface if the broadcast flag is not set. */
+    if ((ifrcopy.ifr_flags & IFF_BROADCAST) == 0)
+      continue;
+    if (ioctl(b->sock_fd, SIOCGIFBRDADDR, ifr) != -1) {
+      if (ifr->ifr_broadaddr.sa_family == AF_INET) {
+        sin = (struct sockaddr_in*) &ifr->ifr_broadaddr;
+        addrs[count].sin_family = AF_INET;
+        addrs[count].sin_port = htons(b->port);
+        addrs[count].sin_addr.s_addr = sin->sin_addr.s_addr;
+        fds[count] = open_bcast_socket(lastname, &addrs[count]);
+        if (fds[count] == -1) {
 #ifdef DEBUG
-        fprintf(stderr, "Sending broadcast\n");
+          fprintf(stderr, "Opening socket for %s\n", lastname);
 #endif
-        fprintf(stderr, "%s\n", strerror(errno));
-        goto CLEAN_UP;
+          error = errno;
+          goto CLEAN_UP;
+        }
+        count++;
       }
+    } else {
+#ifdef DEBUG
+      fprintf(stderr, "Getting broadcast address\n");
+#endif
+      error = errno;
+      goto CLEAN_UP;
     }
   }
-  else
-    fprintf(stderr, "%s\n", strerror(errno));
 
 CLEAN_UP:
-  if (sock_fd != -1)
-    close(sock_fd);
   if (ifc.ifc_buf) {
     free(ifc.ifc_buf);
     ifc.ifc_buf = NULL;
   }
+  if (error) {
+    free_bcast_pool(addrs, fds, count);
+    errno = error;
+    return -1;
+  }
+
+  free_bcast_pool(b->addrs, b->fds, b->count);
+  b->addrs = addrs;
+  b->fds = fds;
+  b->count = count;
+  return 0;
+}
+
+/*
+ * Opens a pool of sockets, one for each interface that is up, is not
+ * the loopback interface and has the broadcast flag set, as described
+ * for scan_broadcaster.  The pool can be used to send any number of
+ * messages with broadcaster_send_msgs without looking at the
+ * interfaces again, until they change: a netlink socket tells us when
+ * they do, and the pool is then opened afresh before the next send.
+ *
+ * Returns a pointer to a struct broadcaster that must be released
+ * with close_broadcaster or NULL on error.
+ */
+struct broadcaster *
+open_broadcaster(const u_int16_t port)
+{
+  struct broadcaster *b;
+  const int on = 1;
+  int error;
+
+  b = calloc(1, sizeof(struct broadcaster));
+  if (b == NULL)
+    return NULL;
+  b->port = port;
+  b->watch_fd = -1;
+  inet_pton(AF_INET6, MCAST6_GROUP, &b->group6);
+
+  /* This one sends to single subnets and asks about interfaces. */
+  b->sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (b->sock_fd == -1)
+    goto CLEAN_UP;
+  setsockopt(b->sock_fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+
+  /* Listen before looking, so no change can slip in between. */
+  b->watch_fd = open_link_watch();
+#ifdef DEBUG
+  if (b->watch_fd == -1)
+    fprintf(stderr, "Watching interfaces: %s\n", strerror(errno));
+#endif
+  if (scan_broadcaster(b) == -1)
+    goto CLEAN_UP;
+
+  return b;
+
+CLEAN_UP:
+  error = errno;
+  close_broadcaster(b);
+  errno = error;
+  return NULL;
+}
+
+/*
+ * Opens b's pool afresh if the interfaces have changed since it was
+ * last opened, along with the raw, io_uring or IPv6 sender, which keep
+ * their own lists of interfaces.  If a sender can't be opened again,
+ * the old one is kept, or, for io_uring, b goes back to the blocking
+ * path.
+ *
+ * Returns 0 on success or -1 on error, when the old pool is kept.
+ */
+static int refresh_broadcaster(struct broadcaster *b)
+{
+  struct raw_sender *raw;
+
+  if (b->watch_fd == -1 || link_watch_changed(b->watch_fd) == 0)
+    return 0;
+  if (scan_broadcaster(b) == -1)
+    return -1;
+
+  if (b->raw != NULL) {
+    raw = open_raw_sender();
+    if (raw != NULL) {
+      close_raw_sender(b->raw);
+      b->raw = raw;
+    }
+  }
+  if (b->uring != NULL) {
+    close_uring_sender(b->uring);
+    b->uring = open_uring_sender(b);
+    if (b->uring == NULL)
+      b->transport = BCAST_UDP;
+  }
+  if (b->mcast6 != NULL && refresh_mcast6_sender(b->mcast6) == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Finding IPv6 interfaces: %s\n", strerror(errno));
+#endif
+  }
+  return 0;
+}
+
+/*
+ * Switches b to sending with transport, BCAST_UDP, BCAST_RAW,
+ * BCAST_URING or BCAST_IPV6.  The raw transport sends each message as
+ * an Ethernet broadcast frame of type RAW_ETHERTYPE from every
+ * Ethernet interface, and needs CAP_NET_RAW.  The io_uring transport
+ * sends the same datagrams as BCAST_UDP without blocking in a system
+ * call for each one; if the kernel can't give us a ring, b quietly
+ * stays with the blocking path.  The IPv6 transport sends each
+ * message to b's multicast group, ff02::1 unless broadcaster_set_group
+ * says otherwise, out of every interface with an IPv6 address.
+ *
+ * Returns 0 on success or -1 on error, when b is left as it was.
+ */
+int
+broadcaster_set_transport(struct broadcaster *b, int transport)
+{
+  struct raw_sender *raw = NULL;
+  struct uring_sender *uring = NULL;
+  struct mcast6_sender *mcast6 = NULL;
+
+  switch (transport) {
+  case BCAST_UDP:
+    break;
+  case BCAST_RAW:
+    if (b->raw != NULL)
+      return 0;
+    raw = open_raw_sender();
+    if (raw == NULL)
+      return -1;
+    break;
+  case BCAST_URING:
+    if (b->uring != NULL)
+      return 0;
+    uring = open_uring_sender(b);
+    if (uring == NULL) {
+#ifdef DEBUG
+      fprintf(stderr, "No io_uring, sending without it: %s\n",
+        strerror(errno));
+#endif
+      transport = BCAST_UDP;
+    }
+    break;
+  case BCAST_IPV6:
+    if (b->mcast6 != NULL)
+      return 0;
+    mcast6 = open_mcast6_sender(b->port, &b->group6);
+    if (mcast6 == NULL)
+      return -1;
+    break;
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+
+  close_raw_sender(b->raw);
+  close_uring_sender(b->uring);
+  close_mcast6_sender(b->mcast6);
+  b->raw = raw;
+  b->uring = uring;
+  b->mcast6 = mcast6;
+  b->transport = transport;
+  return 0;
+}
+
+/*
+ * Sets the IPv6 multicast group that b sends to with BCAST_IPV6 to
+ * group, given in text form, such as ff02::1.  If b is already sending
+ * with BCAST_IPV6, the new group is used from the next send on.
+ *
+ * Returns 0 on success or -1 with errno set to EINVAL if group is not
+ * an IPv6 multicast address.
+ */
+int
+broadcaster_set_group(struct broadcaster *b, const char *group)
+{
+  struct in6_addr addr;
+
+  if (inet_pton(AF_INET6, group, &addr) != 1
+      || !IN6_IS_ADDR_MULTICAST(&addr)) {
+    errno = EINVAL;
+    return -1;
+  }
+  b->group6 = addr;
+  if (b->mcast6 != NULL)
+    b->mcast6->group.sin6_addr = addr;
+  return 0;
+}
+
+/*
+ * Closes the socket and frees everything allocated by
+ * open_broadcaster.
+ */
+void
+close_broadcaster(struct broadcaster *b)
+{
+  if (b == NULL)
+    return;
+  if (b->sock_fd != -1)
+    close(b->sock_fd);
+  if (b->watch_fd != -1)
+    close(b->watch_fd);
+  free_bcast_pool(b->addrs, b->fds, b->count);
+  close_raw_sender(b->raw);
+  close_uring_sender(b->uring);
+  close_mcast6_sender(b->mcast6);
+  free(b);
+}
+
+/* One (message, address) pair of a batch, with everything its msghdr
+ * points at. */
+struct bcast_slot {
+  size_t owner; /* which message this is */
+  struct sockaddr_in addr;
+  struct iovec iov;
+  struct msghdr hdr;
+#ifdef IP_PKTINFO
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+  } control;
+#endif
+};
+
+/*
+ * Sets slot up to send message owner of msgs to addr, at b's port,
+ * or, if addr is NULL, to wherever the socket is connected.  If
+ * ifindex isn't 0, the message is sent out of that interface where
+ * the system lets us choose.
+ */
+static void fill_bcast_slot(struct broadcaster *b, struct bcast_slot *slot,
+  const char *msgs, const size_t msglen, size_t owner,
+  const struct sockaddr_in *addr, int ifindex)
+{
+#ifdef IP_PKTINFO
+  struct cmsghdr *cmsg;
+  struct in_pktinfo *info;
+#endif
+
+  slot->owner = owner;
+  slot->iov.iov_base = (void *) (msgs + owner * msglen);
+  slot->iov.iov_len = msglen;
+  memset(&slot->hdr, 0, sizeof(struct msghdr));
+  if (addr != NULL) {
+    slot->addr = *addr;
+    slot->addr.sin_port = htons(b->port);
+    slot->hdr.msg_name = &slot->addr;
+    slot->hdr.msg_namelen = sizeof(struct sockaddr_in);
+  }
+  slot->hdr.msg_iov = &slot->iov;
+  slot->hdr.msg_iovlen = 1;
+#ifdef IP_PKTINFO
+  if (ifindex != 0) {
+    memset(&slot->control, 0, sizeof(slot->control));
+    slot->hdr.msg_control = slot->control.buf;
+    slot->hdr.msg_controllen = sizeof(slot->control.buf);
+    cmsg = CMSG_FIRSTHDR(&slot->hdr);
+    cmsg->cmsg_level = IPPROTO_IP;
+    cmsg->cmsg_type = IP_PKTINFO;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+    info = (struct in_pktinfo *) CMSG_DATA(cmsg);
+    info->ipi_ifindex = ifindex;
+  }
+#endif
+}
+
+/* A batch of slots to be sent through one socket. */
+struct bcast_batch {
+  struct bcast_slot *slots;
+#ifdef HAVE_SENDMMSG
+  struct mmsghdr *vec;
+#endif
+  size_t n;
+};
+
+/*
+ * Sends every slot of batch through fd, with as few sendmmsg calls as
+ * it takes where we have it, and records how each message went.
+ */
+static void send_bcast_batch(int fd, struct bcast_batch *batch, int *status)
+{
+  struct bcast_slot *slots = batch->slots;
+  size_t k, n = batch->n;
+
+#ifdef HAVE_SENDMMSG
+  struct mmsghdr *vec = batch->vec;
+  size_t done;
+  int r;
+
+  for (k = 0; k < n; k++) {
+    memset(&vec[k], 0, sizeof(struct mmsghdr));
+    vec[k].msg_hdr = slots[k].hdr;
+  }
+  /*
+   * sendmmsg stops at the first message that fails, so record the
+   * error against that message, skip it and carry on.
+   */
+  for (done = 0; done < n;) {
+    r = sendmmsg(fd, vec + done, n - done, 0);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      if (status[slots[done].owner] != 0)
+        status[slots[done].owner] = errno;
+      done++;
+    }
+    else {
+      for (k = done; k < done + r; k++)
+        status[slots[k].owner] = 0;
+      done += r;
+    }
+  }
+#else
+  for (k = 0; k < n; k++) {
+    if (sendmsg(fd, &slots[k].hdr, 0) == -1) {
+      if (status[slots[k].owner] != 0)
+        status[slots[k].owner] = errno;
+    }
+    else
+      status[slots[k].owner] = 0;
+  }
+#endif
+}
+
+/*
+ * Sends count messages of msglen bytes each, stored back to back in
+ * msgs.  Message i goes only to dests[i].addr, out of interface
+ * dests[i].ifindex, if that isn't 0, and to every broadcast address
+ * known to b otherwise, as it does for all of them if dests is NULL.
+ * Messages for every address go out through each interface's socket
+ * of the pool, and those for one subnet through the unbound socket,
+ * in batches with sendmmsg where it is available.  If the interfaces
+ * have changed, the pool is opened afresh first.  With the raw
+ * transport, the work is handed to raw_send_msgs instead, and with the
+ * io_uring one to uring_send_msgs.  If the ring fails, b goes back to
+ * this path for good, and the messages that the ring didn't get out
+ * are sent here.  With the IPv6 transport, mcast6_send_msgs sends
+ * every message to the multicast group on every interface, since
+ * dests only has IPv4 subnets in it.
+ *
+ * If results is not NULL, it must have room for count ints.  Each one
+ * is set to 0 if the corresponding message went out on at least one
+ * interface or to the errno value of the last failure if it did not.
+ *
+ * Returns the number of messages that were sent on at least one
+ * interface or -1 on error.
+ */
+ssize_t
+broadcaster_send_directed(struct broadcaster *b, const char *msgs,
+  const size_t count, const size_t msglen, const struct bcast_dest *dests,
+  int *results)
+{
+  struct bcast_batch batch;
+  size_t i, j, k, end, sent = 0;
+  ssize_t rv;
+  int *status, resend = 0;
+
+  if (refresh_broadcaster(b) == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Refreshing interfaces: %s\n", strerror(errno));
+#endif
+  }
+  if (b->transport == BCAST_RAW)
+    return raw_send_msgs(b->raw, msgs, count, msglen, dests, results);
+  if (b->transport == BCAST_IPV6)
+    return mcast6_send_msgs(b->mcast6, msgs, count, msglen, results);
+  status = calloc(count ? count : 1, sizeof(int));
+  if (status == NULL)
+    return -1;
+  if (b->transport == BCAST_URING && msglen <= URING_SLOT) {
+    rv = uring_send_msgs(b->uring, msgs, count, msglen, dests, status);
+    /* Short of memory, a ring with nothing left in it can be tried
+     * again next time. */
+    if (rv != -1 || (errno == ENOMEM && b->uring->inflight == 0)) {
+      if (results != NULL)
+        memcpy(results, status, count * sizeof(int));
+      free(status);
+      return rv;
+    }
+#ifdef DEBUG
+    fprintf(stderr, "Giving up on io_uring: %s\n", strerror(errno));
+#endif
+    close_uring_sender(b->uring);
+    b->uring = NULL;
+    b->transport = BCAST_UDP;
+    resend = 1;
+  }
+
+  batch.slots = calloc(BCAST_BATCH, sizeof(struct bcast_slot));
+#ifdef HAVE_SENDMMSG
+  batch.vec = calloc(BCAST_BATCH, sizeof(struct mmsghdr));
+  if (batch.vec == NULL) {
+    free(batch.slots);
+    batch.slots = NULL;
+  }
+#endif
+  if (batch.slots == NULL) {
+    free(status);
+    return -1;
+  }
+  /* Nothing has gone out yet, so nothing has succeeded, except for
+   * what the ring sent before it failed, which isn't sent again.  Each
+   * message is looked at before its batch goes out, so a status of 0
+   * then can only have come from the ring. */
+  for (i = 0; i < count; i++)
+    if (!resend || status[i] != 0)
+      status[i] = b->count || (dests != NULL && dests[i].ifindex != 0)
+        ? EIO : ENETUNREACH;
+
+  for (i = 0; i < count; i = end) {
+    end = count - i > BCAST_BATCH ? i + BCAST_BATCH : count;
+
+    /* Messages for a single subnet go through the unbound socket,
+     * which can take a different interface for each of them. */
+    batch.n = 0;
+    if (dests != NULL)
+      for (k = i; k < end; k++)
+        if (dests[k].ifindex != 0 && !(resend && status[k] == 0))
+          fill_bcast_slot(b, &batch.slots[batch.n++], msgs, msglen, k,
+            &dests[k].addr, dests[k].ifindex);
+    send_bcast_batch(b->sock_fd, &batch, status);
+
+    /* The rest go out of every interface, through its own socket. */
+    batch.n = 0;
+    for (k = i; k < end; k++)
+      if ((dests == NULL || dests[k].ifindex == 0)
+          && !(resend && status[k] == 0))
+        fill_bcast_slot(b, &batch.slots[batch.n++], msgs, msglen, k,
+          NULL, 0);
+    if (batch.n > 0)
+      for (j = 0; j < b->count; j++)
+        send_bcast_batch(b->fds[j], &batch, status);
+  }
+
+#ifdef HAVE_SENDMMSG
+  free(batch.vec);
+#endif
+  free(batch.slots);
+
+  for (i = 0; i < count; i++) {
+    if (status[i] == 0)
+      sent++;
+    if (results != NULL)
+      results[i] = status[i];
+  }
+  free(status);
+
+  return sent;
+}
+
+/*
+ * Sends count messages of msglen bytes each, stored back to back in
+ * msgs, to every broadcast address known to b.  See
+ * broadcaster_send_directed for the meaning of results.
+ *
+ * Returns the number of messages that were sent on at least one
+ * interface or -1 on error.
+ */
+ssize_t
+broadcaster_send_msgs(struct broadcaster *b, const char *msgs,
+  const size_t count, const size_t msglen, int *results)
+{
+  return broadcaster_send_directed(b, msgs, count, msglen, NULL, results);
+}
+
+/*
+ * Broadcasts count UDP messages of msglen bytes each, stored back to
+ * back in msgs, to all interfaces except the loopback interface.  The
+ * interfaces are only looked up once for the whole batch and each of
+ * them gets one socket for all of the messages.  See
+ * broadcaster_send_directed for the meaning of results.
+ *
+ * Returns the number of messages sent or -1 on error.
+ */
+ssize_t
+broadcast_msgs(const u_int16_t port, const char *msgs, const size_t count,
+  const size_t msglen, int *results)
+{
+  ssize_t rv;
+  int error;
+  struct broadcaster *b = open_broadcaster(port);
+
+  if (b == NULL)
+    return -1;
+  rv = broadcaster_send_msgs(b, msgs, count, msglen, results);
+  error = errno;
+  close_broadcaster(b);
+  errno = error;
 
   return rv;
 }
+
+/*
+ * Broadcasts a UDP msg to all interfaces, except the loopback
+ * interface.  Since IPv6 doesn't support broadcast, this only works
+ * with IPv4; for IPv6, use a broadcaster with the BCAST_IPV6
+ * transport, which multicasts instead.
+ *
+ * Returns the number of bytes broadcast or -1 on error.
+ */
+ssize_t
+broadcast_msg(const u_int16_t port, const char *msg, const size_t msglen)
+{
+  int result;
+
+  if (broadcast_msgs(port, msg, 1, msglen, &result) == -1)
+    return -1;
+  if (result != 0) {
+    errno = result;
+    return -1;
+  }
+
+  return msglen;
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2012,2016 Jason J.A. Stephenson <jason@sigio.com>
+ * Copyright © 2012,2016,2026 Jason J.A. Stephenson <jason@sigio.com>
  *
  * This file is part of wake.
  *
@@ -20,6 +20,69 @@
 #define BROADCAST_INCL 1
 
 #include <sys/types.h>
+#include <netinet/in.h>
+
+/* How a broadcaster gets messages onto the wire: as UDP datagrams to
+ * the interfaces' broadcast addresses, as raw Ethernet frames, as the
+ * same UDP datagrams pushed through an io_uring, or as UDP datagrams
+ * to an IPv6 multicast group. */
+#define BCAST_UDP 0
+#define BCAST_RAW 1
+#define BCAST_URING 2
+#define BCAST_IPV6 3
+
+struct raw_sender;
+struct uring_sender;
+struct mcast6_sender;
+
+/*
+ * The broadcast addresses of the usable interfaces, with a pool of
+ * sockets, fds, each bound to one interface and connected to its
+ * address, so that many messages can share one lookup.  sock_fd is
+ * not bound and sends to single subnets, and watch_fd hears about
+ * interfaces changing.  group6 is where the IPv6 transport sends.
+ */
+struct broadcaster {
+  int sock_fd;
+  int watch_fd;
+  u_int16_t port;
+  struct sockaddr_in *addrs;
+  int *fds;
+  size_t count;
+  int transport;
+  struct raw_sender *raw;
+  struct uring_sender *uring;
+  struct in6_addr group6;
+  struct mcast6_sender *mcast6;
+};
+
+/* Where to send one message: to addr, out of interface ifindex, or,
+ * if ifindex is 0, to every broadcast address as usual. */
+struct bcast_dest {
+  struct sockaddr_in addr;
+  int ifindex;
+};
+
+struct broadcaster *open_broadcaster(const u_int16_t port);
+
+int broadcaster_set_transport(struct broadcaster *b, int transport);
+
+int broadcaster_set_group(struct broadcaster *b, const char *group);
+
+void close_broadcaster(struct broadcaster *b);
+
+ssize_t
+broadcaster_send_directed(struct broadcaster *b, const char *msgs,
+  const size_t count, const size_t msglen, const struct bcast_dest *dests,
+  int *results);
+
+ssize_t
+broadcaster_send_msgs(struct broadcaster *b, const char *msgs,
+  const size_t count, const size_t msglen, int *results);
+
+ssize_t
+broadcast_msgs(const u_int16_t port, const char *msgs, const size_t count,
+  const size_t msglen, int *results);
 
 ssize_t
 broadcast_msg(const u_int16_t port, const char *msg, const size_t msglen);
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2016 Jason J.A. Stephenson <jason@sigio.com>
+ * Copyright © 2016,2026 Jason J.A. Stephenson <jason@sigio.com>
  *
  * This file is part of wake.
  *
@@ -18,40 +18,114 @@
  */
 #include "build_msg.h"
 #include <string.h>
-#include <stdlib.h>
+
+/* Character classes for parse_macaddr.  Hexadecimal digits map to
+ * their value; everything else maps to one of these. */
+#define MAC_PUNCT 0x10
+#define MAC_OTHER 0x20
+
+/* The class of every byte, with [[:punct:]] as in the C locale. */
+#define P MAC_PUNCT
+#define O MAC_OTHER
+static const unsigned char mac_class[256] = {
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+  O, P, P, P, P, P, P, P, P, P, P, P, P, P, P, P,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, P, P, P, P, P, P,
+  P, 10, 11, 12, 13, 14, 15, O, O, O, O, O, O, O, O, O,
+  O, O, O, O, O, O, O, O, O, O, O, P, P, P, P, P,
+  P, 10, 11, 12, 13, 14, 15, O, O, O, O, O, O, O, O, O,
+  O, O, O, O, O, O, O, O, O, O, O, P, P, P, P, O,
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O
+};
+#undef P
+#undef O
 
 /*
- * Builds the magic packet for the mac address in the first argument.
+ * Checks and converts the len characters of macaddr in a single pass,
+ * without allocating anything.  A mac address is 6 groups of 1 or 2
+ * hexadecimal digits, each followed by a punctuation character or,
+ * for the last one, by the end of the string.  Anything after the
+ * sixth group is ignored.  These are the same addresses the regular
+ * expression ^([[:xdigit:]]{1,2}([[:punct:]]|$)){6} accepts.
  *
- * The magic packet message is returned in msgbuf which must be able
- * to hold 102 bytes, which is the space required for the magic
- * packet. The msgbuf is not nul-terminated (as it may contain nul
- * characters) and no checking is done of the space available in the
- * destination pointer.
+ * On success the 6 byte binary form is in mac.  On failure, if errpos
+ * is not NULL, it is set to the offset of the first character that
+ * does not fit, which is len if the string is too short.
  *
- * Returns a pointer to msgbuf on success or NULL on failure.
+ * Returns 1 if macaddr is a valid mac address and 0 if it is not.
  */
-char *
-build_msg(char *macaddr, char *msgbuf)
+int
+parse_macaddr(const char *macaddr, size_t len, unsigned char *mac,
+  size_t *errpos)
 {
-  char *next; /* Used in parsing the macaddr with strol. */
-  int i; /* a loop iterator */
-
-  /* The first 6 bytes of the magic packet should have the value of 0xFF. */
-  memset(msgbuf, 0xFF, 6);
+  const unsigned char *p = (const unsigned char *) macaddr;
+  size_t i = 0;
+  unsigned char c, byte;
+  int group;
 
-  /* The remaining 96 bytes of the magic packet are the mac address
-   * of the destination computer repeated 16 times. The mac address
-   * is stuffed into a string of 6 characters with each character
-   * having the numeric value of that byte from the mac address. */
+  for (group = 0; group < 6; group++) {
+    /* One hexadecimal digit is required, a second is optional. */
+    if (i == len || (byte = mac_class[p[i]]) > 0x0F)
+      goto BAD;
+    i++;
+    if (i < len && (c = mac_class[p[i]]) <= 0x0F) {
+      byte = (byte << 4) | c;
+      i++;
+    }
+    mac[group] = byte;
 
-  for (i = 6; i < 102; i++) {
-    if (i % 6 == 0)
-      next = macaddr;
-    msgbuf[i] = (char)strtol(macaddr + (next - macaddr), &next, 16);
-    next++;
+    /* Then a separator, or the end after the last group. */
+    if (i == len) {
+      if (group == 5)
+        break;
+      goto BAD;
+    }
+    if (mac_class[p[i]] != MAC_PUNCT)
+      goto BAD;
+    i++;
   }
 
-  return msgbuf;
+  return 1;
+
+BAD:
+  if (errpos != NULL)
+    *errpos = i;
+  return 0;
 }
 
+/*
+ * Builds the magic packet for a mac address that is already in its 6
+ * byte binary form.  The magic packet is 6 bytes of 0xFF followed by
+ * the mac address repeated 16 times.  It is returned in msgbuf, which
+ * must be able to hold MAGIC_PACKET_LEN (102) bytes; it is not
+ * nul-terminated, as it may contain nul characters, and no checking
+ * is done of the space available.
+ *
+ * After the 6 bytes of 0xFF and the first copy of the address, each
+ * copy doubles what is there, so the 16 repetitions take 4 fixed
+ * size copies that the compiler turns into a handful of wide moves.
+ *
+ * Returns a pointer to msgbuf.
+ */
+char *
+build_magic_packet(const unsigned char *mac, char *msgbuf)
+{
+  char *rep = msgbuf + 6;
+
+  memset(msgbuf, 0xFF, 6);
+  memcpy(rep, mac, 6);
+  memcpy(rep + 6, rep, 6);
+  memcpy(rep + 12, rep, 12);
+  memcpy(rep + 24, rep, 24);
+  memcpy(rep + 48, rep, 48);
+
+  return msgbuf;
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2016 Jason J.A. Stephenson <jason@sigio.com>
+ * Copyright © 2016,2026 Jason J.A. Stephenson <jason@sigio.com>
  *
  * This file is part of wake.
  *
@@ -19,7 +19,19 @@
 #ifndef BUILD_MSG_INCL
 #define BUILD_MSG_INCL 1
 
+#include <sys/types.h>
+
+/* The size of a magic packet. */
+#define MAGIC_PACKET_LEN 102
+
+/* Only this many characters of a mac address in wake.hosts count. */
+#define MACADDR_MAXLEN 17
+
+int
+parse_macaddr(const char *macaddr, size_t len, unsigned char *mac,
+  size_t *errpos);
+
 char *
-build_msg(char *macaddr, char *msgbuf);
+build_magic_packet(const unsigned char *mac, char *msgbuf);
 
 #endif
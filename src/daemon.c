@@ -0,0 +1,564 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "daemon.h"
+#include "build_msg.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#ifdef HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+/*
+ * The request protocol is one SOCK_SEQPACKET message per request,
+ * holding host names or mac addresses separated by white space.  The
+ * reply is one message with a line per token, in the same order:
+ *
+ *     ok TOKEN
+ *     unknown TOKEN          (not in wake.hosts and not a mac address)
+ *     invalid TOKEN          (in wake.hosts with a bad mac address)
+ *     error TOKEN: MESSAGE   (the broadcast failed)
+ *
+ * A request that is too long gets the single line "error: MESSAGE".
+ */
+
+/* The most tokens that fit in a request. */
+#define DAEMON_MAX_TOKENS (WAKE_DAEMON_MSG_MAX / 2 + 1)
+
+/* How many events to take from epoll_wait at once. */
+#define DAEMON_EVENTS 64
+
+/* Token status values other than an errno value from sending. */
+#define TOKEN_OK 0
+#define TOKEN_UNKNOWN -1
+#define TOKEN_INVALID -2
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_UN_H)
+
+/* What separates the tokens of a request. */
+static const char request_space[] = " \t\n\r\v\f";
+
+/* Set by the signal handler to make run_wake_daemon return. */
+static volatile sig_atomic_t daemon_stopping;
+
+static void stop_wake_daemon(int signum)
+{
+  (void) signum;
+  daemon_stopping = 1;
+}
+
+/*
+ * Makes a nonblocking SOCK_SEQPACKET socket listening at path.  A
+ * socket file left behind by a daemon that is no longer running is
+ * replaced, but one that is still answering is not.
+ *
+ * Returns the socket or -1 on error.
+ */
+static int open_daemon_socket(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd, probe, error;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    if (errno != EADDRINUSE)
+      goto FAILED;
+    /* See whether anyone is still listening there. */
+    probe = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (probe == -1)
+      goto FAILED;
+    if (connect(probe, (struct sockaddr *) &addr, sizeof(addr)) == 0
+        || errno != ECONNREFUSED) {
+      close(probe);
+      errno = EADDRINUSE;
+      goto FAILED;
+    }
+    close(probe);
+    if (unlink(path) == -1
+        || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+      goto FAILED;
+  }
+
+  if (listen(fd, SOMAXCONN) == -1) {
+    error = errno;
+    unlink(path);
+    errno = error;
+    goto FAILED;
+  }
+
+  return fd;
+
+FAILED:
+  error = errno;
+  close(fd);
+  errno = error;
+  return -1;
+}
+
+/* Adds fd to the daemon's epoll set, waiting for input. */
+static int watch_daemon_fd(struct wake_daemon *d, int fd)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+struct wake_daemon *open_wake_daemon(const char *sockpath,
+  struct host_table *table, struct host_reloader *reloader,
+  struct broadcaster *b)
+{
+  struct wake_daemon *d;
+  int error = 0;
+
+  d = calloc(1, sizeof(struct wake_daemon));
+  if (d == NULL)
+    return NULL;
+  d->listen_fd = -1;
+  d->epoll_fd = -1;
+  d->watch_fd = -1;
+  d->table = table;
+  d->reloader = reloader;
+  d->b = b;
+
+  d->sockpath = strdup(sockpath);
+  d->request = malloc(WAKE_DAEMON_MSG_MAX + 1);
+  d->tokens = calloc(DAEMON_MAX_TOKENS, sizeof(char *));
+  d->status = calloc(DAEMON_MAX_TOKENS, sizeof(int));
+  d->magic = malloc(DAEMON_MAX_TOKENS * MAGIC_PACKET_LEN);
+  d->dests = calloc(DAEMON_MAX_TOKENS, sizeof(struct bcast_dest));
+  d->results = calloc(DAEMON_MAX_TOKENS, sizeof(int));
+  d->reply_size = 2 * WAKE_DAEMON_MSG_MAX;
+  d->reply = malloc(d->reply_size);
+  if (d->sockpath == NULL || d->request == NULL || d->tokens == NULL
+      || d->status == NULL || d->magic == NULL || d->dests == NULL
+      || d->results == NULL || d->reply == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  d->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (d->epoll_fd == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Creating epoll instance\n");
+#endif
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  d->listen_fd = open_daemon_socket(sockpath);
+  if (d->listen_fd == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Opening socket %s\n", sockpath);
+#endif
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  if (watch_daemon_fd(d, d->listen_fd) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  /* Listen before looking, so no change can slip in between.  Without
+   * the routes, every host is woken everywhere. */
+  d->watch_fd = open_link_watch();
+  if (d->watch_fd != -1 && watch_daemon_fd(d, d->watch_fd) == -1) {
+    close(d->watch_fd);
+    d->watch_fd = -1;
+  }
+#ifdef DEBUG
+  if (d->watch_fd == -1)
+    fprintf(stderr, "Watching interfaces: %s\n", strerror(errno));
+#endif
+  d->routes = load_route_table();
+#ifdef DEBUG
+  if (d->routes == NULL)
+    fprintf(stderr, "Can't load routes: %s\n", strerror(errno));
+#endif
+
+CLEAN_UP:
+  if (error) {
+    close_wake_daemon(d);
+    errno = error;
+    return NULL;
+  }
+
+  return d;
+}
+
+/*
+ * Appends len bytes at s to the reply, which is used bytes long so
+ * far, growing the reply buffer if it needs to.
+ *
+ * Returns the new length of the reply or -1 if it can't grow.
+ */
+static ssize_t add_to_reply(struct wake_daemon *d, size_t used,
+  const char *s, size_t len)
+{
+  size_t size;
+  char *t;
+
+  if (used + len > d->reply_size) {
+    size = d->reply_size;
+    while (used + len > size)
+      size *= 2;
+    t = realloc(d->reply, size);
+    if (t == NULL)
+      return -1;
+    d->reply = t;
+    d->reply_size = size;
+  }
+  memcpy(d->reply + used, s, len);
+  return used + len;
+}
+
+/*
+ * Wakes the hosts named in the len byte request and writes the reply
+ * for it.
+ *
+ * Returns the length of the reply or -1 on error.
+ */
+static ssize_t handle_daemon_request(struct wake_daemon *d, size_t len)
+{
+  const struct host_version *v = NULL;
+  struct hostinfo *host;
+  const unsigned char *mac;
+  unsigned char rawmac[6];
+  char *p = d->request, *end = d->request + len;
+  size_t ntokens = 0, nhosts = 0, i, j;
+  ssize_t used = 0;
+  const char *word;
+
+  /* Split the request into nul-terminated tokens.  strchr finds the
+   * nul at the end of request_space, so stray nul bytes count as
+   * white space, too. */
+  *end = 0;
+  while (p < end) {
+    while (p < end && strchr(request_space, *p) != NULL)
+      p++;
+    if (p == end)
+      break;
+    d->tokens[ntokens++] = p;
+    while (p < end && strchr(request_space, *p) == NULL)
+      p++;
+    *p++ = 0;
+  }
+
+  /*
+   * Names in wake.hosts win over tokens that look like mac addresses.
+   * Hosts with a known subnet are only woken there; the rest, and raw
+   * mac addresses, go to every interface.  The version of wake.hosts
+   * is held only while looking up, since the packets are built by
+   * then.
+   */
+  if (d->reloader != NULL)
+    v = host_reloader_enter(d->reloader);
+  for (i = 0; i < ntokens; i++) {
+    host = v != NULL ? host_version_find(v, d->tokens[i])
+      : host_table_find(d->table, d->tokens[i]);
+    mac = NULL;
+    memset(&d->dests[nhosts], 0, sizeof(struct bcast_dest));
+    if (host != NULL) {
+      if (host->ipaddr != 0 && d->routes != NULL)
+        find_wake_dest(d->routes, host->ipaddr, host->prefix,
+          &d->dests[nhosts]);
+      if (host->macvalid)
+        mac = host->mac;
+      else
+        d->status[i] = TOKEN_INVALID;
+    }
+    else if (parse_macaddr(d->tokens[i], strlen(d->tokens[i]), rawmac,
+        NULL))
+      mac = rawmac;
+    else
+      d->status[i] = TOKEN_UNKNOWN;
+    if (mac != NULL) {
+      build_magic_packet(mac, d->magic + nhosts++ * MAGIC_PACKET_LEN);
+      d->status[i] = TOKEN_OK;
+    }
+  }
+  if (v != NULL)
+    host_reloader_leave(d->reloader);
+
+  /* Send everything at once, then pick up the result of each packet. */
+  if (nhosts > 0
+      && broadcaster_send_directed(d->b, d->magic, nhosts, MAGIC_PACKET_LEN,
+        d->dests, d->results) == -1)
+    for (j = 0; j < nhosts; j++)
+      d->results[j] = errno;
+  for (i = 0, j = 0; i < ntokens; i++)
+    if (d->status[i] == TOKEN_OK)
+      d->status[i] = d->results[j++];
+
+  for (i = 0; i < ntokens && used != -1; i++) {
+    switch (d->status[i]) {
+    case TOKEN_OK:
+      word = "ok ";
+      break;
+    case TOKEN_UNKNOWN:
+      word = "unknown ";
+      break;
+    case TOKEN_INVALID:
+      word = "invalid ";
+      break;
+    default:
+      word = "error ";
+    }
+    used = add_to_reply(d, used, word, strlen(word));
+    if (used != -1)
+      used = add_to_reply(d, used, d->tokens[i], strlen(d->tokens[i]));
+    if (used != -1 && d->status[i] > 0) {
+      used = add_to_reply(d, used, ": ", 2);
+      word = strerror(d->status[i]);
+      if (used != -1)
+        used = add_to_reply(d, used, word, strlen(word));
+    }
+    if (used != -1)
+      used = add_to_reply(d, used, "\n", 1);
+  }
+
+  return used;
+}
+
+/*
+ * Answers every request waiting on the client socket fd.
+ *
+ * Returns 0 when there are no more for now or -1 when the client has
+ * gone away or can't be talked to, and should be dropped.
+ */
+static int serve_daemon_client(struct wake_daemon *d, int fd)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  ssize_t len, replylen;
+  char toolong[128];
+
+  for (;;) {
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = d->request;
+    iov.iov_len = WAKE_DAEMON_MSG_MAX;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    len = recvmsg(fd, &msg, 0);
+    if (len == -1)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+        ? 0 : -1;
+    if (len == 0)
+      return -1;
+
+    if (msg.msg_flags & MSG_TRUNC) {
+      replylen = snprintf(toolong, sizeof(toolong), "error: %s\n",
+        strerror(EMSGSIZE));
+      if (send(fd, toolong, replylen, MSG_NOSIGNAL) == -1)
+        return -1;
+      continue;
+    }
+
+    replylen = handle_daemon_request(d, len);
+    if (replylen == -1) {
+      replylen = snprintf(toolong, sizeof(toolong), "error: %s\n",
+        strerror(errno));
+      if (send(fd, toolong, replylen, MSG_NOSIGNAL) == -1)
+        return -1;
+    }
+    else if (send(fd, d->reply, replylen, MSG_NOSIGNAL) == -1)
+      return -1;
+  }
+}
+
+/*
+ * Loads the routes again if a link or address has changed since they
+ * were last loaded, so that hosts are aimed at the subnets and
+ * interfaces there are now.  If they can't be loaded, the old ones are
+ * kept, and if the watch itself fails, it is closed and the routes
+ * stay as they are from then on.
+ */
+static void refresh_daemon_routes(struct wake_daemon *d)
+{
+  struct route_table *rt;
+
+  switch (link_watch_changed(d->watch_fd)) {
+  case 0:
+    return;
+  case -1:
+#ifdef DEBUG
+    fprintf(stderr, "Watching interfaces: %s\n", strerror(errno));
+#endif
+    /* Closing the socket takes it out of the epoll set, too. */
+    close(d->watch_fd);
+    d->watch_fd = -1;
+    return;
+  }
+
+  rt = load_route_table();
+  if (rt == NULL) {
+#ifdef DEBUG
+    fprintf(stderr, "Can't load routes: %s\n", strerror(errno));
+#endif
+    return;
+  }
+  free_route_table(d->routes);
+  d->routes = rt;
+}
+
+/* Takes every connection waiting on the listening socket. */
+static void accept_daemon_clients(struct wake_daemon *d)
+{
+  int fd;
+
+  while ((fd = accept4(d->listen_fd, NULL, NULL,
+          SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    if (watch_daemon_fd(d, fd) == -1) {
+#ifdef DEBUG
+      fprintf(stderr, "Watching client: %s\n", strerror(errno));
+#endif
+      close(fd);
+    }
+}
+
+/*
+ * Serves requests until SIGINT or SIGTERM arrives.  Everything waits
+ * on the one epoll instance, so a burst of requests from many clients
+ * is handled without a thread or process per client.
+ *
+ * Returns 0 when stopped by a signal or -1 on error.
+ */
+int run_wake_daemon(struct wake_daemon *d)
+{
+  struct epoll_event events[DAEMON_EVENTS];
+  struct sigaction sa;
+  sigset_t stop, old, waiting;
+  int n, i, fd, error;
+
+  /* No SA_RESTART, so that epoll_pwait returns when we are told to
+   * stop. */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop_wake_daemon;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  daemon_stopping = 0;
+
+  /* The signals are only let in while waiting, so one that comes
+   * after daemon_stopping is checked still cuts the wait short. */
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  sigprocmask(SIG_BLOCK, &stop, &old);
+  waiting = old;
+  sigdelset(&waiting, SIGINT);
+  sigdelset(&waiting, SIGTERM);
+
+  while (!daemon_stopping) {
+    n = epoll_pwait(d->epoll_fd, events, DAEMON_EVENTS, -1, &waiting);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      error = errno;
+      sigprocmask(SIG_SETMASK, &old, NULL);
+      errno = error;
+      return -1;
+    }
+    for (i = 0; i < n; i++) {
+      fd = events[i].data.fd;
+      if (fd == d->listen_fd)
+        accept_daemon_clients(d);
+      else if (fd == d->watch_fd)
+        refresh_daemon_routes(d);
+      else if (((events[i].events & EPOLLIN)
+            && serve_daemon_client(d, fd) == -1)
+          || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+        /* Closing the socket takes it out of the epoll set, too. */
+        close(fd);
+      }
+    }
+  }
+
+  sigprocmask(SIG_SETMASK, &old, NULL);
+  return 0;
+}
+
+#else /* no epoll or no UNIX domain sockets */
+
+struct wake_daemon *open_wake_daemon(const char *sockpath,
+  struct host_table *table, struct host_reloader *reloader,
+  struct broadcaster *b)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+int run_wake_daemon(struct wake_daemon *d)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
+
+/*
+ * Closes the sockets, removes the socket file and frees what
+ * open_wake_daemon allocated, the routes included.  The host table,
+ * reloader and broadcaster belong to the caller.  Client sockets are
+ * left for exit to close.
+ */
+void close_wake_daemon(struct wake_daemon *d)
+{
+  if (d == NULL)
+    return;
+  if (d->listen_fd != -1) {
+    close(d->listen_fd);
+    unlink(d->sockpath);
+  }
+  if (d->epoll_fd != -1)
+    close(d->epoll_fd);
+  if (d->watch_fd != -1)
+    close(d->watch_fd);
+  free_route_table(d->routes);
+  free(d->sockpath);
+  free(d->request);
+  free(d->tokens);
+  free(d->status);
+  free(d->magic);
+  free(d->dests);
+  free(d->results);
+  free(d->reply);
+  free(d);
+}
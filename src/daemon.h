@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMON_INCL
+#define DAEMON_INCL 1
+
+#include "hosttable.h"
+#include "hostreload.h"
+#include "broadcast.h"
+#include "netlink.h"
+#include <sys/types.h>
+
+#ifndef LOCALSTATEDIR
+#define LOCALSTATEDIR "/var"
+#endif
+
+/* Where wake --daemon listens when it isn't given a socket path. */
+#define WAKE_DAEMON_SOCKET LOCALSTATEDIR "/run/wake.sock"
+
+/* The longest request the daemon accepts, in bytes. */
+#define WAKE_DAEMON_MSG_MAX 8192
+
+/*
+ * A running wake daemon: the listening socket, the epoll instance
+ * that watches it and its clients, and everything that is loaded
+ * once and shared by all requests.  Hosts are looked up in the
+ * reloader's current version if there is a reloader, and in table if
+ * not.  The routes are loaded again whenever the link watch hears of
+ * a change.  The buffers are big enough for the most tokens a request
+ * can hold.
+ */
+struct wake_daemon {
+  int listen_fd;
+  int epoll_fd;
+  int watch_fd; /* from open_link_watch, or -1 */
+  char *sockpath;
+  struct host_table *table;
+  struct host_reloader *reloader;
+  struct broadcaster *b;
+  struct route_table *routes;
+  char *request;
+  char **tokens;
+  int *status;
+  char *magic;
+  struct bcast_dest *dests;
+  int *results;
+  char *reply;
+  size_t reply_size;
+};
+
+struct wake_daemon *open_wake_daemon(const char *sockpath,
+  struct host_table *table, struct host_reloader *reloader,
+  struct broadcaster *b);
+
+int run_wake_daemon(struct wake_daemon *d);
+
+void close_wake_daemon(struct wake_daemon *d);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "hostindex.h"
+#include <stdlib.h>
+
+/* The smallest table we bother with.  It must be a power of 2. */
+#define MIN_INDEX_SIZE 16
+
+/* What the key of a slot whose name was removed points to. */
+static const char tombstone[1];
+
+/* Folds an ASCII letter to lower case, the way strcasecmp does in
+ * the C locale. */
+#define FOLD(c) (((c) >= 'A' && (c) <= 'Z') ? (c) + ('a' - 'A') : (c))
+
+/*
+ * Hashes len bytes of name with 32 bit FNV-1a after folding each byte
+ * to lower case, so names that differ only in case hash the same.
+ */
+u_int32_t hash_host_name(const char *name, size_t len)
+{
+  u_int32_t h = 2166136261U;
+  const unsigned char *p = (const unsigned char *) name;
+
+  while (len--) {
+    h ^= FOLD(*p);
+    h *= 16777619U;
+    p++;
+  }
+
+  return h;
+}
+
+/*
+ * Hashes len bytes of name with 64 bit FNV-1a after folding each byte
+ * to lower case.  This is for tables that need more bits than
+ * hash_host_name gives.
+ */
+u_int64_t hash_host_name64(const char *name, size_t len)
+{
+  u_int64_t h = 14695981039346656037ULL;
+  const unsigned char *p = (const unsigned char *) name;
+
+  while (len--) {
+    h ^= FOLD(*p);
+    h *= 1099511628211ULL;
+    p++;
+  }
+
+  return h;
+}
+
+/*
+ * Compares two names of the same length without regard to case.
+ *
+ * Returns 1 if they match and 0 if they do not.
+ */
+int host_names_match(const char *a, const char *b, size_t len)
+{
+  const unsigned char *x = (const unsigned char *) a;
+  const unsigned char *y = (const unsigned char *) b;
+
+  while (len--) {
+    if (FOLD(*x) != FOLD(*y))
+      return 0;
+    x++;
+    y++;
+  }
+
+  return 1;
+}
+
+/*
+ * Returns the slot holding key or, if it isn't there, the slot where
+ * it belongs: the first removed one on the way, or else the empty one
+ * at the end.
+ */
+static struct host_index_slot *find_slot(const struct host_index *idx,
+  const char *key, size_t len, u_int32_t hash)
+{
+  size_t mask = idx->size - 1;
+  size_t i = hash & mask;
+  struct host_index_slot *slot, *removed = NULL;
+
+  for (;;) {
+    slot = &idx->slots[i];
+    if (slot->key == NULL)
+      return removed != NULL ? removed : slot;
+    if (slot->key == tombstone) {
+      if (removed == NULL)
+        removed = slot;
+    }
+    else if (slot->hash == hash && slot->len == len
+        && host_names_match(slot->key, key, len))
+      return slot;
+    i = (i + 1) & mask;
+  }
+}
+
+/* Puts the entries into a table of size slots, leaving out the
+ * removed ones. */
+static int rehash_host_index(struct host_index *idx, size_t size)
+{
+  struct host_index_slot *old = idx->slots, *slot;
+  size_t oldsize = idx->size, i;
+
+  idx->slots = calloc(size, sizeof(struct host_index_slot));
+  if (idx->slots == NULL) {
+    idx->slots = old;
+    return -1;
+  }
+  idx->size = size;
+  idx->tombstones = 0;
+  for (i = 0; i < oldsize; i++)
+    if (old[i].key != NULL && old[i].key != tombstone) {
+      slot = find_slot(idx, old[i].key, old[i].len, old[i].hash);
+      *slot = old[i];
+    }
+  free(old);
+
+  return 0;
+}
+
+/*
+ * Creates an empty index with room for at least hint names before it
+ * has to grow.
+ *
+ * Returns a pointer to the new index or NULL if it cannot be allocated.
+ */
+struct host_index *new_host_index(size_t hint)
+{
+  struct host_index *idx = malloc(sizeof(struct host_index));
+  size_t size = MIN_INDEX_SIZE;
+
+  if (idx == NULL)
+    return NULL;
+  while (size < hint * 2)
+    size <<= 1;
+  idx->slots = calloc(size, sizeof(struct host_index_slot));
+  if (idx->slots == NULL) {
+    free(idx);
+    return NULL;
+  }
+  idx->size = size;
+  idx->count = 0;
+  idx->tombstones = 0;
+
+  return idx;
+}
+
+/*
+ * Adds len bytes of key to the index with data.  If the name is
+ * already in the index, the data already there is kept, which gives
+ * the same first match wins behavior as searching the list of hosts
+ * from the beginning.
+ *
+ * Returns 0 if the key was added, 1 if it was already present and -1
+ * if the index could not grow to hold it.
+ */
+int host_index_add(struct host_index *idx, const char *key, size_t len,
+  void *data)
+{
+  struct host_index_slot *slot;
+  u_int32_t hash = hash_host_name(key, len);
+
+  slot = find_slot(idx, key, len, hash);
+  if (slot->key != NULL && slot->key != tombstone)
+    return 1;
+
+  /* Keep the table at most half full, counting removed names, so probe
+   * sequences stay short.  If it is mostly removed names, clearing
+   * them out makes room enough. */
+  if (slot->key == NULL
+      && (idx->count + idx->tombstones + 1) * 2 > idx->size) {
+    if (rehash_host_index(idx, (idx->count + 1) * 4 > idx->size
+          ? idx->size * 2 : idx->size) == -1)
+      return -1;
+    slot = find_slot(idx, key, len, hash);
+  }
+  if (slot->key == tombstone)
+    idx->tombstones--;
+  slot->hash = hash;
+  slot->len = len;
+  slot->key = key;
+  slot->data = data;
+  idx->count++;
+
+  return 0;
+}
+
+/*
+ * Looks up len bytes of key in the index.
+ *
+ * Returns the data stored for the name or NULL if it is not there.
+ */
+void *host_index_find(const struct host_index *idx, const char *key,
+  size_t len)
+{
+  struct host_index_slot *slot;
+
+  slot = find_slot(idx, key, len, hash_host_name(key, len));
+  return slot->key != NULL && slot->key != tombstone ? slot->data : NULL;
+}
+
+/*
+ * Takes len bytes of key out of the index.  Its slot is marked as
+ * removed rather than emptied, so that names further along the same
+ * probe sequence can still be found; the next name added there, or
+ * the next time the table grows, reuses it.
+ *
+ * Returns the data stored for the name or NULL if it was not there.
+ */
+void *host_index_remove(struct host_index *idx, const char *key,
+  size_t len)
+{
+  struct host_index_slot *slot;
+  void *data;
+
+  slot = find_slot(idx, key, len, hash_host_name(key, len));
+  if (slot->key == NULL || slot->key == tombstone)
+    return NULL;
+  data = slot->data;
+  slot->key = tombstone;
+  slot->data = NULL;
+  idx->count--;
+  idx->tombstones++;
+
+  return data;
+}
+
+/*
+ * Frees the index.  The keys and data are not touched.
+ */
+void free_host_index(struct host_index *idx)
+{
+  if (idx == NULL)
+    return;
+  free(idx->slots);
+  free(idx);
+}
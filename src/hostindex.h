@@ -0,0 +1,65 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HOSTINDEX_INCL
+#define HOSTINDEX_INCL 1
+
+#include <sys/types.h>
+
+/*
+ * An open addressing hash table that maps host names to arbitrary
+ * data.  Names are compared without regard to case, the same way
+ * strcasecmp compares them, and the first data added for a name is
+ * the one that is kept.  The index does not copy the names, so they
+ * must live at least as long as the index does.  Removed names leave
+ * a marker in their slot until the table is rebuilt.
+ */
+struct host_index_slot {
+  u_int32_t hash;
+  u_int32_t len;
+  const char *key;
+  void *data;
+};
+
+struct host_index {
+  struct host_index_slot *slots;
+  size_t size; /* always a power of 2 */
+  size_t count;
+  size_t tombstones; /* slots of removed names */
+};
+
+u_int32_t hash_host_name(const char *name, size_t len);
+
+u_int64_t hash_host_name64(const char *name, size_t len);
+
+int host_names_match(const char *a, const char *b, size_t len);
+
+struct host_index *new_host_index(size_t hint);
+
+int host_index_add(struct host_index *idx, const char *key, size_t len,
+  void *data);
+
+void *host_index_find(const struct host_index *idx, const char *key,
+  size_t len);
+
+void *host_index_remove(struct host_index *idx, const char *key,
+  size_t len);
+
+void free_host_index(struct host_index *idx);
+
+#endif
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2012 Jason J.A. Stephenson <jason@sigio.com>
+ * Copyright © 2012,2026 Jason J.A. Stephenson <jason@sigio.com>
  *
  * This file is part of wake.
  *
@@ -19,26 +19,31 @@
 #ifndef HOSTINFO_INCL
 #define HOSTINFO_INCL 1
 
-#include "list.h"
+#include "hostindex.h"
+#include <sys/types.h>
 
 #ifndef SYSCONFDIR
 #define SYSCONFDIR "/etc"
 #endif
 
-/* Used to hold hostname/mac address pairs read from the file. */
+/* Used to hold hostname/mac address pairs read from the file.  The
+ * mac address is checked and converted to binary when it is read, and
+ * macvalid says whether mac holds the result.  ipaddr and prefix are
+ * the host's IPv4 address and subnet, if the file gives them, with
+ * ipaddr in network byte order and 0 if it doesn't. */
 struct hostinfo {
   char *name;
   char *macaddr;
+  unsigned char mac[6];
+  int macvalid;
+  u_int32_t ipaddr;
+  unsigned char prefix;
 };
 
 char *find_wake_hosts_file_path(void);
 
-list_t *parse_wake_hosts_file(char *path);
-
-void free_wake_hosts_list(list_t *list);
+char *find_wake_hosts_db_path(char *path);
 
 int hostcasecmpname(struct hostinfo *a, struct hostinfo *b);
 
-struct hostinfo *find_host_by_name(list_t *list, char *name);
-
 #endif
@@ -0,0 +1,785 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "hostreload.h"
+#include "hostsmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+/* How long the file has to be left alone after a change before it is
+ * read again, so that a burst of writes makes one reload. */
+#define RELOAD_SETTLE_MS 200
+
+/* But a file that is written to all the time is still read this
+ * often. */
+#define RELOAD_MAX_DELAY_MS 2000
+
+/* If more than one line in this many has changed, the indexes are
+ * made afresh rather than edited. */
+#define RELOAD_REBUILD_RATIO 4
+
+/* A slot of a line map.  The hash is kept here as well, so that
+ * probing doesn't have to touch the lines. */
+struct line_slot {
+  u_int64_t hash;
+  struct host_line *line;
+};
+
+/* The lines of one version of the file by hash, with open addressing.
+ * Identical lines each get a slot of their own. */
+struct line_map {
+  struct line_slot *slots;
+  size_t size; /* always a power of 2 */
+};
+
+/* A name whose entry changes in a reload, and the first line that has
+ * it afterwards, if any still does. */
+struct name_change {
+  const char *name;
+  size_t len;
+  struct host_line *winner;
+};
+
+static void free_line_map(struct line_map *m)
+{
+  if (m == NULL)
+    return;
+  free(m->slots);
+  free(m);
+}
+
+/*
+ * Marks the current version as in use by the reader and returns it.
+ * The version stays as it is until host_reloader_leave, however the
+ * file changes.  This never waits.
+ */
+const struct host_version *host_reloader_enter(struct host_reloader *r)
+{
+  struct host_version *v;
+
+  /* Check that the version is still current once it is marked, or the
+   * reloader may have missed the mark. */
+  do {
+    v = __atomic_load_n(&r->current, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&r->hazard, v, __ATOMIC_SEQ_CST);
+  } while (__atomic_load_n(&r->current, __ATOMIC_SEQ_CST) != v);
+
+  return v;
+}
+
+/* Lets go of the version that host_reloader_enter returned. */
+void host_reloader_leave(struct host_reloader *r)
+{
+  __atomic_store_n(&r->hazard, NULL, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Looks up name in v without regard to case.
+ *
+ * Returns the entry for it or NULL if there is none.
+ */
+struct hostinfo *host_version_find(const struct host_version *v,
+  const char *name)
+{
+  return host_index_find(v->index, name, strlen(name));
+}
+
+/* Returns how many different host names v has. */
+size_t host_version_count(const struct host_version *v)
+{
+  return v->index->count;
+}
+
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_PTHREAD_H)
+
+/*
+ * Hashes the len bytes of a line eight at a time.  Unlike host names,
+ * lines are hashed with regard to case, since a change of case in a
+ * mac address is a change to the line.
+ */
+static u_int64_t hash_line(const char *text, size_t len)
+{
+  u_int64_t h = 0x9E3779B97F4A7C15ULL ^ len, w;
+
+  while (len >= 8) {
+    memcpy(&w, text, 8);
+    h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 32;
+    text += 8;
+    len -= 8;
+  }
+  w = 0;
+  memcpy(&w, text, len);
+  h = (h ^ w) * 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 29;
+
+  return h;
+}
+
+/* Makes a map of the n lines.  Returns it or NULL on error. */
+static struct line_map *new_line_map(struct host_line **lines, size_t n)
+{
+  struct line_map *m;
+  size_t i, j, mask;
+
+  m = malloc(sizeof(struct line_map));
+  if (m == NULL)
+    return NULL;
+  for (m->size = 16; m->size < n * 2; m->size <<= 1)
+    ;
+  m->slots = calloc(m->size, sizeof(struct line_slot));
+  if (m->slots == NULL) {
+    free(m);
+    return NULL;
+  }
+  mask = m->size - 1;
+  for (i = 0; i < n; i++) {
+    for (j = lines[i]->hash & mask; m->slots[j].line != NULL;
+         j = (j + 1) & mask)
+      ;
+    m->slots[j].hash = lines[i]->hash;
+    m->slots[j].line = lines[i];
+  }
+
+  return m;
+}
+
+/*
+ * Finds a line in the map with the len bytes of text, whose hash is
+ * given, that this reload, generation gen, hasn't already found, and
+ * marks it found.
+ *
+ * Returns the line or NULL if there is none.
+ */
+static struct host_line *take_line(struct line_map *m, u_int64_t hash,
+  const char *text, size_t len, unsigned long gen)
+{
+  struct host_line *ln;
+  size_t i, mask;
+
+  if (m == NULL)
+    return NULL;
+  mask = m->size - 1;
+  for (i = hash & mask; (ln = m->slots[i].line) != NULL; i = (i + 1) & mask)
+    if (m->slots[i].hash == hash && ln->len == len && ln->seen != gen
+        && memcmp(ln->text, text, len) == 0) {
+      ln->seen = gen;
+      return ln;
+    }
+
+  return NULL;
+}
+
+/*
+ * Parses len bytes of text, one line of wake.hosts, by the same rules
+ * as next_host_view.
+ *
+ * Returns a new line or NULL, with errno set to 0 if the line holds no
+ * host or to an error.
+ */
+static struct host_line *parse_host_line(const char *text, size_t len,
+  u_int64_t hash)
+{
+  struct hosts_map map;
+  struct host_view view;
+  struct host_line *ln;
+  size_t pos = 0, maclen;
+
+  map.base = (char *) text;
+  map.size = len;
+  if (!next_host_view(text, len, &pos, &view)) {
+    errno = 0;
+    return NULL;
+  }
+  decode_host_view(&map, &view);
+  maclen = HOST_VIEW_MACLEN(&view);
+
+  ln = malloc(sizeof(struct host_line) + view.name_len + maclen + 2 + len);
+  if (ln == NULL)
+    return NULL;
+  ln->hash = hash;
+  ln->len = len;
+  ln->seen = 0;
+  ln->pos = 0;
+  ln->namelen = view.name_len;
+  ln->host.name = (char *) (ln + 1);
+  memcpy(ln->host.name, text + view.name_off, view.name_len);
+  ln->host.name[view.name_len] = '\0';
+  ln->host.macaddr = ln->host.name + view.name_len + 1;
+  memcpy(ln->host.macaddr, text + view.mac_off, maclen);
+  ln->host.macaddr[maclen] = '\0';
+  ln->text = ln->host.macaddr + maclen + 1;
+  memcpy((char *) ln->text, text, len);
+  memcpy(ln->host.mac, view.mac, 6);
+  ln->host.macvalid = view.macvalid;
+  ln->host.ipaddr = view.ipaddr;
+  ln->host.prefix = view.prefix;
+
+  return ln;
+}
+
+/* Indexes the n lines by name, the first line for a name winning.
+ * Returns the index or NULL on error. */
+static struct host_index *index_host_lines(struct host_line **lines,
+  size_t n)
+{
+  struct host_index *idx;
+  size_t i;
+
+  idx = new_host_index(n);
+  for (i = 0; idx != NULL && i < n; i++)
+    if (host_index_add(idx, lines[i]->host.name, lines[i]->namelen,
+          &lines[i]->host) == -1) {
+      free_host_index(idx);
+      idx = NULL;
+    }
+
+  return idx;
+}
+
+/*
+ * Brings v up to date: makes its index afresh from the n lines if
+ * rebuild is set, or else applies the count changes to it.
+ *
+ * Returns 0 on success or -1 on error, when v may be half done.
+ */
+static int update_host_version(struct host_version *v, int rebuild,
+  struct host_line **lines, size_t n, const struct name_change *changes,
+  size_t count)
+{
+  struct host_index *idx;
+  const struct name_change *c;
+
+  if (rebuild) {
+    idx = index_host_lines(lines, n);
+    if (idx == NULL)
+      return -1;
+    free_host_index(v->index);
+    v->index = idx;
+    return 0;
+  }
+  for (c = changes; c < changes + count; c++) {
+    host_index_remove(v->index, c->name, c->len);
+    if (c->winner != NULL && host_index_add(v->index, c->winner->host.name,
+          c->winner->namelen, &c->winner->host) == -1)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* Adds a change for line's name to changes, unless it is already
+ * there.  Returns 0 on success or -1 on error. */
+static int add_name_change(struct host_index *names,
+  struct name_change *changes, size_t *count, struct host_line *ln)
+{
+  switch (host_index_add(names, ln->host.name, ln->namelen,
+        &changes[*count])) {
+  case -1:
+    return -1;
+  case 0:
+    changes[*count].name = ln->host.name;
+    changes[*count].len = ln->namelen;
+    changes[*count].winner = NULL;
+    (*count)++;
+  }
+  return 0;
+}
+
+/*
+ * Tells whether ln, a line that this reload, generation gen, kept,
+ * now comes before the line that has its name in the current index.
+ * If so, the name has a new first line, though no line with it came
+ * or went.
+ */
+static int line_moved_ahead(struct host_reloader *r, struct host_line *ln,
+  unsigned long gen)
+{
+  struct hostinfo *host;
+  struct host_line *first;
+
+  host = host_index_find(r->current->index, ln->host.name, ln->namelen);
+  if (host == NULL || host == &ln->host)
+    return 0;
+  first = (struct host_line *) ((char *) host
+    - offsetof(struct host_line, host));
+  return first->seen == gen && first->pos > ln->pos;
+}
+
+/*
+ * Works out what changed for the names of the lines that were added
+ * to or removed from the file, or that were moved ahead of the first
+ * line with the same name, and which line now has each of them.
+ *
+ * Returns the changes, which must be freed, and sets *count, or
+ * returns NULL on error.
+ */
+static struct name_change *find_name_changes(struct host_reloader *r,
+  struct host_line **lines, size_t nlines, size_t nchanged,
+  unsigned long gen, size_t *count)
+{
+  struct name_change *changes, *c;
+  struct host_index *names;
+  size_t i, nmoved = 0;
+  int error = 0;
+
+  /* The names index points into changes, so make room for every
+   * change first. */
+  for (i = 0; i < nlines; i++)
+    if (lines[i]->seen == gen && line_moved_ahead(r, lines[i], gen))
+      nmoved++;
+
+  *count = 0;
+  changes = calloc(nchanged + nmoved + 1, sizeof(struct name_change));
+  names = new_host_index(nchanged + nmoved);
+  if (changes == NULL || names == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  for (i = 0; i < nlines && !error; i++)
+    if (lines[i]->seen == 0
+        && add_name_change(names, changes, count, lines[i]) == -1)
+      error = errno;
+  for (i = 0; i < r->nlines && !error; i++)
+    if (r->lines[i]->seen != gen
+        && add_name_change(names, changes, count, r->lines[i]) == -1)
+      error = errno;
+  for (i = 0; i < nlines && nmoved > 0 && !error; i++)
+    if (lines[i]->seen == gen && line_moved_ahead(r, lines[i], gen)
+        && add_name_change(names, changes, count, lines[i]) == -1)
+      error = errno;
+
+  /* A name goes to the first line that has it, new or not. */
+  for (i = 0; i < nlines && !error; i++) {
+    c = host_index_find(names, lines[i]->host.name, lines[i]->namelen);
+    if (c != NULL && c->winner == NULL)
+      c->winner = lines[i];
+  }
+
+CLEAN_UP:
+  free_host_index(names);
+  if (error) {
+    free(changes);
+    errno = error;
+    return NULL;
+  }
+
+  return changes;
+}
+
+/*
+ * Brings the indexes up to date with size bytes of wake.hosts text at
+ * base.  Lines that were there before, word for word, are kept as
+ * they are; only new ones are parsed.  The index that no reader is
+ * using is updated first and made current, and the other is updated
+ * once the reader has let go of it.
+ *
+ * Returns 0 on success, with the numbers of lines added and removed
+ * in *added and *removed, or -1 with errno set on error, when readers
+ * go on seeing the last version.
+ */
+static int apply_host_text(struct host_reloader *r, const char *base,
+  size_t size, unsigned long *added, unsigned long *removed)
+{
+  struct host_line **lines = NULL, **t, *ln;
+  struct host_version *old, *spare;
+  struct name_change *changes = NULL;
+  struct line_map *map = NULL;
+  struct timespec pause = {0, 100000};
+  const char *line, *end;
+  size_t nlines = 0, room = r->nlines + 16, nfresh = 0, nchanges = 0;
+  size_t pos, len, i;
+  u_int64_t hash;
+  unsigned long gen = ++r->generation;
+  int rebuild, error = 0;
+
+  lines = malloc(room * sizeof(struct host_line *));
+  if (lines == NULL)
+    return -1;
+
+  for (pos = 0; pos < size; pos = end - base + 1) {
+    line = base + pos;
+    end = memchr(line, '\n', size - pos);
+    if (end == NULL)
+      end = base + size;
+    len = end - line;
+    if (len == 0 || *line == '#' || isspace((unsigned char) *line))
+      continue;
+
+    hash = hash_line(line, len);
+    ln = take_line(r->map, hash, line, len, gen);
+    if (ln == NULL) {
+      ln = parse_host_line(line, len, hash);
+      if (ln == NULL) {
+        if (errno != 0) {
+          error = errno;
+          goto CLEAN_UP;
+        }
+        continue;
+      }
+      nfresh++;
+    }
+    if (nlines == room) {
+      t = realloc(lines, room * 2 * sizeof(struct host_line *));
+      if (t == NULL) {
+        error = errno;
+        if (ln->seen == 0)
+          free(ln);
+        goto CLEAN_UP;
+      }
+      lines = t;
+      room *= 2;
+    }
+    ln->pos = nlines;
+    lines[nlines++] = ln;
+  }
+  *added = nfresh;
+  *removed = r->nlines - (nlines - nfresh);
+
+  rebuild = r->rebuild || r->current->index == NULL
+    || (*added + *removed) * RELOAD_REBUILD_RATIO > nlines;
+  if (!rebuild) {
+    changes = find_name_changes(r, lines, nlines, *added + *removed, gen,
+      &nchanges);
+    if (changes == NULL) {
+      error = errno;
+      goto CLEAN_UP;
+    }
+  }
+  map = new_line_map(lines, nlines);
+  spare = r->current == &r->versions[0] ? &r->versions[1] : &r->versions[0];
+  if (map == NULL
+      || update_host_version(spare, rebuild || spare->index == NULL,
+        lines, nlines, changes, nchanges) == -1) {
+    error = errno;
+    r->rebuild = 1;
+    goto CLEAN_UP;
+  }
+
+  /* Swap the versions, and wait for the reader to be done with the old
+   * one before touching it. */
+  old = r->current;
+  __atomic_store_n(&r->current, spare, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&r->hazard, __ATOMIC_SEQ_CST) == old)
+    nanosleep(&pause, NULL);
+  r->rebuild = update_host_version(old, rebuild || old->index == NULL,
+    lines, nlines, changes, nchanges) == -1;
+
+  /* Neither index has the lines that went any more. */
+  for (i = 0; i < r->nlines; i++)
+    if (r->lines[i]->seen != gen)
+      free(r->lines[i]);
+  for (i = 0; i < nlines; i++)
+    lines[i]->seen = gen;
+  free(r->lines);
+  free_line_map(r->map);
+  r->lines = lines;
+  r->nlines = nlines;
+  r->map = map;
+  lines = NULL;
+  map = NULL;
+
+CLEAN_UP:
+  for (i = 0; lines != NULL && i < nlines; i++)
+    if (lines[i]->seen == 0)
+      free(lines[i]);
+  free(lines);
+  free_line_map(map);
+  free(changes);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Reads the file and brings the indexes up to date with it.  The file
+ * is read rather than mapped, since an editor may be cutting it short
+ * while it is read.
+ *
+ * Returns 0 on success or -1 with errno set on error.
+ */
+static int reload_host_file(struct host_reloader *r, unsigned long *added,
+  unsigned long *removed)
+{
+  struct stat sb;
+  char *text = NULL, *t;
+  size_t len = 0, size;
+  ssize_t n;
+  int fd, error = 0;
+
+  fd = open(r->path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1 || fstat(fd, &sb) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  size = sb.st_size + 1;
+  text = malloc(size);
+  if (text == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  while ((n = read(fd, text + len, size - len)) != 0) {
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      error = errno;
+      goto CLEAN_UP;
+    }
+    len += n;
+    /* It has grown since we looked. */
+    if (len == size) {
+      t = realloc(text, size * 2);
+      if (t == NULL) {
+        error = errno;
+        goto CLEAN_UP;
+      }
+      text = t;
+      size *= 2;
+    }
+  }
+  if (apply_host_text(r, text, len, added, removed) == -1)
+    error = errno;
+
+CLEAN_UP:
+  if (fd != -1)
+    close(fd);
+  free(text);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Returns the monotonic clock in milliseconds. */
+static unsigned long long reload_clock_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Reads all of the waiting inotify events.
+ *
+ * Returns 1 if any of them was about the file, or the queue
+ * overflowed, and 0 if not.
+ */
+static int host_file_changed(struct host_reloader *r)
+{
+  char buf[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *ev;
+  const char *name = strrchr(r->path, '/');
+  ssize_t n, i;
+  int changed = 0;
+
+  name = name != NULL ? name + 1 : r->path;
+  while ((n = read(r->inotify_fd, buf, sizeof(buf))) > 0)
+    for (i = 0; i < n; i += sizeof(struct inotify_event) + ev->len) {
+      ev = (const struct inotify_event *) (buf + i);
+      if ((ev->mask & IN_Q_OVERFLOW)
+          || (ev->len > 0 && strcmp(ev->name, name) == 0))
+        changed = 1;
+    }
+
+  return changed;
+}
+
+/*
+ * The reloading thread: waits for the file to change and settle, then
+ * brings the indexes up to date and says what changed, until told to
+ * stop.
+ */
+static void *run_host_reloader(void *arg)
+{
+  struct host_reloader *r = arg;
+  struct pollfd fds[2];
+  unsigned long long first = 0, now;
+  unsigned long added, removed;
+  int n, timeout;
+
+  fds[0].fd = r->inotify_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = r->stop_fds[0];
+  fds[1].events = POLLIN;
+
+  for (;;) {
+    timeout = -1;
+    if (first != 0) {
+      now = reload_clock_ms();
+      timeout = now - first >= RELOAD_MAX_DELAY_MS ? 0
+        : RELOAD_MAX_DELAY_MS - (now - first);
+      if (timeout > RELOAD_SETTLE_MS)
+        timeout = RELOAD_SETTLE_MS;
+    }
+    n = poll(fds, 2, timeout);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Can't watch %s: %s\n", r->path, strerror(errno));
+      return NULL;
+    }
+    if (fds[1].revents)
+      return NULL;
+    if (n > 0) {
+      if (host_file_changed(r) && first == 0)
+        first = reload_clock_ms();
+      if (first == 0 || reload_clock_ms() - first < RELOAD_MAX_DELAY_MS)
+        continue;
+    }
+    if (first == 0)
+      continue;
+
+    first = 0;
+    if (reload_host_file(r, &added, &removed) == -1)
+      fprintf(stderr, "Can't reload %s: %s\n", r->path, strerror(errno));
+    else if (added > 0 || removed > 0) {
+      printf("Reloaded %s: %lu added, %lu removed, %lu hosts\n", r->path,
+        added, removed,
+        (unsigned long) host_version_count(r->current));
+      fflush(stdout);
+    }
+  }
+}
+
+/*
+ * Loads the wake.hosts file at path and starts a thread that keeps an
+ * index of it up to date as it changes.  The directory is watched,
+ * not the file, so that editors that write a new file and rename it
+ * into place are seen, too.
+ *
+ * Returns a pointer to the reloader, which must be closed with
+ * close_host_reloader, or NULL with errno set on error.
+ */
+struct host_reloader *open_host_reloader(const char *path)
+{
+  struct host_reloader *r;
+  unsigned long added, removed;
+  sigset_t all, old;
+  char *dir, *slash;
+  int error = 0;
+
+  r = calloc(1, sizeof(struct host_reloader));
+  if (r == NULL)
+    return NULL;
+  r->inotify_fd = -1;
+  r->stop_fds[0] = r->stop_fds[1] = -1;
+  r->current = &r->versions[0];
+
+  r->path = strdup(path);
+  if (r->path == NULL || reload_host_file(r, &added, &removed) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  dir = strdup(path);
+  if (dir == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  slash = strrchr(dir, '/');
+  if (slash == NULL)
+    strcpy(dir, ".");
+  else
+    slash[slash == dir] = '\0';
+  r->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (r->inotify_fd == -1
+      || inotify_add_watch(r->inotify_fd, dir,
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY) == -1
+      || pipe(r->stop_fds) == -1)
+    error = errno;
+  free(dir);
+  if (error)
+    goto CLEAN_UP;
+
+  /* The signals are for the thread that serves requests. */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  error = pthread_create(&r->thread, NULL, run_host_reloader, r);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  r->started = !error;
+
+CLEAN_UP:
+  if (error) {
+    close_host_reloader(r);
+    errno = error;
+    return NULL;
+  }
+
+  return r;
+}
+
+#else /* no inotify or no threads */
+
+struct host_reloader *open_host_reloader(const char *path)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+#endif
+
+/*
+ * Stops the reloading thread and frees everything, the lines and the
+ * indexes included.
+ */
+void close_host_reloader(struct host_reloader *r)
+{
+  size_t i;
+
+  if (r == NULL)
+    return;
+  if (r->started) {
+    while (write(r->stop_fds[1], "", 1) == -1 && errno == EINTR)
+      ;
+    pthread_join(r->thread, NULL);
+  }
+  if (r->inotify_fd != -1)
+    close(r->inotify_fd);
+  if (r->stop_fds[0] != -1) {
+    close(r->stop_fds[0]);
+    close(r->stop_fds[1]);
+  }
+  for (i = 0; i < r->nlines; i++)
+    free(r->lines[i]);
+  free(r->lines);
+  free_line_map(r->map);
+  free_host_index(r->versions[0].index);
+  free_host_index(r->versions[1].index);
+  free(r->path);
+  free(r);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HOSTRELOAD_INCL
+#define HOSTRELOAD_INCL 1
+
+#include "hostinfo.h"
+#include "hostindex.h"
+#include <sys/types.h>
+#include <pthread.h>
+
+/*
+ * A host entry from one line of wake.hosts, with the name, the mac
+ * address and the text of the line stored right after it.  Once made,
+ * a line never changes and is shared by every version of the file
+ * that has it, so a line that is still there after an edit is never
+ * parsed again.
+ */
+struct host_line {
+  u_int64_t hash; /* of the text of the whole line */
+  size_t len; /* of the text of the whole line */
+  const char *text; /* not nul terminated */
+  unsigned long seen; /* the last reload that found the line */
+  size_t pos; /* where the last reload found it */
+  struct hostinfo host;
+  u_int32_t namelen;
+};
+
+/* What readers look hosts up in: one version of wake.hosts. */
+struct host_version {
+  struct host_index *index;
+};
+
+struct line_map;
+
+/*
+ * Keeps an index of a wake.hosts file up to date as the file is
+ * edited.  A thread waits for inotify to say that the file has
+ * changed, works out which lines came and went by their hashes, and
+ * applies only those to two copies of the index in turn: first the
+ * one no reader is using, which then becomes current, and then, once
+ * the reader has let go of it, the other.  Readers never wait.
+ *
+ * There is one reader, which marks the version it is using in hazard.
+ */
+struct host_reloader {
+  char *path;
+  struct host_version versions[2];
+  struct host_version *current;
+  struct host_version *hazard;
+  struct host_line **lines; /* in file order */
+  size_t nlines;
+  struct line_map *map;
+  unsigned long generation; /* counts attempts to reload */
+  int rebuild; /* an edit failed, so the next reload starts afresh */
+  int inotify_fd;
+  int stop_fds[2];
+  pthread_t thread;
+  int started;
+};
+
+struct host_reloader *open_host_reloader(const char *path);
+
+const struct host_version *host_reloader_enter(struct host_reloader *r);
+
+void host_reloader_leave(struct host_reloader *r);
+
+struct hostinfo *host_version_find(const struct host_version *v,
+  const char *name);
+
+size_t host_version_count(const struct host_version *v);
+
+void close_host_reloader(struct host_reloader *r);
+
+#endif
@@ -0,0 +1,488 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "hostsdb.h"
+#include "hostindex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* The average number of names that share a seed. */
+#define NAMES_PER_BUCKET 4
+
+/* How many seeds we try for one bucket before giving up. */
+#define MAX_SEED_TRIES (1U << 24)
+
+/* Rounds n up to a multiple of 8 so the tables stay aligned. */
+#define ALIGN8(n) (((n) + 7) & ~((u_int64_t) 7))
+
+/* The values that place one name in the perfect hash. */
+struct db_key {
+  u_int64_t hash;
+  u_int32_t bucket;
+  u_int32_t view; /* which view of the map the name came from */
+};
+
+/* A bucket of names and how many there are, for sorting. */
+struct db_bucket {
+  u_int32_t bucket;
+  u_int32_t size;
+};
+
+/* The splitmix64 finalizer, to get more hash values out of one. */
+static u_int64_t mix64(u_int64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/* Works out the hash and bucket of len bytes of name. */
+static void hash_db_key(const char *name, size_t len, u_int32_t nbuckets,
+  struct db_key *key)
+{
+  key->hash = hash_host_name64(name, len);
+  key->bucket = key->hash % nbuckets;
+}
+
+/*
+ * Returns the slot a key lands in with the given seed.  Every seed
+ * mixes the hash afresh, so that two names in a bucket that collide
+ * with one seed are as likely as any to be apart with the next.
+ */
+static u_int32_t place_db_key(const struct db_key *key, u_int32_t seed,
+  u_int32_t count)
+{
+  return mix64(key->hash + ((u_int64_t) seed + 1) * 0x9E3779B97F4A7C15ULL)
+    % count;
+}
+
+/* Sorts buckets from the largest to the smallest. */
+static int cmp_db_buckets(const void *a, const void *b)
+{
+  const struct db_bucket *x = a, *y = b;
+
+  if (x->size != y->size)
+    return x->size < y->size ? 1 : -1;
+  return x->bucket < y->bucket ? -1 : x->bucket > y->bucket;
+}
+
+/*
+ * Builds the image of a hosts database from the hosts in map.  Names
+ * are matched without regard to case and, as everywhere else, the
+ * first entry for a name is the one that is kept.
+ *
+ * Returns a pointer to the image, which should be freed with free,
+ * and stores its length in size.  Returns NULL on error.
+ */
+void *build_hosts_db_image(struct hosts_map *map, size_t *size)
+{
+  struct host_index *idx;
+  struct hosts_db_header *header;
+  struct hosts_db_entry *entry;
+  struct host_view *view;
+  struct db_key *keys = NULL;
+  struct db_bucket *buckets = NULL;
+  u_int32_t *start = NULL, *order = NULL, *slot_key = NULL, *seeds;
+  u_int32_t count = 0, nbuckets, i, j, k, b, seed, slots[64];
+  char *taken = NULL, *image = NULL, *names;
+  char macaddr[18];
+  u_int64_t seeds_off, entries_off, names_off, names_size = 0;
+  int error = 0;
+
+  /* Find the names to keep, dropping repeats. */
+  idx = new_host_index(map->count);
+  keys = calloc(map->count + 1, sizeof(struct db_key));
+  if (idx == NULL || keys == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  for (i = 0; i < map->count; i++) {
+    view = &map->views[i];
+    switch (host_index_add(idx, map->base + view->name_off, view->name_len,
+          view)) {
+    case -1:
+      error = errno;
+      goto CLEAN_UP;
+    case 0:
+      keys[count++].view = i;
+      names_size += view->name_len + 1;
+      names_size += HOST_VIEW_MACLEN(view) + 1;
+      break;
+    }
+  }
+
+  nbuckets = count / NAMES_PER_BUCKET + 1;
+  start = calloc(nbuckets + 1, sizeof(u_int32_t));
+  order = calloc(count + 1, sizeof(u_int32_t));
+  slot_key = calloc(count + 1, sizeof(u_int32_t));
+  taken = calloc(count + 1, 1);
+  buckets = calloc(nbuckets, sizeof(struct db_bucket));
+  if (!start || !order || !slot_key || !taken || !buckets) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  /* Hash the names and group them by bucket. */
+  for (i = 0; i < count; i++) {
+    view = &map->views[keys[i].view];
+    hash_db_key(map->base + view->name_off, view->name_len, nbuckets,
+      &keys[i]);
+    start[keys[i].bucket + 1]++;
+  }
+  for (b = 0; b < nbuckets; b++) {
+    buckets[b].bucket = b;
+    buckets[b].size = start[b + 1];
+    start[b + 1] += start[b];
+  }
+  for (i = 0; i < count; i++)
+    order[start[keys[i].bucket]++] = i;
+  for (b = nbuckets; b > 0; b--)
+    start[b] = start[b - 1];
+  start[0] = 0;
+
+  /* Lay out the image so the seeds can be filled in directly. */
+  seeds_off = ALIGN8(sizeof(struct hosts_db_header));
+  entries_off = ALIGN8(seeds_off + nbuckets * sizeof(u_int32_t));
+  names_off = entries_off + (u_int64_t) count * sizeof(struct hosts_db_entry);
+  *size = names_off + names_size;
+  image = calloc(1, *size);
+  if (image == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  seeds = (u_int32_t *) (image + seeds_off);
+
+  /*
+   * Place the biggest buckets first, while there is the most room,
+   * trying seeds until every name in the bucket lands in a free slot
+   * that no other name in the bucket wants.
+   */
+  qsort(buckets, nbuckets, sizeof(struct db_bucket), cmp_db_buckets);
+  for (b = 0; b < nbuckets && buckets[b].size > 0; b++) {
+    if (buckets[b].size > sizeof(slots) / sizeof(slots[0])) {
+      error = EOVERFLOW;
+      goto CLEAN_UP;
+    }
+    for (seed = 0; seed < MAX_SEED_TRIES; seed++) {
+      for (j = 0; j < buckets[b].size; j++) {
+        slots[j] = place_db_key(&keys[order[start[buckets[b].bucket] + j]],
+          seed, count);
+        if (taken[slots[j]])
+          break;
+        for (k = 0; k < j && slots[k] != slots[j]; k++)
+          ;
+        if (k < j)
+          break;
+      }
+      if (j == buckets[b].size)
+        break;
+    }
+    if (seed == MAX_SEED_TRIES) {
+      error = EOVERFLOW;
+      goto CLEAN_UP;
+    }
+    seeds[buckets[b].bucket] = seed;
+    for (j = 0; j < buckets[b].size; j++) {
+      taken[slots[j]] = 1;
+      slot_key[slots[j]] = order[start[buckets[b].bucket] + j];
+    }
+  }
+
+  header = (struct hosts_db_header *) image;
+  memcpy(header->magic, HOSTS_DB_MAGIC, sizeof(HOSTS_DB_MAGIC));
+  header->version = HOSTS_DB_VERSION;
+  header->byteorder = HOSTS_DB_BYTEORDER;
+  header->count = count;
+  header->nbuckets = nbuckets;
+  header->seeds_off = seeds_off;
+  header->entries_off = entries_off;
+  header->names_off = names_off;
+  header->names_size = names_size;
+
+  /* Fill in the entries in slot order and intern their strings. */
+  entry = (struct hosts_db_entry *) (image + entries_off);
+  names = image + names_off;
+  j = 0;
+  for (i = 0; i < count; i++, entry++) {
+    view = &map->views[keys[slot_key[i]].view];
+    entry->name_off = j;
+    entry->name_len = view->name_len;
+    memcpy(names + j, map->base + view->name_off, view->name_len);
+    j += view->name_len + 1;
+    host_view_macaddr(map, view, macaddr);
+    entry->macaddr_off = j;
+    strcpy(names + j, macaddr);
+    j += strlen(macaddr) + 1;
+    if (view->macvalid) {
+      memcpy(entry->mac, view->mac, 6);
+      entry->flags |= HOSTS_DB_MAC_VALID;
+    }
+    entry->ipaddr = view->ipaddr;
+    entry->prefix = view->prefix;
+  }
+
+CLEAN_UP:
+  free_host_index(idx);
+  free(keys);
+  free(buckets);
+  free(start);
+  free(order);
+  free(slot_key);
+  free(taken);
+  if (error) {
+    free(image);
+    errno = error;
+    return NULL;
+  }
+
+  return image;
+}
+
+/*
+ * Compiles the hosts in map into a database at path.  The database is
+ * written to a temporary file first and renamed into place, so a
+ * reader never sees half of one.
+ *
+ * Returns the number of hosts in the database or -1 on error.
+ */
+int compile_hosts_db(struct hosts_map *map, const char *path)
+{
+  char *image, *tmppath;
+  size_t size, done = 0;
+  ssize_t n;
+  int fd, error = 0, count;
+
+  image = build_hosts_db_image(map, &size);
+  if (image == NULL)
+    return -1;
+  count = ((struct hosts_db_header *) image)->count;
+
+  tmppath = malloc(strlen(path) + 32);
+  if (tmppath == NULL) {
+    free(image);
+    return -1;
+  }
+  sprintf(tmppath, "%s.%ld.tmp", path, (long) getpid());
+
+  fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    error = errno;
+  while (!error && done < size) {
+    n = write(fd, image + done, size - done);
+    if (n == -1) {
+      if (errno != EINTR)
+        error = errno;
+    }
+    else
+      done += n;
+  }
+  if (fd != -1 && close(fd) == -1 && !error)
+    error = errno;
+  if (!error && rename(tmppath, path) == -1)
+    error = errno;
+  if (error && fd != -1)
+    unlink(tmppath);
+
+  free(tmppath);
+  free(image);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+
+  return count;
+}
+
+/*
+ * Compiles the hosts in table, which may have come from a file in
+ * another format than wake.hosts, into a database at path, in the same
+ * way as compile_hosts_db.
+ *
+ * Returns the number of hosts in the database or -1 on error.
+ */
+int compile_host_table(const struct host_table *table, const char *path)
+{
+  const struct hostinfo *host;
+  struct host_view *view;
+  struct hosts_map map;
+  size_t i;
+  int count, error;
+
+  /* The table's strings stand in for the text of a wake.hosts file. */
+  map.base = table->strings;
+  map.size = table->strings_size;
+  map.count = table->count;
+  map.views = calloc(table->count + 1, sizeof(struct host_view));
+  if (map.views == NULL)
+    return -1;
+  for (i = 0; i < table->count; i++) {
+    host = &table->hosts[i];
+    view = &map.views[i];
+    view->name_off = host->name - table->strings;
+    view->name_len = strlen(host->name);
+    view->mac_off = host->macaddr - table->strings;
+    view->mac_len = strlen(host->macaddr);
+    view->ipaddr = host->ipaddr;
+    view->prefix = host->prefix;
+    memcpy(view->mac, host->mac, 6);
+    view->macvalid = host->macvalid;
+  }
+
+  count = compile_hosts_db(&map, path);
+  error = errno;
+  free(map.views);
+  errno = error;
+
+  return count;
+}
+
+/*
+ * Points the tables of db at the size bytes of a database image at
+ * image, once it has checked that the image was made by this version
+ * of wake on a machine with the same byte order, that the tables are
+ * where the header says and fit in it, and that the names block ends
+ * in a nul, so that no name or mac address read from it as a string
+ * can run off the end.  The image has to stay where it is for as long
+ * as db is used.
+ *
+ * Returns 0 on success or -1 with errno set to EINVAL if the image
+ * isn't a database that wake can use.
+ */
+int use_hosts_db_image(struct hosts_db *db, const void *image, size_t size)
+{
+  const struct hosts_db_header *h = image;
+
+  if (size < sizeof(struct hosts_db_header)
+      || memcmp(h->magic, HOSTS_DB_MAGIC, sizeof(HOSTS_DB_MAGIC)) != 0
+      || h->version != HOSTS_DB_VERSION
+      || h->byteorder != HOSTS_DB_BYTEORDER
+      || h->nbuckets == 0
+      || h->seeds_off % 4 != 0 || h->entries_off % 4 != 0
+      || h->seeds_off + (u_int64_t) h->nbuckets * 4 > size
+      || h->entries_off + (u_int64_t) h->count
+        * sizeof(struct hosts_db_entry) > size
+      || h->names_off > size || h->names_size > size - h->names_off
+      || (h->names_size > 0
+        && ((const char *) image)[h->names_off + h->names_size - 1] != '\0')) {
+    errno = EINVAL;
+    return -1;
+  }
+  db->header = h;
+  db->seeds = (const u_int32_t *) ((const char *) image + h->seeds_off);
+  db->entries = (const struct hosts_db_entry *)
+    ((const char *) image + h->entries_off);
+  db->names = (const char *) image + h->names_off;
+
+  return 0;
+}
+
+/*
+ * Maps the hosts database at path and checks it with
+ * use_hosts_db_image.
+ *
+ * Returns a pointer to the open database, which must be closed with
+ * close_hosts_db, or NULL with errno set on error.
+ */
+struct hosts_db *open_hosts_db(const char *path)
+{
+  struct hosts_db *db;
+  struct stat sb;
+  int fd, error = 0;
+
+  db = calloc(1, sizeof(struct hosts_db));
+  if (db == NULL)
+    return NULL;
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1 || fstat(fd, &sb) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  if ((size_t) sb.st_size < sizeof(struct hosts_db_header)) {
+    error = EINVAL;
+    goto CLEAN_UP;
+  }
+  db->size = sb.st_size;
+  db->base = mmap(NULL, db->size, PROT_READ, MAP_SHARED, fd, 0);
+  if (db->base == MAP_FAILED) {
+    error = errno;
+    db->base = NULL;
+    goto CLEAN_UP;
+  }
+  if (use_hosts_db_image(db, db->base, db->size) == -1)
+    error = errno;
+
+CLEAN_UP:
+  if (fd != -1)
+    close(fd);
+  if (error) {
+    close_hosts_db(db);
+    errno = error;
+    return NULL;
+  }
+
+  return db;
+}
+
+/*
+ * Looks up len bytes of name in the database without regard to case.
+ * This costs one hash and a look at the seed, the entry and the name.
+ *
+ * Returns a pointer to the entry for the name or NULL if it is not in
+ * the database.
+ */
+const struct hosts_db_entry *
+hosts_db_find(const struct hosts_db *db, const char *name, size_t len)
+{
+  const struct hosts_db_entry *entry;
+  struct db_key key;
+  u_int32_t count = db->header->count;
+
+  if (count == 0)
+    return NULL;
+  hash_db_key(name, len, db->header->nbuckets, &key);
+  entry = &db->entries[place_db_key(&key, db->seeds[key.bucket], count)];
+  if (entry->name_len != len
+      || (u_int64_t) entry->name_off + len >= db->header->names_size
+      || entry->macaddr_off >= db->header->names_size
+      || !host_names_match(db->names + entry->name_off, name, len))
+    return NULL;
+
+  return entry;
+}
+
+/*
+ * Unmaps the database and frees the handle.
+ */
+void close_hosts_db(struct hosts_db *db)
+{
+  if (db == NULL)
+    return;
+  if (db->base != NULL)
+    munmap(db->base, db->size);
+  free(db);
+}
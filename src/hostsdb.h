@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HOSTSDB_INCL
+#define HOSTSDB_INCL 1
+
+#include "hostsmap.h"
+#include "hosttable.h"
+#include <sys/types.h>
+
+/*
+ * A compiled wake.hosts file.  The layout is a header, a table of
+ * hash seeds for a minimal perfect hash over the case-folded
+ * host names, the entries in hash slot order and a table of nul
+ * terminated strings that the entries point into.  Everything is
+ * stored in the byte order of the machine that compiled it.
+ */
+#define HOSTS_DB_MAGIC "WAKEDB"
+#define HOSTS_DB_VERSION 3
+#define HOSTS_DB_BYTEORDER 0x01020304
+
+struct hosts_db_header {
+  char magic[8];
+  u_int32_t version;
+  u_int32_t byteorder;
+  u_int32_t count;
+  u_int32_t nbuckets;
+  u_int64_t seeds_off;
+  u_int64_t entries_off;
+  u_int64_t names_off;
+  u_int64_t names_size;
+};
+
+/* Set in flags when mac holds a valid mac address. */
+#define HOSTS_DB_MAC_VALID 0x01
+
+struct hosts_db_entry {
+  u_int32_t name_off;
+  u_int32_t name_len;
+  u_int32_t macaddr_off; /* the mac address as written in wake.hosts */
+  u_int32_t ipaddr; /* network byte order, 0 if there is none */
+  unsigned char mac[6];
+  unsigned char flags;
+  unsigned char prefix;
+};
+
+/* An open, mapped hosts database.  base and size are the whole
+ * mapping, which may hold more than the database. */
+struct hosts_db {
+  void *base;
+  size_t size;
+  const struct hosts_db_header *header;
+  const u_int32_t *seeds;
+  const struct hosts_db_entry *entries;
+  const char *names;
+};
+
+void *build_hosts_db_image(struct hosts_map *map, size_t *size);
+
+int compile_hosts_db(struct hosts_map *map, const char *path);
+
+int compile_host_table(const struct host_table *table, const char *path);
+
+int use_hosts_db_image(struct hosts_db *db, const void *image, size_t size);
+
+struct hosts_db *open_hosts_db(const char *path);
+
+const struct hosts_db_entry *
+hosts_db_find(const struct hosts_db *db, const char *name, size_t len);
+
+void close_hosts_db(struct hosts_db *db);
+
+#endif
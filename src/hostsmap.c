@@ -0,0 +1,409 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "hostsmap.h"
+#include "build_msg.h"
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+/*
+ * Scans the wake.hosts text in base, which is size bytes long,
+ * starting at *pos for the next line that holds a host entry.  Lines
+ * that begin with a pound sign (#) or with white space are skipped,
+ * the hostname runs up to the first white space, and the mac address
+ * is the next word on the same line.  Lines of any length are handled.
+ *
+ * On return *pos is the offset of the line after the one scanned.
+ *
+ * Returns 1 when view has been filled in or 0 at the end of the text.
+ */
+int next_host_view(const char *base, size_t size, size_t *pos,
+  struct host_view *view)
+{
+  const char *line, *end, *p, *mac;
+
+  while (*pos < size) {
+    line = base + *pos;
+    end = memchr(line, '\n', size - *pos);
+    if (end == NULL)
+      end = base + size;
+    *pos = end - base + (end < base + size);
+
+    if (line == end || *line == '#' || isspace((unsigned char) *line))
+      continue;
+
+    for (p = line; p < end && !isspace((unsigned char) *p); p++)
+      ;
+    for (mac = p; mac < end && isspace((unsigned char) *mac); mac++)
+      ;
+    if (mac == end)
+      continue; /* No mac address, so no host. */
+
+    view->name_off = line - base;
+    view->name_len = p - line;
+    view->mac_off = mac - base;
+    for (p = mac; p < end && !isspace((unsigned char) *p); p++)
+      ;
+    view->mac_len = p - mac;
+    view->rest_off = p - base;
+    view->rest_len = end - p;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Reads len bytes of text as an IPv4 address in dotted decimal form,
+ * optionally followed by a slash and a prefix length, such as
+ * 192.0.2.7/24.  Without one, the prefix is 32.
+ *
+ * Returns 1 and fills in ipaddr, in network byte order, and prefix if
+ * text is such an address, or 0 if it isn't.
+ */
+int parse_host_ipaddr(const char *text, size_t len, u_int32_t *ipaddr,
+  unsigned char *prefix)
+{
+  char buf[sizeof("255.255.255.255/32")];
+  struct in_addr addr;
+  const char *slash;
+  unsigned int n = 32;
+  size_t i, addrlen = len;
+
+  if (len >= sizeof(buf))
+    return 0;
+  slash = memchr(text, '/', len);
+  if (slash != NULL) {
+    addrlen = slash - text;
+    if (addrlen + 1 == len || len - addrlen - 1 > 2)
+      return 0;
+    for (n = 0, i = addrlen + 1; i < len; i++) {
+      if (!isdigit((unsigned char) text[i]))
+        return 0;
+      n = n * 10 + text[i] - '0';
+    }
+    if (n > 32)
+      return 0;
+  }
+  memcpy(buf, text, addrlen);
+  buf[addrlen] = '\0';
+  if (inet_pton(AF_INET, buf, &addr) != 1 || addr.s_addr == 0)
+    return 0;
+
+  *ipaddr = addr.s_addr;
+  *prefix = n;
+  return 1;
+}
+
+/*
+ * Looks through the words of rest, what follows the mac address on a
+ * wake.hosts line, for the first one that parse_host_ipaddr takes.
+ *
+ * Returns 1 if one is found and 0 otherwise, when ipaddr is set to 0.
+ */
+int find_host_ipaddr(const char *rest, size_t len, u_int32_t *ipaddr,
+  unsigned char *prefix)
+{
+  const char *p = rest, *end = rest + len, *word;
+
+  while (p < end) {
+    while (p < end && isspace((unsigned char) *p))
+      p++;
+    for (word = p; p < end && !isspace((unsigned char) *p); p++)
+      ;
+    if (p > word && parse_host_ipaddr(word, p - word, ipaddr, prefix))
+      return 1;
+  }
+
+  *ipaddr = 0;
+  *prefix = 0;
+  return 0;
+}
+
+/*
+ * Finds the next tag in rest, what follows the mac address on a
+ * wake.hosts line, starting at *pos: a word that begins with an at
+ * sign (@), as in @rack12.  A comment ends the search.
+ *
+ * Returns 1 with *tag pointing just past the at sign and *taglen set,
+ * and *pos moved past the tag, or 0 if there are no more tags.
+ */
+int next_host_tag(const char *rest, size_t len, size_t *pos,
+  const char **tag, size_t *taglen)
+{
+  const char *p = rest + *pos, *end = rest + len, *word;
+
+  while (p < end) {
+    while (p < end && isspace((unsigned char) *p))
+      p++;
+    for (word = p; p < end && !isspace((unsigned char) *p) && *p != '#';
+         p++)
+      ;
+    if (p - word > 1 && *word == '@') {
+      *tag = word + 1;
+      *taglen = p - word - 1;
+      *pos = p - rest;
+      return 1;
+    }
+    if (p < end && *p == '#')
+      break;
+  }
+
+  *pos = len;
+  return 0;
+}
+
+/*
+ * Checks the mac address of view and converts it to binary, so that
+ * it never has to be parsed again.  The same goes for an IPv4 address
+ * in the rest of the line.
+ */
+void decode_host_view(const struct hosts_map *map, struct host_view *view)
+{
+  view->macvalid = parse_macaddr(map->base + view->mac_off,
+    HOST_VIEW_MACLEN(view), view->mac, NULL);
+  find_host_ipaddr(map->base + view->rest_off, view->rest_len,
+    &view->ipaddr, &view->prefix);
+}
+
+/*
+ * Maps the file at path into memory and scans it once, recording a
+ * struct host_view, with its mac address decoded, for every host
+ * entry found.  No memory is
+ * allocated per host; the views are kept in a single array that
+ * grows as needed.
+ *
+ * Returns a pointer to the map, which must be released with
+ * unmap_wake_hosts_file, or NULL with errno set on error.
+ */
+struct hosts_map *map_wake_hosts_file(char *path)
+{
+  struct hosts_map *map;
+  struct host_view view, *t;
+  struct stat sb;
+  size_t pos = 0, room = 0;
+  int fd, error = 0;
+
+  map = calloc(1, sizeof(struct hosts_map));
+  if (map == NULL)
+    return NULL;
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1 || fstat(fd, &sb) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  /* An empty file is fine, but there is nothing to map. */
+  if (sb.st_size > 0) {
+    map->size = sb.st_size;
+    map->base = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map->base == MAP_FAILED) {
+      error = errno;
+      map->base = NULL;
+      goto CLEAN_UP;
+    }
+    posix_madvise(map->base, map->size, POSIX_MADV_SEQUENTIAL);
+  }
+
+  while (next_host_view(map->base, map->size, &pos, &view)) {
+    if (map->count == room) {
+      room = room ? room * 2 : 64;
+      t = realloc(map->views, room * sizeof(struct host_view));
+      if (t == NULL) {
+        error = errno;
+        goto CLEAN_UP;
+      }
+      map->views = t;
+    }
+    decode_host_view(map, &view);
+    map->views[map->count++] = view;
+  }
+
+CLEAN_UP:
+  if (fd != -1)
+    close(fd);
+  if (error) {
+    unmap_wake_hosts_file(map);
+    errno = error;
+    return NULL;
+  }
+
+  return map;
+}
+
+/*
+ * Maps the file at path and scans it for just the count hosts named
+ * in names, stopping as soon as all of them have been found, so the
+ * cost depends on where the hosts are in the file rather than on its
+ * size.  Lines for other hosts are skipped without keeping anything.
+ *
+ * The returned map has exactly count views: views[i] is the first
+ * entry for names[i] or has a name_len of 0 if there is none.
+ *
+ * Returns a pointer to the map, which must be released with
+ * unmap_wake_hosts_file, or NULL with errno set on error.
+ */
+struct hosts_map *scan_wake_hosts_file(char *path, char **names,
+  size_t count)
+{
+  struct hosts_map *map;
+  struct host_index *wanted;
+  struct host_view view, *want;
+  struct stat sb;
+  size_t pos = 0, left = 0, i;
+  int fd, error = 0;
+
+  map = calloc(1, sizeof(struct hosts_map));
+  if (map == NULL)
+    return NULL;
+  map->count = count;
+  map->views = calloc(count + 1, sizeof(struct host_view));
+  wanted = new_host_index(count);
+  if (map->views == NULL || wanted == NULL) {
+    error = errno;
+    free_host_index(wanted);
+    unmap_wake_hosts_file(map);
+    errno = error;
+    return NULL;
+  }
+
+  /*
+   * Index the names we want, pointing at the slot for the first
+   * request of each name, so each line costs one hash lookup.
+   */
+  for (i = 0; i < count; i++)
+    switch (host_index_add(wanted, names[i], strlen(names[i]),
+          &map->views[i])) {
+    case -1:
+      error = errno;
+      goto CLEAN_UP;
+    case 0:
+      left++;
+      break;
+    }
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1 || fstat(fd, &sb) == -1) {
+    error = errno;
+    if (fd != -1)
+      close(fd);
+    goto CLEAN_UP;
+  }
+  if (sb.st_size > 0) {
+    map->size = sb.st_size;
+    map->base = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map->base == MAP_FAILED)
+      error = errno;
+  }
+  close(fd);
+  if (error) {
+    map->base = NULL;
+    goto CLEAN_UP;
+  }
+
+  while (left > 0 && next_host_view(map->base, map->size, &pos, &view)) {
+    want = host_index_find(wanted, map->base + view.name_off, view.name_len);
+    if (want != NULL && want->name_len == 0) {
+      decode_host_view(map, &view);
+      *want = view;
+      left--;
+    }
+  }
+
+  /* Hand the result of the first request for a name to any repeats. */
+  for (i = 0; i < count; i++)
+    map->views[i] = *(struct host_view *) host_index_find(wanted, names[i],
+      strlen(names[i]));
+
+CLEAN_UP:
+  free_host_index(wanted);
+  if (error) {
+    unmap_wake_hosts_file(map);
+    errno = error;
+    return NULL;
+  }
+
+  return map;
+}
+
+/*
+ * Unmaps the file and frees the views.
+ */
+void unmap_wake_hosts_file(struct hosts_map *map)
+{
+  if (map == NULL)
+    return;
+  if (map->base != NULL)
+    munmap(map->base, map->size);
+  free(map->views);
+  free(map);
+}
+
+/*
+ * Copies the mac address of view into buf, which must hold 18 bytes,
+ * and nul-terminates it.  Only the first 17 characters are copied,
+ * as wake has always done.
+ *
+ * Returns a pointer to buf.
+ */
+char *host_view_macaddr(const struct hosts_map *map,
+  const struct host_view *view, char *buf)
+{
+  size_t len = HOST_VIEW_MACLEN(view);
+
+  memcpy(buf, map->base + view->mac_off, len);
+  buf[len] = '\0';
+
+  return buf;
+}
+
+/*
+ * Builds a hash index from the names in map to their views.  The
+ * first view for a name wins, as it always has in wake.
+ *
+ * Returns a pointer to the index, which must be freed with
+ * free_host_index before the map is unmapped, or NULL on error.
+ */
+struct host_index *index_hosts_map(struct hosts_map *map)
+{
+  struct host_index *idx = new_host_index(map->count);
+  struct host_view *view;
+  size_t i;
+
+  if (idx == NULL)
+    return NULL;
+  for (i = 0; i < map->count; i++) {
+    view = &map->views[i];
+    if (host_index_add(idx, map->base + view->name_off, view->name_len,
+          view) == -1) {
+      free_host_index(idx);
+      return NULL;
+    }
+  }
+
+  return idx;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HOSTSMAP_INCL
+#define HOSTSMAP_INCL 1
+
+#include "hostindex.h"
+#include "build_msg.h"
+#include <sys/types.h>
+
+/* Where one host's name and mac address sit in a mapped wake.hosts
+ * file.  Nothing is copied: both are offsets into the mapping.  The
+ * mac address is also kept in binary once it has been checked, and
+ * so is the IPv4 address, if the rest of the line has one. */
+struct host_view {
+  size_t name_off;
+  size_t mac_off;
+  size_t rest_off;
+  u_int32_t name_len;
+  u_int32_t mac_len;
+  u_int32_t rest_len;
+  u_int32_t ipaddr; /* network byte order, 0 if there is none */
+  unsigned char prefix;
+  unsigned char mac[6];
+  unsigned char macvalid;
+};
+
+/* How much of a view's mac address counts. */
+#define HOST_VIEW_MACLEN(v) \
+  ((v)->mac_len < MACADDR_MAXLEN ? (v)->mac_len : MACADDR_MAXLEN)
+
+/* A wake.hosts file mapped into memory with a view for each host. */
+struct hosts_map {
+  char *base;
+  size_t size;
+  struct host_view *views;
+  size_t count;
+};
+
+int next_host_view(const char *base, size_t size, size_t *pos,
+  struct host_view *view);
+
+int parse_host_ipaddr(const char *text, size_t len, u_int32_t *ipaddr,
+  unsigned char *prefix);
+
+int find_host_ipaddr(const char *rest, size_t len, u_int32_t *ipaddr,
+  unsigned char *prefix);
+
+int next_host_tag(const char *rest, size_t len, size_t *pos,
+  const char **tag, size_t *taglen);
+
+void decode_host_view(const struct hosts_map *map, struct host_view *view);
+
+struct hosts_map *map_wake_hosts_file(char *path);
+
+struct hosts_map *scan_wake_hosts_file(char *path, char **names,
+  size_t count);
+
+void unmap_wake_hosts_file(struct hosts_map *map);
+
+char *host_view_macaddr(const struct hosts_map *map,
+  const struct host_view *view, char *buf);
+
+struct host_index *index_hosts_map(struct hosts_map *map);
+
+#endif
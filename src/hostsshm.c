@@ -0,0 +1,355 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "hostsshm.h"
+#include "hostsmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* What a shared memory object that holds a wake.hosts file starts
+ * with. */
+#define HOSTS_SHM_MAGIC "WAKESHM"
+
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+
+/*
+ * Writes into name, which has room for len bytes, the name of the
+ * shared memory object for the wake.hosts file at path.  The name
+ * holds the user's id, since each user only trusts objects of their
+ * own, and a hash of the file's full path.
+ *
+ * Returns 0 on success or -1 with errno set on error.
+ */
+static int hosts_shm_name(const char *path, char *name, size_t len)
+{
+  char *full;
+  const unsigned char *p;
+  u_int64_t hash = 0xCBF29CE484222325ULL;
+
+  full = realpath(path, NULL);
+  if (full == NULL)
+    return -1;
+  for (p = (const unsigned char *) full; *p != '\0'; p++)
+    hash = (hash ^ *p) * 0x100000001B3ULL;
+  free(full);
+  snprintf(name, len, HOSTS_SHM_PREFIX "%lu.%016llx",
+    (unsigned long) geteuid(), (unsigned long long) hash);
+
+  return 0;
+}
+
+/* Fills in the fields of h that say which version of a file sb is. */
+static void stamp_hosts_shm(struct hosts_shm_header *h, const struct stat *sb)
+{
+  h->dev = sb->st_dev;
+  h->ino = sb->st_ino;
+  h->size = sb->st_size;
+  h->mtime_sec = sb->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  h->mtime_nsec = sb->st_mtim.tv_nsec;
+#else
+  h->mtime_nsec = 0;
+#endif
+}
+
+/*
+ * Attaches, read only, to the copy of the wake.hosts file at path
+ * that a wake process published with publish_hosts_shm, if there is
+ * one and it was made from the file as it is now.  Nothing is parsed
+ * and the lookups go straight to the shared pages.
+ *
+ * Returns a pointer to the database, which must be closed with
+ * close_hosts_db, or NULL on error, with errno set to ENOENT if no
+ * copy has been published, ESTALE if the file has changed since,
+ * EAGAIN if it is still being published and EACCES if the object
+ * belongs to someone else.
+ */
+struct hosts_db *attach_hosts_shm(const char *path)
+{
+  struct hosts_db *db;
+  const struct hosts_shm_header *h;
+  struct hosts_shm_header stamp;
+  struct stat sb;
+  char name[64];
+  int fd = -1, error = 0;
+
+  db = calloc(1, sizeof(struct hosts_db));
+  if (db == NULL)
+    return NULL;
+
+  if (hosts_shm_name(path, name, sizeof(name)) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1 || fstat(fd, &sb) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  if (sb.st_uid != geteuid()) {
+    error = EACCES;
+    goto CLEAN_UP;
+  }
+  /* It is empty until its publisher has made room for the image. */
+  if ((size_t) sb.st_size < sizeof(struct hosts_shm_header)) {
+    error = EAGAIN;
+    goto CLEAN_UP;
+  }
+  db->size = sb.st_size;
+  db->base = mmap(NULL, db->size, PROT_READ, MAP_SHARED, fd, 0);
+  if (db->base == MAP_FAILED) {
+    error = errno;
+    db->base = NULL;
+    goto CLEAN_UP;
+  }
+
+  h = db->base;
+  if (memcmp(h->magic, HOSTS_SHM_MAGIC, sizeof(HOSTS_SHM_MAGIC)) != 0
+      || !__atomic_load_n(&h->ready, __ATOMIC_ACQUIRE)) {
+    error = EAGAIN;
+    goto CLEAN_UP;
+  }
+  if (stat(path, &sb) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  stamp_hosts_shm(&stamp, &sb);
+  if (h->dev != stamp.dev || h->ino != stamp.ino || h->size != stamp.size
+      || h->mtime_sec != stamp.mtime_sec
+      || h->mtime_nsec != stamp.mtime_nsec) {
+    error = ESTALE;
+    goto CLEAN_UP;
+  }
+  if (h->image_size > db->size - sizeof(struct hosts_shm_header)
+      || use_hosts_db_image(db, h + 1, h->image_size) == -1)
+    error = EINVAL;
+
+CLEAN_UP:
+  if (fd != -1)
+    close(fd);
+  if (error) {
+    close_hosts_db(db);
+    errno = error;
+    return NULL;
+  }
+
+  return db;
+}
+
+/*
+ * Tells whether the object open on fd may be removed: a copy of an
+ * older version of the file that sb is the current one of, or one
+ * whose publisher died before it was ready.  An object that another
+ * process is still filling in with the file as it is now, or one that
+ * is up to date, is left alone.
+ *
+ * Returns 1 if it is stale or 0 if not.
+ */
+static int hosts_shm_stale(int fd, const struct stat *sb)
+{
+  struct hosts_shm_header h, stamp;
+  struct stat osb;
+
+  if (fstat(fd, &osb) == -1 || osb.st_uid != geteuid()
+      || pread(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h)
+      || memcmp(h.magic, HOSTS_SHM_MAGIC, sizeof(HOSTS_SHM_MAGIC)) != 0)
+    return 0;
+  if (!h.ready && h.pid != 0 && kill((pid_t) h.pid, 0) == -1
+      && errno == ESRCH)
+    return 1;
+  stamp_hosts_shm(&stamp, sb);
+  return h.dev != stamp.dev || h.ino != stamp.ino || h.size != stamp.size
+    || h.mtime_sec != stamp.mtime_sec || h.mtime_nsec != stamp.mtime_nsec;
+}
+
+/*
+ * Claims the shared memory object called name, to publish a copy of
+ * the file that sb is the current version of, and writes a header in
+ * it that says who is filling it in.  An object already there is only
+ * removed if hosts_shm_stale says it is, so that one another process
+ * is still filling in is never pulled out from under it.
+ *
+ * Returns the object, open for reading and writing, or -1 on error,
+ * with errno set to EEXIST if a copy that isn't stale is there.
+ */
+static int claim_hosts_shm(const char *name, const struct stat *sb)
+{
+  struct hosts_shm_header h;
+  int fd, stale, error;
+
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd == -1 && errno == EEXIST) {
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+      return -1;
+    stale = hosts_shm_stale(fd, sb);
+    close(fd);
+    if (!stale) {
+      errno = EEXIST;
+      return -1;
+    }
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  }
+  if (fd == -1)
+    return -1;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, HOSTS_SHM_MAGIC, sizeof(HOSTS_SHM_MAGIC));
+  stamp_hosts_shm(&h, sb);
+  h.pid = getpid();
+  if (pwrite(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h)) {
+    error = errno;
+    shm_unlink(name);
+    close(fd);
+    errno = error;
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * Parses the wake.hosts file at path into a database image and
+ * publishes it in shared memory for attach_hosts_shm, in place of a
+ * stale copy.  Processes that are using the stale copy keep it until
+ * they close it.  The object is claimed before the file is read, so
+ * that other processes wait for it rather than read the file too.  It
+ * is made afresh, not rewritten, and the header is only marked ready
+ * once the image is in it, so no process ever sees half of one.  If
+ * it can't be published for any other reason, the image is kept in
+ * private memory and used all the same.
+ *
+ * Returns a pointer to the database, which must be closed with
+ * close_hosts_db, or NULL with errno set on error, to EAGAIN if
+ * another process is publishing the file.
+ */
+struct hosts_db *publish_hosts_shm(char *path)
+{
+  struct hosts_db *db;
+  struct hosts_shm_header *h;
+  struct hosts_map *map;
+  struct stat sb;
+  char name[64], *image = NULL;
+  size_t size;
+  int fd = -1, error = 0;
+
+  db = calloc(1, sizeof(struct hosts_db));
+  if (db == NULL)
+    return NULL;
+
+  /* Stamp the file as it was before reading it, so that a change
+   * while it is read makes the copy stale rather than wrong. */
+  if (stat(path, &sb) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  if (hosts_shm_name(path, name, sizeof(name)) == 0) {
+    fd = claim_hosts_shm(name, &sb);
+    if (fd == -1 && errno == EEXIST) {
+      error = EAGAIN;
+      goto CLEAN_UP;
+    }
+#ifdef DEBUG
+    if (fd == -1)
+      fprintf(stderr, "Can't publish %s: %s\n", path, strerror(errno));
+#endif
+  }
+
+  map = map_wake_hosts_file(path);
+  if (map == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  image = build_hosts_db_image(map, &size);
+  unmap_wake_hosts_file(map);
+  if (image == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  db->size = sizeof(struct hosts_shm_header) + size;
+
+  if (fd != -1 && ftruncate(fd, db->size) == 0)
+    db->base = mmap(NULL, db->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+      0);
+  if (fd != -1 && (db->base == NULL || db->base == MAP_FAILED)) {
+#ifdef DEBUG
+    fprintf(stderr, "Can't publish %s: %s\n", path, strerror(errno));
+#endif
+    shm_unlink(name);
+    close(fd);
+    fd = -1;
+  }
+  if (fd == -1) {
+    db->base = mmap(NULL, db->size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (db->base == MAP_FAILED) {
+      error = errno;
+      db->base = NULL;
+      goto CLEAN_UP;
+    }
+  }
+
+  h = db->base;
+  memcpy(h->magic, HOSTS_SHM_MAGIC, sizeof(HOSTS_SHM_MAGIC));
+  stamp_hosts_shm(h, &sb);
+  h->image_size = size;
+  memcpy(h + 1, image, size);
+  __atomic_store_n(&h->ready, 1, __ATOMIC_RELEASE);
+  if (use_hosts_db_image(db, h + 1, size) == -1)
+    error = errno;
+
+CLEAN_UP:
+  if (fd != -1) {
+    /* Don't leave others waiting for a copy that will never come. */
+    if (error)
+      shm_unlink(name);
+    close(fd);
+  }
+  free(image);
+  if (error) {
+    close_hosts_db(db);
+    errno = error;
+    return NULL;
+  }
+
+  return db;
+}
+
+#else /* no shared memory */
+
+struct hosts_db *attach_hosts_shm(const char *path)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+struct hosts_db *publish_hosts_shm(char *path)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HOSTSSHM_INCL
+#define HOSTSSHM_INCL 1
+
+#include "hostsdb.h"
+#include <sys/types.h>
+
+/* The start of the names of the shared memory objects that hold
+ * published wake.hosts files. */
+#define HOSTS_SHM_PREFIX "/wake-hosts."
+
+/*
+ * What comes before the database image in a shared memory object:
+ * which version of which wake.hosts file the image was made from, how
+ * long the image is and which process published it.  ready is set
+ * last, once the image is all there.
+ */
+struct hosts_shm_header {
+  char magic[8];
+  u_int64_t dev;
+  u_int64_t ino;
+  u_int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  u_int64_t image_size;
+  u_int32_t ready;
+  u_int32_t pid;
+};
+
+struct hosts_db *attach_hosts_shm(const char *path);
+
+struct hosts_db *publish_hosts_shm(char *path);
+
+#endif
@@ -0,0 +1,581 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "hosttable.h"
+#include "hostsmap.h"
+#include "build_msg.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+
+/* A host as the builder keeps it, with its strings as offsets. */
+struct host_record {
+  size_t name_off;
+  size_t mac_off;
+  size_t name_len;
+  u_int32_t ipaddr;
+  unsigned char prefix;
+  unsigned char mac[6];
+  unsigned char macvalid;
+};
+
+/* A tag on a host as the builder keeps it, with its name as an offset. */
+struct tag_ref {
+  size_t name_off;
+  u_int32_t name_len;
+  u_int32_t host;
+};
+
+/*
+ * Gets an arena ready with room for size bytes before it has to grow.
+ *
+ * Returns 0 on success or -1 if the memory cannot be allocated.
+ */
+int arena_init(struct arena *a, size_t size)
+{
+  a->used = 0;
+  a->size = size ? size : 64;
+  a->base = malloc(a->size);
+  return a->base == NULL ? -1 : 0;
+}
+
+/*
+ * Bumps len bytes off the end of the arena, doubling it if need be.
+ *
+ * Returns the offset of the new bytes or ARENA_FAILED if the arena
+ * cannot grow.
+ */
+size_t arena_alloc(struct arena *a, size_t len)
+{
+  size_t off = a->used, size = a->size;
+  char *t;
+
+  while (size - a->used < len)
+    size *= 2;
+  if (size != a->size) {
+    t = realloc(a->base, size);
+    if (t == NULL)
+      return ARENA_FAILED;
+    a->base = t;
+    a->size = size;
+  }
+  a->used += len;
+
+  return off;
+}
+
+/*
+ * Frees everything in the arena at once.
+ */
+void arena_free(struct arena *a)
+{
+  free(a->base);
+  a->base = NULL;
+  a->used = a->size = 0;
+}
+
+/*
+ * Returns the offset of a copy of the len bytes of s in the strings
+ * arena, adding one, nul-terminated, only if the same bytes are not
+ * already there.  Returns ARENA_FAILED if it runs out of memory.
+ */
+static size_t intern_string(struct host_table_builder *b, const char *s,
+  size_t len)
+{
+  struct intern_slot *slot, *old;
+  u_int32_t hash = hash_host_name(s, len);
+  size_t i, mask, off, oldsize;
+
+  /* Keep the table at most half full, as the host index does. */
+  if ((b->interned_count + 1) * 2 > b->interned_size) {
+    old = b->interned;
+    oldsize = b->interned_size;
+    b->interned_size = oldsize ? oldsize * 2 : 64;
+    b->interned = calloc(b->interned_size, sizeof(struct intern_slot));
+    if (b->interned == NULL) {
+      b->interned = old;
+      b->interned_size = oldsize;
+      return ARENA_FAILED;
+    }
+    mask = b->interned_size - 1;
+    for (i = 0; i < oldsize; i++)
+      if (old[i].off) {
+        off = old[i].hash & mask;
+        while (b->interned[off].off)
+          off = (off + 1) & mask;
+        b->interned[off] = old[i];
+      }
+    free(old);
+  }
+
+  mask = b->interned_size - 1;
+  for (i = hash & mask; b->interned[i].off; i = (i + 1) & mask) {
+    slot = &b->interned[i];
+    if (slot->hash == hash && slot->len == len
+        && memcmp(b->strings.base + slot->off - 1, s, len) == 0)
+      return slot->off - 1;
+  }
+
+  off = arena_alloc(&b->strings, len + 1);
+  if (off == ARENA_FAILED)
+    return ARENA_FAILED;
+  memcpy(b->strings.base + off, s, len);
+  b->strings.base[off + len] = '\0';
+  slot = &b->interned[i];
+  slot->hash = hash;
+  slot->len = len;
+  slot->off = off + 1;
+  b->interned_count++;
+
+  return off;
+}
+
+/*
+ * Creates a builder with room for the given number of hosts and bytes
+ * of strings before it has to grow.
+ *
+ * Returns a pointer to the builder or NULL on error.
+ */
+struct host_table_builder *new_host_table_builder(size_t hosts,
+  size_t strings)
+{
+  struct host_table_builder *b;
+
+  b = calloc(1, sizeof(struct host_table_builder));
+  if (b == NULL)
+    return NULL;
+  if (arena_init(&b->records, hosts * sizeof(struct host_record)) == -1
+      || arena_init(&b->strings, strings) == -1
+      || arena_init(&b->tags, 0) == -1) {
+    free_host_table_builder(b);
+    return NULL;
+  }
+
+  return b;
+}
+
+/*
+ * Adds a host to the table being built.  The name and mac address are
+ * copied into the string block, which holds only one copy of each
+ * distinct string, and the mac address is checked and converted to
+ * binary.  Only the first 17 characters of the mac address count, as
+ * in the rest of wake.  rest is whatever else was given for the
+ * host, which may hold its IPv4 address and tags, or NULL.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+int host_table_add(struct host_table_builder *b, const char *name,
+  size_t namelen, const char *macaddr, size_t maclen, const char *rest,
+  size_t restlen)
+{
+  struct host_record *rec;
+  struct tag_ref *ref;
+  const char *tag;
+  size_t off, name_off, mac_off, pos = 0, taglen;
+
+  if (maclen > MACADDR_MAXLEN)
+    maclen = MACADDR_MAXLEN;
+  name_off = intern_string(b, name, namelen);
+  mac_off = intern_string(b, macaddr, maclen);
+  off = arena_alloc(&b->records, sizeof(struct host_record));
+  if (name_off == ARENA_FAILED || mac_off == ARENA_FAILED
+      || off == ARENA_FAILED)
+    return -1;
+
+  rec = (struct host_record *) (b->records.base + off);
+  rec->name_off = name_off;
+  rec->mac_off = mac_off;
+  rec->name_len = namelen;
+  rec->macvalid = parse_macaddr(macaddr, maclen, rec->mac, NULL);
+  find_host_ipaddr(rest, rest != NULL ? restlen : 0, &rec->ipaddr,
+    &rec->prefix);
+
+  while (rest != NULL && next_host_tag(rest, restlen, &pos, &tag, &taglen)) {
+    name_off = intern_string(b, tag, taglen);
+    off = arena_alloc(&b->tags, sizeof(struct tag_ref));
+    if (name_off == ARENA_FAILED || off == ARENA_FAILED)
+      return -1;
+    ref = (struct tag_ref *) (b->tags.base + off);
+    ref->name_off = name_off;
+    ref->name_len = taglen;
+    ref->host = b->count;
+  }
+  b->count++;
+
+  return 0;
+}
+
+/*
+ * Gathers the tags collected by b into table->tags, each with the ids
+ * of its hosts in the block at ids, which has room for one id per
+ * tag_ref, and indexes them by name.  The tags are seen in file order,
+ * so every tag's ids come out sorted; a host that gives the same tag
+ * twice is only counted once.
+ *
+ * Returns the tag index or NULL if there is no memory for it.
+ */
+static struct host_index *index_host_tags(struct host_table *table,
+  struct host_table_builder *b, u_int32_t *ids)
+{
+  struct host_index *idx;
+  struct tag_ref *refs = (struct tag_ref *) b->tags.base;
+  struct host_tag *tag;
+  const char *name;
+  size_t i, nrefs = b->tags.used / sizeof(struct tag_ref);
+
+  idx = new_host_index(nrefs);
+  if (idx == NULL)
+    return NULL;
+
+  /* Give each tag its slot and room for as many ids as it has refs. */
+  table->tag_count = 0;
+  for (i = 0; i < nrefs; i++) {
+    name = table->strings + refs[i].name_off;
+    tag = host_index_find(idx, name, refs[i].name_len);
+    if (tag == NULL) {
+      tag = &table->tags[table->tag_count++];
+      tag->name = name;
+      tag->count = 0;
+      if (host_index_add(idx, name, refs[i].name_len, tag) == -1) {
+        free_host_index(idx);
+        return NULL;
+      }
+    }
+    tag->count++;
+  }
+  for (i = 0; i < table->tag_count; i++) {
+    tag = &table->tags[i];
+    tag->ids = ids;
+    ids += tag->count;
+    tag->count = 0;
+  }
+
+  for (i = 0; i < nrefs; i++) {
+    tag = host_index_find(idx, table->strings + refs[i].name_off,
+      refs[i].name_len);
+    if (tag->count == 0 || tag->ids[tag->count - 1] != refs[i].host)
+      tag->ids[tag->count++] = refs[i].host;
+  }
+
+  return idx;
+}
+
+/*
+ * Packs the hosts collected by b into a single block of memory, with
+ * the table itself first, then the struct hostinfo entries, the tags
+ * and their ids and then the strings, and indexes them by name.  The
+ * builder is freed.
+ *
+ * Returns a pointer to the table, which must be freed with
+ * free_host_table, or NULL on error.
+ */
+struct host_table *finish_host_table(struct host_table_builder *b)
+{
+  struct host_table *table;
+  struct host_record *rec;
+  struct hostinfo *host;
+  u_int32_t *ids;
+  size_t i, hosts_size = b->count * sizeof(struct hostinfo);
+  size_t nrefs = b->tags.used / sizeof(struct tag_ref);
+  size_t tags_size = nrefs * sizeof(struct host_tag);
+  size_t ids_size = nrefs * sizeof(u_int32_t);
+  int error;
+
+  table = malloc(sizeof(struct host_table) + hosts_size + tags_size
+    + ids_size + b->strings.used);
+  if (table == NULL) {
+    error = errno;
+    free_host_table_builder(b);
+    errno = error;
+    return NULL;
+  }
+  table->hosts = (struct hostinfo *) (table + 1);
+  table->count = b->count;
+  table->tags = (struct host_tag *) ((char *) table->hosts + hosts_size);
+  ids = (u_int32_t *) ((char *) table->tags + tags_size);
+  table->strings = (char *) ids + ids_size;
+  table->strings_size = b->strings.used;
+  memcpy(table->strings, b->strings.base, b->strings.used);
+
+  table->index = new_host_index(b->count);
+  for (i = 0; table->index != NULL && i < b->count; i++) {
+    rec = (struct host_record *) b->records.base + i;
+    host = &table->hosts[i];
+    host->name = table->strings + rec->name_off;
+    host->macaddr = table->strings + rec->mac_off;
+    memcpy(host->mac, rec->mac, 6);
+    host->macvalid = rec->macvalid;
+    host->ipaddr = rec->ipaddr;
+    host->prefix = rec->prefix;
+    if (host_index_add(table->index, host->name, rec->name_len,
+          host) == -1) {
+      free_host_index(table->index);
+      table->index = NULL;
+    }
+  }
+  table->tag_index = NULL;
+  table->trie = NULL;
+  if (table->index != NULL) {
+    table->tag_index = index_host_tags(table, b, ids);
+    if (table->tag_index == NULL) {
+      free_host_index(table->index);
+      table->index = NULL;
+    }
+  }
+  error = errno;
+  free_host_table_builder(b);
+
+  if (table->index == NULL) {
+    free(table);
+    errno = error;
+    return NULL;
+  }
+
+  return table;
+}
+
+/*
+ * Frees a builder and everything in it.
+ */
+void free_host_table_builder(struct host_table_builder *b)
+{
+  if (b == NULL)
+    return;
+  arena_free(&b->records);
+  arena_free(&b->strings);
+  arena_free(&b->tags);
+  free(b->interned);
+  free(b);
+}
+
+/*
+ * Reads the wake.hosts file at path into a host table.  The file is
+ * scanned once with map_wake_hosts_file, which also tells us how big
+ * the arenas need to be, so they never have to grow.
+ *
+ * Returns a pointer to the table or NULL with errno set on error.
+ */
+struct host_table *load_host_table(char *path)
+{
+  struct hosts_map *map;
+  struct host_table_builder *b;
+  struct host_view *view;
+  size_t i, strings = 0;
+  int error;
+
+  map = map_wake_hosts_file(path);
+  if (map == NULL)
+    return NULL;
+
+  /* The rest of each line is counted in case it is all tags. */
+  for (i = 0; i < map->count; i++)
+    strings += map->views[i].name_len + HOST_VIEW_MACLEN(&map->views[i])
+      + map->views[i].rest_len + 2;
+  b = new_host_table_builder(map->count, strings);
+
+  for (i = 0; b != NULL && i < map->count; i++) {
+    view = &map->views[i];
+    if (host_table_add(b, map->base + view->name_off, view->name_len,
+          map->base + view->mac_off, view->mac_len,
+          map->base + view->rest_off, view->rest_len) == -1) {
+      error = errno;
+      free_host_table_builder(b);
+      b = NULL;
+      errno = error;
+    }
+  }
+  error = errno;
+  unmap_wake_hosts_file(map);
+
+  if (b == NULL) {
+    errno = error;
+    return NULL;
+  }
+
+  return finish_host_table(b);
+}
+
+/*
+ * Looks up name in the table without regard to case.  It returns the
+ * first matching struct hostinfo pointer or NULL if nothing matches.
+ */
+struct hostinfo *host_table_find(const struct host_table *table,
+  const char *name)
+{
+  return host_index_find(table->index, name, strlen(name));
+}
+
+/*
+ * Keeps only those of the count ids that are also among the n sorted
+ * ids in other.  Each id is looked for by galloping ahead from where
+ * the last one was found and then searching the bracket, so a small
+ * set intersected with a large one costs little more than the small
+ * one's size.
+ *
+ * Returns how many ids are kept.
+ */
+static size_t intersect_host_ids(u_int32_t *ids, size_t count,
+  const u_int32_t *other, size_t n)
+{
+  size_t i, kept = 0, lo = 0, hi, mid, step;
+
+  for (i = 0; i < count && lo < n; i++) {
+    for (hi = lo, step = 1; hi < n && other[hi] < ids[i]; step *= 2) {
+      lo = hi + 1;
+      hi += step;
+    }
+    if (hi > n)
+      hi = n;
+    while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (other[mid] < ids[i])
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo < n && other[lo] == ids[i])
+      ids[kept++] = ids[i];
+  }
+
+  return kept;
+}
+
+/*
+ * Finds the tag named by the term of expr that starts at *p, an at
+ * sign followed by the name, and moves *p past it and the ampersand
+ * after it, if there is one.  *tag is set to NULL if no host has the
+ * tag.
+ *
+ * Returns 0 or -1 if the term is not a tag.
+ */
+static int next_tag_term(const struct host_table *table, const char **p,
+  const struct host_tag **tag)
+{
+  const char *name = *p + 1;
+  size_t len = strcspn(name, "&");
+
+  if (**p != '@' || len == 0 || (name[len] == '&' && name[len + 1] == '\0'))
+    return -1;
+  *tag = host_index_find(table->tag_index, name, len);
+  *p = name + len + (name[len] == '&');
+  return 0;
+}
+
+/*
+ * Picks out the hosts in table that carry every tag in expr, which is
+ * one or more tags, each with its at sign, joined by ampersands, as
+ * in @rack12&@gpu.  Tags are matched without regard to case.  The
+ * intersection starts from the tag with the fewest hosts and narrows
+ * it with each of the others in turn, so it never does more than a
+ * search of each other tag per host of that one.
+ *
+ * Returns 0 and fills in sel, in file order, or -1 with errno set on
+ * error, EINVAL if expr is not a tag expression.  sel->ids must be
+ * freed with free.
+ */
+int host_table_select(const struct host_table *table, const char *expr,
+  struct host_selection *sel)
+{
+  const struct host_tag *tag, *smallest = NULL;
+  const char *p;
+  int missing = 0;
+
+  sel->ids = NULL;
+  sel->count = 0;
+  for (p = expr; *p != '\0'; ) {
+    if (next_tag_term(table, &p, &tag) == -1) {
+      errno = EINVAL;
+      return -1;
+    }
+    if (tag == NULL)
+      missing = 1;
+    else if (smallest == NULL || tag->count < smallest->count)
+      smallest = tag;
+  }
+  if (p == expr) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (missing)
+    return 0;
+
+  sel->ids = malloc(smallest->count * sizeof(u_int32_t));
+  if (sel->ids == NULL)
+    return -1;
+  memcpy(sel->ids, smallest->ids, smallest->count * sizeof(u_int32_t));
+  sel->count = smallest->count;
+  for (p = expr; *p != '\0' && sel->count > 0; ) {
+    next_tag_term(table, &p, &tag);
+    if (tag != smallest)
+      sel->count = intersect_host_ids(sel->ids, sel->count, tag->ids,
+        tag->count);
+  }
+
+  return 0;
+}
+
+/*
+ * Picks out the hosts in table whose names match pattern, a shell
+ * wildcard pattern as for fnmatch, such as db-prod-*, without regard
+ * to case.  The part of the pattern before the first wildcard is
+ * looked up in the trie of names, so only the hosts that begin with
+ * it are ever looked at, and for a pattern that is just a prefix and
+ * a star, they all match without being looked at again.
+ *
+ * Returns 0 and fills in sel, in order of name, or -1 with errno set
+ * on error.  sel->ids must be freed with free.
+ */
+int host_table_match(struct host_table *table, const char *pattern,
+  struct host_selection *sel)
+{
+  size_t i, kept, len = strcspn(pattern, "*?[\\");
+
+  if (table->trie == NULL) {
+    table->trie = build_name_trie(table->hosts, table->count);
+    if (table->trie == NULL)
+      return -1;
+  }
+  if (name_trie_prefix(table->trie, pattern, len, &sel->ids,
+        &sel->count) == -1)
+    return -1;
+
+  if (strcmp(pattern + len, "*") != 0) {
+    for (i = kept = 0; i < sel->count; i++)
+      if (fnmatch(pattern, table->hosts[sel->ids[i]].name,
+            FNM_CASEFOLD) == 0)
+        sel->ids[kept++] = sel->ids[i];
+    sel->count = kept;
+  }
+
+  return 0;
+}
+
+/*
+ * Frees the table: the indexes and then the one block that holds
+ * everything else.
+ */
+void free_host_table(struct host_table *table)
+{
+  if (table == NULL)
+    return;
+  free_host_index(table->index);
+  free_host_index(table->tag_index);
+  free_name_trie(table->trie);
+  free(table);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HOSTTABLE_INCL
+#define HOSTTABLE_INCL 1
+
+#include "hostinfo.h"
+#include "hostindex.h"
+#include "nametrie.h"
+#include <sys/types.h>
+
+/*
+ * A bump allocator over a single block that grows by doubling.  Since
+ * the block can move while it grows, allocations are handed out as
+ * offsets from the start of it.
+ */
+struct arena {
+  char *base;
+  size_t used;
+  size_t size;
+};
+
+/* What arena_alloc returns when it runs out of memory. */
+#define ARENA_FAILED ((size_t) -1)
+
+/*
+ * The hosts that carry one tag, such as @rack12 in wake.hosts, as
+ * positions in the table's hosts array.  The ids are in ascending
+ * order with no repeats, so sets of them can be intersected in one
+ * pass.
+ */
+struct host_tag {
+  const char *name;
+  u_int32_t *ids;
+  size_t count;
+};
+
+/* The hosts picked out by a tag expression or a pattern, as
+ * positions in the table's hosts array. */
+struct host_selection {
+  u_int32_t *ids;
+  size_t count;
+};
+
+/*
+ * All of the hosts from a wake.hosts file in one allocation: the
+ * struct hostinfo entries, in file order, then the tags and the ids
+ * of their hosts, followed by the block of interned strings that
+ * they point into.  The index finds entries by name and the tag index
+ * finds a struct host_tag by its name, without the at sign.  The trie
+ * of names is made the first time a pattern is matched.
+ */
+struct host_table {
+  struct hostinfo *hosts;
+  size_t count;
+  struct host_tag *tags;
+  size_t tag_count;
+  char *strings;
+  size_t strings_size;
+  struct host_index *index;
+  struct host_index *tag_index;
+  struct name_trie *trie;
+};
+
+/* One slot of the table used to intern strings while building. */
+struct intern_slot {
+  u_int32_t hash;
+  u_int32_t len;
+  size_t off; /* where the string is in the strings arena, plus 1 */
+};
+
+/* Collects hosts for a struct host_table until finish_host_table. */
+struct host_table_builder {
+  struct arena records;
+  struct arena strings;
+  struct arena tags;
+  struct intern_slot *interned;
+  size_t interned_size;
+  size_t interned_count;
+  size_t count;
+};
+
+int arena_init(struct arena *a, size_t size);
+
+size_t arena_alloc(struct arena *a, size_t len);
+
+void arena_free(struct arena *a);
+
+struct host_table_builder *new_host_table_builder(size_t hosts,
+  size_t strings);
+
+int host_table_add(struct host_table_builder *b, const char *name,
+  size_t namelen, const char *macaddr, size_t maclen, const char *rest,
+  size_t restlen);
+
+struct host_table *finish_host_table(struct host_table_builder *b);
+
+void free_host_table_builder(struct host_table_builder *b);
+
+struct host_table *load_host_table(char *path);
+
+struct hostinfo *host_table_find(const struct host_table *table,
+  const char *name);
+
+int host_table_select(const struct host_table *table, const char *expr,
+  struct host_selection *sel);
+
+int host_table_match(struct host_table *table, const char *pattern,
+  struct host_selection *sel);
+
+void free_host_table(struct host_table *table);
+
+#endif
@@ -0,0 +1,1108 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "inventory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/* How much of the file is read at a time into one batch. */
+#define INVENTORY_CHUNK (1 << 20)
+
+/* How many batches there are between the thread that reads and parses
+ * the file and the one that builds the table, which bounds the memory
+ * used for them. */
+#define INVENTORY_BATCHES 4
+
+/* The most columns of a CSV line, or tag lists of a JSON object, that
+ * are looked at. */
+#define INVENTORY_MAX_FIELDS 64
+
+/* What a CSV column or a JSON member holds. */
+#define FIELD_NONE -1
+#define FIELD_NAME 0
+#define FIELD_MAC 1
+#define FIELD_IP 2
+#define FIELD_PREFIX 3
+#define FIELD_TAGS 4
+#define FIELD_COUNT 5
+
+/* The names a column or member may go by for each field, without
+ * regard to case. */
+static const char *const field_names[FIELD_COUNT][7] = {
+  {"name", "host", "hostname", "host_name", NULL},
+  {"mac", "macaddr", "mac_address", "mac address", "ether", "hwaddr", NULL},
+  {"ip", "ipaddr", "ip_address", "ip address", "ipv4", "address", NULL},
+  {"prefix", "prefixlen", "cidr", NULL},
+  {"tags", "tag", "groups", NULL}
+};
+
+/* One host parsed out of a batch, as offsets into the batch's out
+ * arena.  rest is made up to look like the rest of a wake.hosts
+ * line: the IPv4 address, if there is one, and the tags. */
+struct inventory_row {
+  size_t name_off;
+  size_t mac_off;
+  size_t rest_off;
+  u_int32_t name_len;
+  u_int32_t mac_len;
+  u_int32_t rest_len;
+};
+
+/* Some whole lines of the file, and the hosts parsed out of them. */
+struct inventory_batch {
+  char *text;
+  size_t len;
+  size_t size;
+  struct arena rows;
+  struct arena out;
+  unsigned long skipped;
+  struct inventory_batch *next;
+};
+
+/*
+ * The state of one load_inventory.  The reading thread fills free
+ * batches and queues them on full, in file order, and the building
+ * thread takes them off, adds their hosts to the table and gives them
+ * back.  Everything from lock on is shared between the two.
+ */
+struct inventory_reader {
+  int fd;
+  int format;
+  int eof;
+  int started; /* a batch has been parsed */
+  int header_done; /* the first line of a CSV file has been seen */
+  int columns[FIELD_COUNT]; /* which CSV column holds each field */
+  char *pending; /* the start of a line the last batch cut off */
+  size_t pending_len;
+  size_t pending_size;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  struct inventory_batch *free;
+  struct inventory_batch *full;
+  struct inventory_batch **full_tail;
+  int done; /* the reader has read everything, or failed */
+  int stop; /* the builder has failed, so the reader should stop */
+  int error;
+};
+
+/*
+ * Reads the name of a format, as given to --format.
+ *
+ * Returns one of the INVENTORY_ formats or -1 if name is not one.
+ */
+int parse_inventory_format(const char *name)
+{
+  if (strcasecmp(name, "hosts") == 0)
+    return INVENTORY_HOSTS;
+  if (strcasecmp(name, "ethers") == 0)
+    return INVENTORY_ETHERS;
+  if (strcasecmp(name, "csv") == 0)
+    return INVENTORY_CSV;
+  if (strcasecmp(name, "json") == 0 || strcasecmp(name, "jsonl") == 0)
+    return INVENTORY_JSON;
+  return -1;
+}
+
+/*
+ * Guesses the format of the file at path from its name: .csv is CSV,
+ * .json, .jsonl and .ndjson are JSON, one object to a line, a file
+ * called ethers is in the format of /etc/ethers and anything else is
+ * in the wake.hosts format.
+ */
+int guess_inventory_format(const char *path)
+{
+  const char *base = strrchr(path, '/'), *dot;
+
+  base = base != NULL ? base + 1 : path;
+  if (strcmp(base, "ethers") == 0)
+    return INVENTORY_ETHERS;
+  dot = strrchr(base, '.');
+  if (dot == NULL)
+    return INVENTORY_HOSTS;
+  if (strcasecmp(dot, ".csv") == 0)
+    return INVENTORY_CSV;
+  if (strcasecmp(dot, ".json") == 0 || strcasecmp(dot, ".jsonl") == 0
+      || strcasecmp(dot, ".ndjson") == 0)
+    return INVENTORY_JSON;
+  return INVENTORY_HOSTS;
+}
+
+/* Returns which field a column or member called len bytes of s
+ * holds, or FIELD_NONE. */
+static int inventory_field(const char *s, size_t len)
+{
+  int field, i;
+
+  for (field = 0; field < FIELD_COUNT; field++)
+    for (i = 0; field_names[field][i] != NULL; i++)
+      if (strlen(field_names[field][i]) == len
+          && strncasecmp(field_names[field][i], s, len) == 0)
+        return field;
+  return FIELD_NONE;
+}
+
+/* Appends len bytes of s, which must not be in the arena itself, to
+ * b's out arena.  Returns their offset or ARENA_FAILED. */
+static size_t put_out(struct inventory_batch *b, const char *s, size_t len)
+{
+  size_t off = arena_alloc(&b->out, len);
+
+  if (off != ARENA_FAILED)
+    memcpy(b->out.base + off, s, len);
+  return off;
+}
+
+/* Appends a copy of the len bytes at off in b's out arena to it.
+ * Returns 0 on success or -1 if it can't grow. */
+static int copy_out(struct inventory_batch *b, size_t off, size_t len)
+{
+  size_t to = arena_alloc(&b->out, len);
+
+  if (to == ARENA_FAILED)
+    return -1;
+  memcpy(b->out.base + to, b->out.base + off, len);
+  return 0;
+}
+
+/* Whether c separates the tags in a list of them. */
+static int is_tag_separator(char c)
+{
+  return c == ';' || c == ',' || c == '|' || c == '#'
+    || isspace((unsigned char) c);
+}
+
+/*
+ * Appends the tags in the list of len bytes at off in b's out arena,
+ * separated by any of ;,| or white space and each with or without an
+ * at sign, as " @tag" for each one.
+ *
+ * Returns 0 on success or -1 if the arena can't grow.
+ */
+static int put_tags(struct inventory_batch *b, size_t off, size_t len)
+{
+  size_t i = 0, start, at;
+
+  while (i < len) {
+    if (is_tag_separator(b->out.base[off + i])) {
+      i++;
+      continue;
+    }
+    for (start = i; i < len && !is_tag_separator(b->out.base[off + i]); i++)
+      ;
+    if (b->out.base[off + start] == '@')
+      start++;
+    if (start == i)
+      continue;
+    at = arena_alloc(&b->out, i - start + 2);
+    if (at == ARENA_FAILED)
+      return -1;
+    b->out.base[at] = ' ';
+    b->out.base[at + 1] = '@';
+    memcpy(b->out.base + at + 2, b->out.base + off + start, i - start);
+  }
+  return 0;
+}
+
+/*
+ * Appends the rest of a host's line, as wake.hosts would have it, made
+ * from the fields found for it, which are offsets into b's out arena
+ * with a length of 0 for a missing one.  The prefix is only added to
+ * an address that has none.
+ *
+ * Returns 0 on success or -1 if the arena can't grow.
+ */
+static int put_host_rest(struct inventory_batch *b, const size_t *offs,
+  const size_t *lens, const size_t *tag_offs, const size_t *tag_lens,
+  int ntags)
+{
+  size_t ip = offs[FIELD_IP], iplen = lens[FIELD_IP];
+  int i;
+
+  if (iplen > 0) {
+    if (copy_out(b, ip, iplen) == -1)
+      return -1;
+    if (lens[FIELD_PREFIX] > 0
+        && memchr(b->out.base + ip, '/', iplen) == NULL
+        && (put_out(b, "/", 1) == ARENA_FAILED
+          || copy_out(b, offs[FIELD_PREFIX], lens[FIELD_PREFIX]) == -1))
+      return -1;
+  }
+  for (i = 0; i < ntags; i++)
+    if (put_tags(b, tag_offs[i], tag_lens[i]) == -1)
+      return -1;
+  return 0;
+}
+
+/* Records a host whose name and mac address are at the given offsets
+ * in b's out arena and whose rest runs from rest_off to the end of it.
+ * Returns 0 on success or -1 if the rows can't grow. */
+static int add_inventory_row(struct inventory_batch *b, size_t name_off,
+  size_t name_len, size_t mac_off, size_t mac_len, size_t rest_off)
+{
+  struct inventory_row *row;
+  size_t off;
+
+  off = arena_alloc(&b->rows, sizeof(struct inventory_row));
+  if (off == ARENA_FAILED)
+    return -1;
+  row = (struct inventory_row *) (b->rows.base + off);
+  row->name_off = name_off;
+  row->name_len = name_len;
+  row->mac_off = mac_off;
+  row->mac_len = mac_len;
+  row->rest_off = rest_off;
+  row->rest_len = b->out.used - rest_off;
+  return 0;
+}
+
+/*
+ * Parses a line of an ethers(5) file: a mac address, then a host name,
+ * separated by white space, with # starting a comment.
+ *
+ * Returns 0 on success or -1 if memory runs out.
+ */
+static int parse_ethers_line(struct inventory_batch *b, const char *line,
+  size_t len)
+{
+  const char *hash = memchr(line, '#', len);
+  size_t i = 0, mac, maclen, name, namelen, mac_off, name_off;
+
+  if (hash != NULL)
+    len = hash - line;
+  while (i < len && isspace((unsigned char) line[i]))
+    i++;
+  if (i == len)
+    return 0;
+  for (mac = i; i < len && !isspace((unsigned char) line[i]); i++)
+    ;
+  maclen = i - mac;
+  while (i < len && isspace((unsigned char) line[i]))
+    i++;
+  for (name = i; i < len && !isspace((unsigned char) line[i]); i++)
+    ;
+  namelen = i - name;
+  if (namelen == 0) {
+    b->skipped++;
+    return 0;
+  }
+
+  name_off = put_out(b, line + name, namelen);
+  mac_off = put_out(b, line + mac, maclen);
+  if (name_off == ARENA_FAILED || mac_off == ARENA_FAILED)
+    return -1;
+  return add_inventory_row(b, name_off, namelen, mac_off, maclen,
+    b->out.used);
+}
+
+/*
+ * Splits a CSV line into fields, copying each into b's out arena with
+ * any quotes undone and, if it wasn't quoted, without the white space
+ * around it.  A quoted field can't hold a line break.  Only the first
+ * INVENTORY_MAX_FIELDS fields are kept, in offs and lens.
+ *
+ * Returns the number of fields kept or -1 if memory runs out.
+ */
+static int split_csv_line(struct inventory_batch *b, const char *line,
+  size_t len, size_t *offs, size_t *lens)
+{
+  size_t i = 0, start, end, off;
+  int n = 0;
+
+  for (;;) {
+    off = b->out.used;
+    while (i < len && (line[i] == ' ' || line[i] == '\t'))
+      i++;
+    if (i < len && line[i] == '"') {
+      for (i++; i < len; i++) {
+        for (start = i; i < len && line[i] != '"'; i++)
+          ;
+        if (put_out(b, line + start, i - start) == ARENA_FAILED)
+          return -1;
+        /* A doubled quote is a quote; any other ends the field. */
+        if (i + 1 < len && line[i + 1] == '"') {
+          if (put_out(b, "\"", 1) == ARENA_FAILED)
+            return -1;
+          i++;
+        }
+        else
+          break;
+      }
+      while (i < len && line[i] != ',')
+        i++;
+    }
+    else {
+      for (start = i; i < len && line[i] != ','; i++)
+        ;
+      for (end = i; end > start && isspace((unsigned char) line[end - 1]);
+           end--)
+        ;
+      if (put_out(b, line + start, end - start) == ARENA_FAILED)
+        return -1;
+    }
+    if (n < INVENTORY_MAX_FIELDS) {
+      offs[n] = off;
+      lens[n] = b->out.used - off;
+      n++;
+    }
+    if (i >= len)
+      break;
+    i++;
+  }
+
+  return n;
+}
+
+/*
+ * Works out from the first line of a CSV file, split into n fields at
+ * offs and lens, which column holds each field.  If there is no column
+ * for the name or the mac address, the line isn't taken for a header,
+ * and the columns are taken to be the name, the mac address, the IPv4
+ * address and the tags, in that order.
+ *
+ * Returns 1 if the line is a header and 0 if it is not.
+ */
+static int find_csv_columns(struct inventory_reader *r,
+  struct inventory_batch *b, const size_t *offs, const size_t *lens, int n)
+{
+  int i, field;
+
+  for (field = 0; field < FIELD_COUNT; field++)
+    r->columns[field] = -1;
+  for (i = 0; i < n; i++) {
+    field = inventory_field(b->out.base + offs[i], lens[i]);
+    if (field != FIELD_NONE && r->columns[field] == -1)
+      r->columns[field] = i;
+  }
+  if (r->columns[FIELD_NAME] != -1 && r->columns[FIELD_MAC] != -1)
+    return 1;
+
+  r->columns[FIELD_NAME] = 0;
+  r->columns[FIELD_MAC] = 1;
+  r->columns[FIELD_IP] = 2;
+  r->columns[FIELD_PREFIX] = -1;
+  r->columns[FIELD_TAGS] = 3;
+  return 0;
+}
+
+/*
+ * Parses a line of a CSV file.  The first line names the columns, as
+ * find_csv_columns describes; the tags column holds a list of tags.
+ *
+ * Returns 0 on success or -1 if memory runs out.
+ */
+static int parse_csv_line(struct inventory_reader *r,
+  struct inventory_batch *b, const char *line, size_t len)
+{
+  size_t offs[INVENTORY_MAX_FIELDS], lens[INVENTORY_MAX_FIELDS];
+  size_t found_offs[FIELD_COUNT], found_lens[FIELD_COUNT];
+  size_t mark = b->out.used, rest_off, i;
+  int n, field, col;
+
+  for (i = 0; i < len && isspace((unsigned char) line[i]); i++)
+    ;
+  if (i == len)
+    return 0;
+  n = split_csv_line(b, line, len, offs, lens);
+  if (n == -1)
+    return -1;
+  if (!r->header_done) {
+    r->header_done = 1;
+    if (find_csv_columns(r, b, offs, lens, n)) {
+      b->out.used = mark;
+      return 0;
+    }
+  }
+
+  for (field = 0; field < FIELD_COUNT; field++) {
+    col = r->columns[field];
+    found_offs[field] = col >= 0 && col < n ? offs[col] : 0;
+    found_lens[field] = col >= 0 && col < n ? lens[col] : 0;
+  }
+  if (found_lens[FIELD_NAME] == 0 || found_lens[FIELD_MAC] == 0) {
+    b->skipped++;
+    b->out.used = mark;
+    return 0;
+  }
+
+  rest_off = b->out.used;
+  if (put_host_rest(b, found_offs, found_lens, &found_offs[FIELD_TAGS],
+        &found_lens[FIELD_TAGS], found_lens[FIELD_TAGS] > 0) == -1)
+    return -1;
+  return add_inventory_row(b, found_offs[FIELD_NAME], found_lens[FIELD_NAME],
+    found_offs[FIELD_MAC], found_lens[FIELD_MAC], rest_off);
+}
+
+/* Where a JSON parse has got to in a line. */
+struct json_cursor {
+  const char *p;
+  const char *end;
+};
+
+static void skip_json_space(struct json_cursor *c)
+{
+  while (c->p < c->end && isspace((unsigned char) *c->p))
+    c->p++;
+}
+
+/* Reads n hexadecimal digits at c.  Returns their value or -1. */
+static long read_json_hex(struct json_cursor *c, int n)
+{
+  long value = 0;
+  int digit;
+
+  if (c->end - c->p < n)
+    return -1;
+  while (n-- > 0) {
+    if (*c->p >= '0' && *c->p <= '9')
+      digit = *c->p - '0';
+    else if (*c->p >= 'a' && *c->p <= 'f')
+      digit = *c->p - 'a' + 10;
+    else if (*c->p >= 'A' && *c->p <= 'F')
+      digit = *c->p - 'A' + 10;
+    else
+      return -1;
+    value = value * 16 + digit;
+    c->p++;
+  }
+  return value;
+}
+
+/* Appends the UTF-8 encoding of code point cp to b's out arena.
+ * Returns 0 on success or -1 if the arena can't grow. */
+static int put_utf8(struct inventory_batch *b, long cp)
+{
+  char buf[4];
+  size_t n;
+
+  if (cp < 0x80) {
+    buf[0] = cp;
+    n = 1;
+  }
+  else if (cp < 0x800) {
+    buf[0] = 0xC0 | (cp >> 6);
+    buf[1] = 0x80 | (cp & 0x3F);
+    n = 2;
+  }
+  else if (cp < 0x10000) {
+    buf[0] = 0xE0 | (cp >> 12);
+    buf[1] = 0x80 | ((cp >> 6) & 0x3F);
+    buf[2] = 0x80 | (cp & 0x3F);
+    n = 3;
+  }
+  else {
+    buf[0] = 0xF0 | (cp >> 18);
+    buf[1] = 0x80 | ((cp >> 12) & 0x3F);
+    buf[2] = 0x80 | ((cp >> 6) & 0x3F);
+    buf[3] = 0x80 | (cp & 0x3F);
+    n = 4;
+  }
+  return put_out(b, buf, n) == ARENA_FAILED ? -1 : 0;
+}
+
+/*
+ * Reads the JSON string at c into b's out arena with its escapes
+ * undone, and sets *off and *len to where it is.
+ *
+ * Returns 0 on success, -1 if there is no well formed string at c or
+ * -2 if memory runs out.
+ */
+static int read_json_string(struct json_cursor *c, struct inventory_batch *b,
+  size_t *off, size_t *len)
+{
+  const char *start;
+  long cp, low;
+  char ch;
+
+  if (c->p == c->end || *c->p != '"')
+    return -1;
+  c->p++;
+  *off = b->out.used;
+  for (;;) {
+    for (start = c->p; c->p < c->end && *c->p != '"' && *c->p != '\\';
+         c->p++)
+      ;
+    if (put_out(b, start, c->p - start) == ARENA_FAILED)
+      return -2;
+    if (c->p == c->end)
+      return -1;
+    if (*c->p++ == '"')
+      break;
+    if (c->p == c->end)
+      return -1;
+    switch (*c->p++) {
+    case '"': ch = '"'; break;
+    case '\\': ch = '\\'; break;
+    case '/': ch = '/'; break;
+    case 'b': ch = '\b'; break;
+    case 'f': ch = '\f'; break;
+    case 'n': ch = '\n'; break;
+    case 'r': ch = '\r'; break;
+    case 't': ch = '\t'; break;
+    case 'u':
+      cp = read_json_hex(c, 4);
+      if (cp == -1)
+        return -1;
+      /* A high surrogate followed by a low one makes one code point. */
+      if (cp >= 0xD800 && cp < 0xDC00 && c->end - c->p >= 6
+          && c->p[0] == '\\' && c->p[1] == 'u') {
+        c->p += 2;
+        low = read_json_hex(c, 4);
+        if (low < 0xDC00 || low >= 0xE000)
+          return -1;
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+      }
+      if (put_utf8(b, cp) == -1)
+        return -2;
+      continue;
+    default:
+      return -1;
+    }
+    if (put_out(b, &ch, 1) == ARENA_FAILED)
+      return -2;
+  }
+  *len = b->out.used - *off;
+
+  return 0;
+}
+
+/*
+ * Steps c past the JSON value at it, whatever it is, without keeping
+ * it.  Objects and arrays are only followed so deep.
+ *
+ * Returns 0 on success or -1 if the value isn't well formed.
+ */
+static int skip_json_value(struct json_cursor *c, int depth)
+{
+  const char *start;
+  char close;
+
+  skip_json_space(c);
+  if (c->p == c->end || depth > 32)
+    return -1;
+  switch (*c->p) {
+  case '"':
+    for (c->p++; c->p < c->end && *c->p != '"'; c->p++)
+      if (*c->p == '\\' && ++c->p == c->end)
+        return -1;
+    if (c->p == c->end)
+      return -1;
+    c->p++;
+    return 0;
+  case '{':
+  case '[':
+    close = *c->p == '{' ? '}' : ']';
+    c->p++;
+    skip_json_space(c);
+    if (c->p < c->end && *c->p == close) {
+      c->p++;
+      return 0;
+    }
+    for (;;) {
+      if (close == '}') {
+        if (skip_json_value(c, depth + 1) == -1)
+          return -1;
+        skip_json_space(c);
+        if (c->p == c->end || *c->p++ != ':')
+          return -1;
+      }
+      if (skip_json_value(c, depth + 1) == -1)
+        return -1;
+      skip_json_space(c);
+      if (c->p == c->end)
+        return -1;
+      if (*c->p == close) {
+        c->p++;
+        return 0;
+      }
+      if (*c->p++ != ',')
+        return -1;
+    }
+  default:
+    /* A number, true, false or null. */
+    for (start = c->p; c->p < c->end && (isalnum((unsigned char) *c->p)
+          || *c->p == '-' || *c->p == '+' || *c->p == '.'); c->p++)
+      ;
+    return c->p > start ? 0 : -1;
+  }
+}
+
+/*
+ * Parses a line of a JSON lines file, which should hold one object.
+ * Its members name the fields in the same way as the columns of a CSV
+ * file, and the tags may be a list in a string or an array of strings.
+ * Any other members are passed over.
+ *
+ * Returns 0 on success or -1 if memory runs out.
+ */
+static int parse_json_line(struct inventory_batch *b, const char *line,
+  size_t len)
+{
+  struct json_cursor c = {line, line + len};
+  size_t found_offs[FIELD_COUNT], found_lens[FIELD_COUNT];
+  size_t tag_offs[INVENTORY_MAX_FIELDS], tag_lens[INVENTORY_MAX_FIELDS];
+  size_t mark = b->out.used, key_off, key_len, off, vlen, rest_off;
+  const char *start;
+  int field, ntags = 0, rv = 0;
+
+  memset(found_lens, 0, sizeof(found_lens));
+  skip_json_space(&c);
+  if (c.p == c.end)
+    return 0;
+  if (*c.p++ != '{')
+    goto BAD;
+  skip_json_space(&c);
+  if (c.p < c.end && *c.p == '}')
+    goto BAD;
+
+  for (;;) {
+    skip_json_space(&c);
+    rv = read_json_string(&c, b, &key_off, &key_len);
+    if (rv != 0)
+      goto FAIL;
+    field = inventory_field(b->out.base + key_off, key_len);
+    b->out.used = key_off;
+    skip_json_space(&c);
+    if (c.p == c.end || *c.p++ != ':')
+      goto BAD;
+    skip_json_space(&c);
+
+    if (field != FIELD_NONE && c.p < c.end && *c.p == '"') {
+      rv = read_json_string(&c, b, &off, &vlen);
+      if (rv != 0)
+        goto FAIL;
+      if (field == FIELD_TAGS) {
+        if (ntags < INVENTORY_MAX_FIELDS) {
+          tag_offs[ntags] = off;
+          tag_lens[ntags++] = vlen;
+        }
+      }
+      else {
+        found_offs[field] = off;
+        found_lens[field] = vlen;
+      }
+    }
+    else if (field == FIELD_TAGS && c.p < c.end && *c.p == '[') {
+      c.p++;
+      skip_json_space(&c);
+      if (c.p < c.end && *c.p == ']')
+        c.p++;
+      else
+        for (;;) {
+          skip_json_space(&c);
+          if (c.p < c.end && *c.p == '"' && ntags < INVENTORY_MAX_FIELDS) {
+            rv = read_json_string(&c, b, &tag_offs[ntags], &tag_lens[ntags]);
+            if (rv != 0)
+              goto FAIL;
+            ntags++;
+          }
+          else if (skip_json_value(&c, 1) == -1)
+            goto BAD;
+          skip_json_space(&c);
+          if (c.p == c.end)
+            goto BAD;
+          if (*c.p == ']') {
+            c.p++;
+            break;
+          }
+          if (*c.p++ != ',')
+            goto BAD;
+        }
+    }
+    else if (field == FIELD_PREFIX && c.p < c.end
+        && isdigit((unsigned char) *c.p)) {
+      for (start = c.p; c.p < c.end && isdigit((unsigned char) *c.p); c.p++)
+        ;
+      found_offs[field] = put_out(b, start, c.p - start);
+      if (found_offs[field] == ARENA_FAILED)
+        return -1;
+      found_lens[field] = c.p - start;
+    }
+    else if (skip_json_value(&c, 0) == -1)
+      goto BAD;
+
+    skip_json_space(&c);
+    if (c.p == c.end)
+      goto BAD;
+    if (*c.p == '}')
+      break;
+    if (*c.p++ != ',')
+      goto BAD;
+  }
+
+  if (found_lens[FIELD_NAME] == 0 || found_lens[FIELD_MAC] == 0)
+    goto BAD;
+  rest_off = b->out.used;
+  if (put_host_rest(b, found_offs, found_lens, tag_offs, tag_lens,
+        ntags) == -1)
+    return -1;
+  return add_inventory_row(b, found_offs[FIELD_NAME], found_lens[FIELD_NAME],
+    found_offs[FIELD_MAC], found_lens[FIELD_MAC], rest_off);
+
+FAIL:
+  if (rv == -2)
+    return -1;
+BAD:
+  b->skipped++;
+  b->out.used = mark;
+  return 0;
+}
+
+/*
+ * Parses the lines of text in b into its rows, in the reader's format.
+ *
+ * Returns 0 on success or -1 if memory runs out.
+ */
+static int parse_inventory_batch(struct inventory_reader *r,
+  struct inventory_batch *b)
+{
+  const char *line = b->text, *end = b->text + b->len, *nl;
+  size_t len;
+  int rv = 0;
+
+  /* Spreadsheets like to start their CSV files with a byte order
+   * mark. */
+  if (!r->started && b->len >= 3 && memcmp(line, "\xEF\xBB\xBF", 3) == 0)
+    line += 3;
+  r->started = 1;
+
+  while (rv == 0 && line < end) {
+    nl = memchr(line, '\n', end - line);
+    len = (nl != NULL ? nl : end) - line;
+    if (len > 0 && line[len - 1] == '\r')
+      len--;
+    switch (r->format) {
+    case INVENTORY_ETHERS:
+      rv = parse_ethers_line(b, line, len);
+      break;
+    case INVENTORY_CSV:
+      rv = parse_csv_line(r, b, line, len);
+      break;
+    default:
+      rv = parse_json_line(b, line, len);
+      break;
+    }
+    line = nl != NULL ? nl + 1 : end;
+  }
+
+  return rv;
+}
+
+/* Makes sure that buf, of *size bytes, can hold need bytes, doubling
+ * it if not.  Returns 0 on success or -1 on error. */
+static int grow_buffer(char **buf, size_t *size, size_t need)
+{
+  size_t n = *size ? *size : INVENTORY_CHUNK;
+  char *t;
+
+  while (n < need)
+    n *= 2;
+  if (n == *size)
+    return 0;
+  t = realloc(*buf, n);
+  if (t == NULL)
+    return -1;
+  *buf = t;
+  *size = n;
+  return 0;
+}
+
+/*
+ * Fills b with the next whole lines of the file, at least a chunk of
+ * it unless the end comes first, and parses them.  A line that the
+ * chunk cuts off is kept for the next batch.
+ *
+ * Returns 1 if b got some lines, 0 at the end of the file or -1 with
+ * errno set on error.
+ */
+static int fill_inventory_batch(struct inventory_reader *r,
+  struct inventory_batch *b)
+{
+  size_t end;
+  ssize_t n;
+
+  b->rows.used = b->out.used = 0;
+  b->skipped = 0;
+  if (grow_buffer(&b->text, &b->size, r->pending_len + INVENTORY_CHUNK) == -1)
+    return -1;
+  if (r->pending_len > 0)
+    memcpy(b->text, r->pending, r->pending_len);
+  b->len = r->pending_len;
+  r->pending_len = 0;
+
+  for (;;) {
+    if (!r->eof) {
+      if (grow_buffer(&b->text, &b->size, b->len + INVENTORY_CHUNK) == -1)
+        return -1;
+      n = read(r->fd, b->text + b->len, INVENTORY_CHUNK);
+      if (n == -1) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+      if (n == 0)
+        r->eof = 1;
+      b->len += n;
+    }
+    if (r->eof)
+      break;
+    for (end = b->len; end > 0 && b->text[end - 1] != '\n'; end--)
+      ;
+    /* Without a line break, the line is longer than a chunk. */
+    if (end > 0) {
+      if (b->len > end) {
+        if (grow_buffer(&r->pending, &r->pending_size, b->len - end) == -1)
+          return -1;
+        memcpy(r->pending, b->text + end, b->len - end);
+      }
+      r->pending_len = b->len - end;
+      b->len = end;
+      break;
+    }
+  }
+  if (b->len == 0)
+    return 0;
+
+  return parse_inventory_batch(r, b) == -1 ? -1 : 1;
+}
+
+/*
+ * The reading thread: fills free batches and queues them until the
+ * file runs out, something fails or the building thread says to stop.
+ */
+static void *run_inventory_reader(void *arg)
+{
+  struct inventory_reader *r = arg;
+  struct inventory_batch *b;
+  int n, error;
+
+  for (;;) {
+    pthread_mutex_lock(&r->lock);
+    while (r->free == NULL && !r->stop)
+      pthread_cond_wait(&r->changed, &r->lock);
+    b = r->stop ? NULL : r->free;
+    if (b != NULL)
+      r->free = b->next;
+    pthread_mutex_unlock(&r->lock);
+    if (b == NULL)
+      return NULL;
+
+    n = fill_inventory_batch(r, b);
+    error = errno;
+
+    pthread_mutex_lock(&r->lock);
+    if (n == 1) {
+      b->next = NULL;
+      *r->full_tail = b;
+      r->full_tail = &b->next;
+    }
+    else {
+      b->next = r->free;
+      r->free = b;
+      r->done = 1;
+      if (n == -1)
+        r->error = error;
+    }
+    pthread_cond_broadcast(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+    if (n != 1)
+      return NULL;
+  }
+}
+
+/*
+ * Adds the hosts in the rows of b to the table being built.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int add_inventory_batch(struct host_table_builder *tb,
+  struct inventory_batch *b, struct inventory_stats *stats)
+{
+  const struct inventory_row *row = (struct inventory_row *) b->rows.base;
+  size_t i, n = b->rows.used / sizeof(struct inventory_row);
+
+  for (i = 0; i < n; i++, row++)
+    if (host_table_add(tb, b->out.base + row->name_off, row->name_len,
+          b->out.base + row->mac_off, row->mac_len,
+          row->rest_len > 0 ? b->out.base + row->rest_off : NULL,
+          row->rest_len) == -1)
+      return -1;
+  stats->rows += n;
+  stats->skipped += b->skipped;
+
+  return 0;
+}
+
+/*
+ * The building thread's side: takes the batches off the queue in
+ * order and adds their hosts to tb until the reader is done.
+ *
+ * Returns 0 on success or an errno value on error.
+ */
+static int build_from_inventory(struct inventory_reader *r,
+  struct host_table_builder *tb, struct inventory_stats *stats)
+{
+  struct inventory_batch *b;
+  int error = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&r->lock);
+    while (r->full == NULL && !r->done)
+      pthread_cond_wait(&r->changed, &r->lock);
+    b = r->full;
+    if (b != NULL && (r->full = b->next) == NULL)
+      r->full_tail = &r->full;
+    if (b == NULL)
+      error = r->error;
+    pthread_mutex_unlock(&r->lock);
+    if (b == NULL)
+      return error;
+
+    if (add_inventory_batch(tb, b, stats) == -1)
+      error = errno;
+
+    pthread_mutex_lock(&r->lock);
+    b->next = r->free;
+    r->free = b;
+    if (error)
+      r->stop = 1;
+    pthread_cond_broadcast(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+    if (error)
+      return error;
+  }
+}
+
+/*
+ * Reads the hosts from the file at path, in one of the formats
+ * INVENTORY_ETHERS, INVENTORY_CSV or INVENTORY_JSON, into a host table.
+ * The file is read a chunk at a time into a few batches, which one
+ * thread parses while another adds the hosts from the last ones to the
+ * table, so the two overlap and the memory used, besides the table,
+ * doesn't grow with the file.  If the thread can't be started, the
+ * batches are parsed and added in turn.  Lines without a name or a mac
+ * address are counted in stats and passed over.
+ *
+ * Returns a pointer to the table, which must be freed with
+ * free_host_table, or NULL with errno set on error.
+ */
+struct host_table *load_inventory(const char *path, int format,
+  struct inventory_stats *stats)
+{
+  struct inventory_reader r;
+  struct inventory_batch batches[INVENTORY_BATCHES];
+  struct host_table_builder *tb = NULL;
+  struct host_table *table = NULL;
+  struct timespec start, end;
+  struct stat sb;
+  pthread_t thread;
+  int i, n, locked = 0, error = 0;
+
+  if (format != INVENTORY_ETHERS && format != INVENTORY_CSV
+      && format != INVENTORY_JSON) {
+    errno = EINVAL;
+    return NULL;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  memset(stats, 0, sizeof(struct inventory_stats));
+  memset(&r, 0, sizeof(r));
+  memset(batches, 0, sizeof(batches));
+  r.format = format;
+  r.full_tail = &r.full;
+
+  r.fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (r.fd == -1 || fstat(r.fd, &sb) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  /* Guess at the size of the table from the size of the file; the
+   * builder grows if it has to. */
+  tb = new_host_table_builder(sb.st_size / 48 + 1, sb.st_size / 2 + 64);
+  if (tb == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  for (i = 0; i < INVENTORY_BATCHES; i++) {
+    if (arena_init(&batches[i].rows, 0) == -1
+        || arena_init(&batches[i].out, INVENTORY_CHUNK) == -1) {
+      error = errno;
+      goto CLEAN_UP;
+    }
+    batches[i].next = r.free;
+    r.free = &batches[i];
+  }
+  if (pthread_mutex_init(&r.lock, NULL) != 0) {
+    error = ENOMEM;
+    goto CLEAN_UP;
+  }
+  if (pthread_cond_init(&r.changed, NULL) != 0) {
+    pthread_mutex_destroy(&r.lock);
+    error = ENOMEM;
+    goto CLEAN_UP;
+  }
+  locked = 1;
+
+  if (pthread_create(&thread, NULL, run_inventory_reader, &r) == 0) {
+    error = build_from_inventory(&r, tb, stats);
+    pthread_join(thread, NULL);
+  }
+  else
+    while ((n = fill_inventory_batch(&r, &batches[0])) != 0)
+      if (n == -1 || add_inventory_batch(tb, &batches[0], stats) == -1) {
+        error = errno;
+        break;
+      }
+
+  if (!error) {
+    table = finish_host_table(tb);
+    tb = NULL;
+    if (table == NULL)
+      error = errno;
+  }
+
+CLEAN_UP:
+  if (locked) {
+    pthread_cond_destroy(&r.changed);
+    pthread_mutex_destroy(&r.lock);
+  }
+  for (i = 0; i < INVENTORY_BATCHES; i++) {
+    free(batches[i].text);
+    arena_free(&batches[i].rows);
+    arena_free(&batches[i].out);
+  }
+  free(r.pending);
+  free_host_table_builder(tb);
+  if (r.fd != -1)
+    close(r.fd);
+  if (error) {
+    errno = error;
+    return NULL;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  stats->seconds = (end.tv_sec - start.tv_sec)
+    + (end.tv_nsec - start.tv_nsec) / 1e9;
+  return table;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef INVENTORY_INCL
+#define INVENTORY_INCL 1
+
+#include "hosttable.h"
+#include <sys/types.h>
+
+/* The formats a list of hosts can come in.  INVENTORY_HOSTS is the
+ * wake.hosts format, which load_host_table reads; load_inventory reads
+ * the others. */
+#define INVENTORY_HOSTS 0
+#define INVENTORY_ETHERS 1
+#define INVENTORY_CSV 2
+#define INVENTORY_JSON 3
+
+/* What load_inventory did and how long it took. */
+struct inventory_stats {
+  unsigned long rows; /* lines that gave a host */
+  unsigned long skipped; /* lines that held no name or mac address */
+  double seconds;
+};
+
+int parse_inventory_format(const char *name);
+
+int guess_inventory_format(const char *path);
+
+struct host_table *load_inventory(const char *path, int format,
+  struct inventory_stats *stats);
+
+#endif
@@ -1,6 +1,6 @@
 /*
  * liblist - A library to implement doubly-linked lists in C.
- * Copyright © 2012 Jason J.A. Stephenson <jason@sigio.com>
+ * Copyright © 2012,2026 Jason J.A. Stephenson <jason@sigio.com>
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -19,196 +19,218 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <pthread.h>
 
 /* Doubly linked list implementation. */
 
+/* Makes a new member for handle's list that is not linked in yet. */
+static list_t *new_list_member(list_handle_t *handle, void *data)
+{
+  list_t *new = malloc(sizeof(list_t));
+  if (new != NULL) {
+    new->data = data;
+    new->previous = NULL;
+    new->next = NULL;
+    new->handle = handle;
+  }
+  return new;
+}
+
+/* Takes member out of its list and frees it. The handle is freed,
+ * too, if member was the last one. */
+static void unlink_list_member(list_t *member)
+{
+  list_handle_t *handle = member->handle;
+  if (member->previous != NULL)
+    member->previous->next = member->next;
+  else
+    handle->head = member->next;
+  if (member->next != NULL)
+    member->next->previous = member->previous;
+  else
+    handle->tail = member->previous;
+  free(member);
+  if (--handle->length == 0)
+    free(handle);
+}
+
+list_handle_t *new_list_handle(void)
+{
+  list_handle_t *handle = malloc(sizeof(list_handle_t));
+  if (handle != NULL) {
+    handle->head = NULL;
+    handle->tail = NULL;
+    handle->length = 0;
+  }
+  return handle;
+}
+
+list_handle_t *get_list_handle(list_t *list)
+{
+  return list->handle;
+}
+
+list_t *list_handle_append(list_handle_t *handle, void *data)
+{
+  list_t *new = new_list_member(handle, data);
+  if (new != NULL) {
+    new->previous = handle->tail;
+    if (handle->tail != NULL)
+      handle->tail->next = new;
+    else
+      handle->head = new;
+    handle->tail = new;
+    handle->length++;
+  }
+  return new;
+}
+
+list_t *list_handle_prepend(list_handle_t *handle, void *data)
+{
+  list_t *new = new_list_member(handle, data);
+  if (new != NULL) {
+    new->next = handle->head;
+    if (handle->head != NULL)
+      handle->head->previous = new;
+    else
+      handle->tail = new;
+    handle->head = new;
+    handle->length++;
+  }
+  return new;
+}
+
+size_t list_handle_count(const list_handle_t *handle)
+{
+  return handle->length;
+}
+
+void free_list_handle(list_handle_t *handle)
+{
+  list_t *temp, *list = handle->head;
+  while (list != NULL) {
+    temp = list->next;
+    free(list);
+    list = temp;
+  }
+  free(handle);
+}
+
 list_t *initialize_list(size_t count, ...)
 {
   extern int errno;
   int error;
   va_list ap;
 
-  list_t *head, *current;
-  head = malloc(sizeof(list_t));
+  list_t *head;
+  list_handle_t *handle = new_list_handle();
+  if (handle == NULL)
+    return NULL;
+
+  /* We always make at least one member, even with nothing in it. */
+  head = list_handle_append(handle, NULL);
   if (head != NULL) {
-    head->data = NULL;
-    head->previous = NULL;
-    head->next = NULL;
-    current = head;
     va_start(ap, count);
+    if (count--)
+      head->data = va_arg(ap, void *);
     while (count--) {
-      current->data = va_arg(ap, void *);
-      if (count) {
-        current->next = malloc(sizeof(list_t));
-        if (current->next != NULL) {
-          current->next->previous = current;
-          current->next->next = NULL;
-          current->next->data = NULL;
-          current = current->next;
-        }
-        else {
-          error = errno;
-          free_list(head);
-          errno = error;
-          break;
-        }
-      }
-      else {
-        current->next = NULL;
+      if (list_handle_append(handle, va_arg(ap, void *)) == NULL) {
+        error = errno;
+        free_list_handle(handle);
+        errno = error;
+        head = NULL;
+        break;
       }
     }
     va_end(ap);
   }
+  else
+    free(handle);
   return head;
 }
 
 void free_list(list_t *list)
 {
-  list_t *temp;
-  list = unwind_list(list);
-  while (list != NULL) {
-    temp = list->previous;
-    free(list);
-    list = temp;
-  }
+  free_list_handle(list->handle);
 }
 
 size_t count_list(list_t *list)
 {
-  size_t count = 0;
-  list_t *temp = list;
-
-  if (temp != NULL) {
-    while (temp->previous != NULL)
-      temp = temp->previous;
-    while (temp != NULL) {
-      count++;
-      temp = temp->next;
-    }
-  }
-
-  return count;
+  if (list == NULL)
+    return 0;
+  return list->handle->length;
 }
 
 list_t *rewind_list(list_t *list)
 {
-  while (list->previous != NULL)
-    list = list->previous;
-  return list;
+  return list->handle->head;
 }
 
 list_t *unwind_list(list_t *list)
 {
-  while (list->next != NULL)
-    list = list->next;
-  return list;
+  return list->handle->tail;
 }
 
 list_t *append_list_data(list_t *list, void *data)
 {
-  list_t *temp;
-  temp = list;
-  while (temp->next != NULL)
-    temp = temp->next;
-  temp->next = malloc(sizeof(list_t));
-  if (temp->next != NULL) {
-    temp->next->previous = temp;
-    temp->next->next = NULL;
-    temp->next->data = data;
-  }
-  temp = temp->next;
-
-  return temp;
+  return list_handle_append(list->handle, data);
 }
 
 list_t *prepend_list_data(list_t *list, void *data)
 {
-  list_t *temp;
-  temp = list;
-  while (temp->previous != NULL)
-    temp = temp->previous;
-  temp->previous = malloc(sizeof(list_t));
-  if (temp->previous != NULL) {
-    temp->previous->previous = NULL;
-    temp->previous->next = temp;
-    temp->previous->data = data;
-  }
-  temp = temp->previous;
-
-  return temp;
+  return list_handle_prepend(list->handle, data);
 }
 
 list_t *insert_list_data_before(list_t *list, void *data)
 {
-  list_t *new = malloc(sizeof(list_t));
+  list_t *new;
+  if (list->previous == NULL)
+    return list_handle_prepend(list->handle, data);
+  new = new_list_member(list->handle, data);
   if (new != NULL) {
     new->next = list;
     new->previous = list->previous;
     list->previous = new;
-    if (new->previous != NULL)
-      new->previous->next = new;
-    new->data = data;
+    new->previous->next = new;
+    list->handle->length++;
   }
   return new;
 }
 
 list_t *insert_list_data_after(list_t *list, void *data)
 {
-  list_t *new = malloc(sizeof(list_t));
+  list_t *new;
+  if (list->next == NULL)
+    return list_handle_append(list->handle, data);
+  new = new_list_member(list->handle, data);
   if (new != NULL) {
     new->previous = list;
     new->next = list->next;
     list->next = new;
-    if (new->next != NULL)
-      new->next->previous = new;
-    new->data = data;
+    new->next->previous = new;
+    list->handle->length++;
   }
   return new;
 }
 
 list_t *delete_list_member_before(list_t *list)
 {
-  list_t *member = list->previous;
-  if (member != NULL) {
-    list->previous = member->previous;
-    if (list->previous != NULL)
-      list->previous->next = list;
-    free(member);
-  }
+  if (list->previous != NULL)
+    unlink_list_member(list->previous);
   return list;
 }
 
 list_t *delete_list_member_after(list_t *list)
 {
-  list_t *member = list->next;
-  if (member != NULL) {
-    list->next = member->next;
-    if (list->next != NULL)
-      list->next->previous = list;
-    free(member);
-  }
+  if (list->next != NULL)
+    unlink_list_member(list->next);
   return list;
 }
 
 list_t *delete_list_member(list_t *list)
 {
-  list_t *temp;
-  if (list->previous != NULL) {
-    temp = list->previous;
-    temp->next = list->next;
-    if (temp->next != NULL)
-      temp->next->previous = temp;
-  }
-  else {
-    temp = list->next;
-    if (temp != NULL) {
-      temp->previous = list->previous;
-      if (temp->previous != NULL)
-        temp->previous->next = temp;
-    }
-  }
-  free(list);
+  list_t *temp = list->previous != NULL ? list->previous : list->next;
+  unlink_list_member(list);
 
   return temp;
 }
@@ -236,32 +258,233 @@ void swap_list_data(list_t *first, list_t *second)
 
 list_t *get_list_index(list_t *list, size_t index)
 {
-  list_t *temp = list;
+  list_t *temp;
+  size_t length = list->handle->length;
 
-  while (temp->previous != NULL)
-    temp = temp->previous;
+  if (index >= length)
+    return NULL;
 
-  while (index > 0 && temp != NULL) {
-    temp = temp->next;
-    index--;
+  /* Walk from whichever end is closer. */
+  if (index < length / 2) {
+    temp = list->handle->head;
+    while (index-- > 0)
+      temp = temp->next;
+  }
+  else {
+    temp = list->handle->tail;
+    while (++index < length)
+      temp = temp->previous;
   }
 
   return temp;
 }
 
+/* Lists shorter than this per thread are not worth sorting in parallel. */
+#define MIN_PARALLEL_SORT 4096
+
+/* Merges two sorted chains, linked through next only, into one.  When
+ * members compare equal, the one from a comes first, which keeps the
+ * sort stable. */
+static list_t *merge_list_chains(list_t *a, list_t *b,
+  int (*func)(void *, void *))
+{
+  list_t *head = NULL, **tail = &head;
+  while (a != NULL && b != NULL) {
+    if ((*func)(a->data, b->data) <= 0) {
+      *tail = a;
+      a = a->next;
+    }
+    else {
+      *tail = b;
+      b = b->next;
+    }
+    tail = &(*tail)->next;
+  }
+  *tail = a != NULL ? a : b;
+  return head;
+}
+
+/* Sorts a chain linked through next only with a stable bottom-up
+ * merge sort: runs of 1, 2, 4 and so on are merged pairwise until
+ * one run is left.  Returns the new head of the chain. */
+static list_t *sort_list_chain(list_t *head, int (*func)(void *, void *))
+{
+  list_t *p, *q, *e, *tail;
+  size_t insize = 1, psize, qsize, merges;
+
+  if (head == NULL)
+    return NULL;
+  for (;;) {
+    p = head;
+    head = tail = NULL;
+    merges = 0;
+    while (p != NULL) {
+      merges++;
+      /* Step q past a run of up to insize members starting at p. */
+      q = p;
+      for (psize = 0; psize < insize && q != NULL; psize++)
+        q = q->next;
+      qsize = insize;
+      /* Merge the run at p with the run of up to qsize at q. */
+      while (psize > 0 || (qsize > 0 && q != NULL)) {
+        if (psize == 0 || (qsize > 0 && q != NULL
+              && (*func)(p->data, q->data) > 0)) {
+          e = q;
+          q = q->next;
+          qsize--;
+        }
+        else {
+          e = p;
+          p = p->next;
+          psize--;
+        }
+        if (tail != NULL)
+          tail->next = e;
+        else
+          head = e;
+        tail = e;
+      }
+      p = q;
+    }
+    tail->next = NULL;
+    if (merges <= 1)
+      return head;
+    insize *= 2;
+  }
+}
+
+/* Puts a sorted chain back into handle, fixing the previous links. */
+static void relink_list_chain(list_handle_t *handle, list_t *head)
+{
+  list_t *previous = NULL, *temp;
+  handle->head = head;
+  for (temp = head; temp != NULL; temp = temp->next) {
+    temp->previous = previous;
+    previous = temp;
+  }
+  handle->tail = previous;
+}
+
+void list_handle_sort(list_handle_t *handle, int (*func)(void *, void *))
+{
+  relink_list_chain(handle, sort_list_chain(handle->head, func));
+}
+
+/* One piece of work for a sorting thread: sort the chain at a, or
+ * merge it with the chain at b if there is one. */
+struct list_sort_job {
+  list_t *a;
+  list_t *b;
+  int (*func)(void *, void *);
+  pthread_t thread;
+  int started;
+};
+
+static void *run_list_sort_job(void *arg)
+{
+  struct list_sort_job *job = arg;
+  if (job->b != NULL)
+    job->a = merge_list_chains(job->a, job->b, job->func);
+  else
+    job->a = sort_list_chain(job->a, job->func);
+  return NULL;
+}
+
+/* Runs count jobs, each on its own thread where one can be started
+ * and on this one otherwise, and waits for all of them. */
+static void run_list_sort_jobs(struct list_sort_job *jobs, size_t count)
+{
+  size_t i;
+  for (i = 0; i < count; i++)
+    jobs[i].started = pthread_create(&jobs[i].thread, NULL,
+      run_list_sort_job, &jobs[i]) == 0;
+  for (i = 0; i < count; i++)
+    if (jobs[i].started)
+      pthread_join(jobs[i].thread, NULL);
+    else
+      run_list_sort_job(&jobs[i]);
+}
+
+int list_handle_sort_parallel(list_handle_t *handle,
+  int (*func)(void *, void *), unsigned int nthreads)
+{
+  struct list_sort_job *jobs;
+  list_t *temp, *next;
+  size_t chunks = nthreads, size, i, j;
+
+  if (chunks > handle->length / MIN_PARALLEL_SORT)
+    chunks = handle->length / MIN_PARALLEL_SORT;
+  if (chunks < 2) {
+    list_handle_sort(handle, func);
+    return 0;
+  }
+  jobs = calloc(chunks, sizeof(struct list_sort_job));
+  if (jobs == NULL)
+    return -1;
+
+  /* Cut the list into chunks of about the same size and sort each. */
+  temp = handle->head;
+  for (i = 0; i < chunks; i++) {
+    size = handle->length / chunks + (i < handle->length % chunks);
+    jobs[i].a = temp;
+    jobs[i].func = func;
+    for (j = 1; j < size; j++)
+      temp = temp->next;
+    next = temp->next;
+    temp->next = NULL;
+    temp = next;
+  }
+  run_list_sort_jobs(jobs, chunks);
+
+  /* Merge neighbouring chunks pairwise, in order, until one is left. */
+  while (chunks > 1) {
+    for (i = 0; i < chunks / 2; i++) {
+      jobs[i].a = jobs[2 * i].a;
+      jobs[i].b = jobs[2 * i + 1].a;
+    }
+    run_list_sort_jobs(jobs, chunks / 2);
+    if (chunks % 2) {
+      jobs[chunks / 2].a = jobs[chunks - 1].a;
+      jobs[chunks / 2].b = NULL;
+    }
+    chunks = (chunks + 1) / 2;
+  }
+
+  relink_list_chain(handle, jobs[0].a);
+  free(jobs);
+  return 0;
+}
+
 void sort_list_data(list_t *list, int (*func)(void *, void *))
 {
-  list_t *next, *first;
-  size_t i, left;
-  list = rewind_list(list);
-  left = count_list(list);
-  while (--left > 0) {
-    first = list;
-    for (i = 0; i < left; i++) {
-      next = first->next;
-      if ((*func)(first->data, next->data) > 0)
-        swap_list_data(first, next);
-      first = next;
+  list_handle_t *handle = list->handle;
+  list_t *first = handle->head, *head, *before, *temp;
+  void *data;
+
+  head = sort_list_chain(first, func);
+
+  /*
+   * This used to sort by swapping data, so the member that was first
+   * stayed first.  Keep it that way for callers that hold on to the
+   * head: trade places, and data, with whatever member is first now.
+   */
+  if (head != first) {
+    for (before = head; before->next != first; before = before->next)
+      ;
+    data = head->data;
+    head->data = first->data;
+    first->data = data;
+    if (before == head) {
+      head->next = first->next;
+      first->next = head;
+    }
+    else {
+      temp = head->next;
+      head->next = first->next;
+      first->next = temp;
+      before->next = head;
     }
+    head = first;
   }
+  relink_list_chain(handle, head);
 }
@@ -1,6 +1,6 @@
 /*
  * liblist - A library to implement doubly-linked lists in C.
- * Copyright © 2012 Jason J.A. Stephenson <jason@sigio.com>
+ * Copyright © 2012,2026 Jason J.A. Stephenson <jason@sigio.com>
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -29,15 +29,60 @@ extern "C" {
 /* Create the list_t type so we have a shorthand for our struct. */
 typedef struct doubly_linked_list_elem list_t;
 
-/* Implementation of a linked list node. You can manipulate these
- * directly or use the handy functions below to help with more common
- * tasks. */
+/* And list_handle_t for the struct that keeps track of a whole list. */
+typedef struct doubly_linked_list_handle list_handle_t;
+
+/* Implementation of a linked list node. You can read these directly,
+ * but use the functions below to change a list, because they keep
+ * its handle up to date. */
 struct doubly_linked_list_elem {
   void *data;
   list_t *previous;
   list_t *next;
+  list_handle_t *handle; /* the handle of the list we belong to */
+};
+
+/* Every list has a handle that knows both ends of the list and how
+ * many members it has, so that getting to either end, adding at
+ * either end and counting the members take constant time. */
+struct doubly_linked_list_handle {
+  list_t *head;
+  list_t *tail;
+  size_t length;
 };
 
+/*
+ * Creates a handle for a new, empty list.
+ *
+ * Returns a pointer to the handle or NULL if there is an error.
+ */
+list_handle_t *new_list_handle(void);
+
+/*
+ * Returns the handle of the list that the list member belongs to.
+ */
+list_handle_t *get_list_handle(list_t *list);
+
+/*
+ * Adds data to the end or the beginning of the list. Returns a
+ * pointer to the newly created list member or NULL if it is unable to
+ * allocate space.
+ */
+list_t *list_handle_append(list_handle_t *handle, void *data);
+
+list_t *list_handle_prepend(list_handle_t *handle, void *data);
+
+/*
+ * Returns the count of items in the list.
+ */
+size_t list_handle_count(const list_handle_t *handle);
+
+/*
+ * Frees every member of the list and the handle itself. As with
+ * free_list, the data is not freed.
+ */
+void free_list_handle(list_handle_t *handle);
+
 /*
  * Initialize a list with count members. The count argument should be
  * followed by count number of pointers to the data to be stored in
@@ -95,8 +140,31 @@ void swap_list_data(list_t *first, list_t *second);
 
 list_t *search_list(list_t *list, void *des, int (*func)(void *, void *));
 
+/*
+ * Sorts the list with func, which compares the data of two members
+ * like strcmp does.  The sort is a stable merge sort that relinks the
+ * members rather than moving the data around. The member that was
+ * first when sort_list_data is called is still first after it.
+ */
 void sort_list_data(list_t *list, int (*func)(void *, void*));
 
+/*
+ * Sorts the list the same way as sort_list_data, except that the
+ * members keep their data, so the head may change.
+ */
+void list_handle_sort(list_handle_t *handle, int (*func)(void *, void *));
+
+/*
+ * Like list_handle_sort, but cuts the list into up to nthreads
+ * chunks, sorts them on their own threads and merges the results.
+ * The result is the same as list_handle_sort's.  Short lists are
+ * sorted on the calling thread.
+ *
+ * Returns 0 on success or -1 if it cannot allocate memory.
+ */
+int list_handle_sort_parallel(list_handle_t *handle,
+  int (*func)(void *, void *), unsigned int nthreads);
+
 /*
  * Frees the space allocated to hold the list_t information in the
  * entire list that contains the argument pointer. This function does
@@ -0,0 +1,264 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "maccache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* What the header's magic is once the table is set up: "WMC" and a
+ * version number. */
+#define MAC_CACHE_MAGIC 0x574D4301U
+
+/* How many slots the table has.  It must be a power of 2. */
+#define MAC_CACHE_SLOTS 65536
+
+/* Set in every key, so that no key is 0. */
+#define MAC_CACHE_USED ((u_int64_t) 1 << 48)
+
+/* How far to look for a mac address before giving up on it. */
+#define MAC_CACHE_PROBES 64
+
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+
+/*
+ * Opens the shared table called name, followed by a dot and the
+ * effective user id, making it if none of the user's processes has
+ * yet.  The table is the user's alone: any user who could write to it
+ * could keep another's wakes from going out.  A new shared memory
+ * object is all zeros, which is an empty table, so whichever process
+ * gets to the header first just stamps it, and every other one checks
+ * the stamp.
+ *
+ * Returns a pointer to the cache, which must be released with
+ * close_mac_cache, or NULL on error, with errno set to EACCES if the
+ * object belongs to another user or to EPROTO if it is not a table
+ * this version of wake can use.
+ */
+struct mac_cache *open_mac_cache(const char *name)
+{
+  struct mac_cache *c;
+  struct stat sb;
+  char path[64];
+  u_int32_t expected;
+  void *base;
+  int fd = -1, error = 0;
+
+  c = calloc(1, sizeof(struct mac_cache));
+  if (c == NULL)
+    return NULL;
+  c->size = MAC_CACHE_SLOTS;
+  c->maplen = (c->size + 1) * sizeof(struct mac_cache_slot);
+
+  if ((size_t) snprintf(path, sizeof(path), "%s.%lu", name,
+        (unsigned long) geteuid()) >= sizeof(path)) {
+    error = ENAMETOOLONG;
+    goto CLEAN_UP;
+  }
+  fd = shm_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1 || fstat(fd, &sb) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  if (sb.st_uid != geteuid()) {
+    error = EACCES;
+    goto CLEAN_UP;
+  }
+  /* Growing it fills it with zeros, so it is safe if two processes
+   * race to do it. */
+  if ((size_t) sb.st_size < c->maplen && ftruncate(fd, c->maplen) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  base = mmap(NULL, c->maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  c->header = base;
+  c->slots = (struct mac_cache_slot *) base + 1;
+
+  expected = 0;
+  if (!__atomic_compare_exchange_n(&c->header->magic, &expected,
+        MAC_CACHE_MAGIC, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+      && expected != MAC_CACHE_MAGIC)
+    error = EPROTO;
+  expected = 0;
+  if (!error && !__atomic_compare_exchange_n(&c->header->slots, &expected,
+        MAC_CACHE_SLOTS, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+      && expected != MAC_CACHE_SLOTS)
+    error = EPROTO;
+
+CLEAN_UP:
+  if (fd != -1)
+    close(fd);
+  if (error) {
+    close_mac_cache(c);
+    errno = error;
+    return NULL;
+  }
+
+  return c;
+}
+
+/* Returns the monotonic clock, which all processes share, in
+ * milliseconds. */
+static u_int64_t mac_cache_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u_int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Makes the key for mac. */
+static u_int64_t mac_cache_key(const unsigned char *mac)
+{
+  u_int64_t key = MAC_CACHE_USED;
+  int i;
+
+  for (i = 0; i < 6; i++)
+    key |= (u_int64_t) mac[i] << (8 * i);
+  return key;
+}
+
+/* Mixes the bits of a key so that nearby mac addresses spread out. */
+static u_int64_t hash_mac_key(u_int64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xFF51AFD7ED558CCDULL;
+  key ^= key >> 33;
+  return key;
+}
+
+/*
+ * Decides whether this process should wake mac: not if any process
+ * has woken it within the last window_ms milliseconds.  If it should,
+ * the time is set to now before returning, so that others who ask
+ * from then on are told not to.  Finding or claiming the slot and
+ * updating the time are each a compare and swap that is retried if
+ * another process got in first, and two processes asking at the same
+ * moment can't both be told yes.
+ *
+ * Returns 1 if the caller should wake mac or 0 if it should not.  If
+ * the table has no room for mac, the answer is always 1.  *stamp is
+ * set to the time recorded, for mac_cache_unclaim, or to 0 if none
+ * was.
+ */
+int mac_cache_claim(struct mac_cache *c, const unsigned char *mac,
+  unsigned long window_ms, u_int64_t *stamp)
+{
+  struct mac_cache_slot *slot;
+  u_int64_t key = mac_cache_key(mac), k, when, now = mac_cache_now();
+  size_t i, probes, mask = c->size - 1;
+
+  *stamp = 0;
+  i = hash_mac_key(key) & mask;
+  for (probes = 0; probes < MAC_CACHE_PROBES; probes++, i = (i + 1) & mask) {
+    slot = &c->slots[i];
+    k = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+    if (k == 0)
+      __atomic_compare_exchange_n(&slot->key, &k, key, 0, __ATOMIC_ACQ_REL,
+        __ATOMIC_ACQUIRE);
+    /* Either we claimed it, or k is what someone else put there. */
+    if (k != 0 && k != key)
+      continue;
+
+    when = __atomic_load_n(&slot->when, __ATOMIC_ACQUIRE);
+    do {
+      /* A time after ours means someone woke it just now. */
+      if (when != 0 && (when >= now || now - when < window_ms))
+        return 0;
+    } while (!__atomic_compare_exchange_n(&slot->when, &when, now, 0,
+          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    *stamp = now;
+    return 1;
+  }
+
+  return 1;
+}
+
+/*
+ * Takes back a claim on mac that mac_cache_claim made at stamp, when
+ * the wake it was for never went out, so that the next process to ask
+ * is told to wake it.  Nothing changes if stamp is 0 or if another
+ * process has claimed mac since, which a compare and swap makes sure
+ * of.
+ */
+void mac_cache_unclaim(struct mac_cache *c, const unsigned char *mac,
+  u_int64_t stamp)
+{
+  u_int64_t key = mac_cache_key(mac), k;
+  size_t i, probes, mask = c->size - 1;
+
+  if (stamp == 0)
+    return;
+  i = hash_mac_key(key) & mask;
+  for (probes = 0; probes < MAC_CACHE_PROBES; probes++, i = (i + 1) & mask) {
+    k = __atomic_load_n(&c->slots[i].key, __ATOMIC_ACQUIRE);
+    if (k == 0)
+      return;
+    if (k == key) {
+      __atomic_compare_exchange_n(&c->slots[i].when, &stamp, 0, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+      return;
+    }
+  }
+}
+
+#else /* no shared memory */
+
+struct mac_cache *open_mac_cache(const char *name)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+int mac_cache_claim(struct mac_cache *c, const unsigned char *mac,
+  unsigned long window_ms, u_int64_t *stamp)
+{
+  *stamp = 0;
+  return 1;
+}
+
+void mac_cache_unclaim(struct mac_cache *c, const unsigned char *mac,
+  u_int64_t stamp)
+{
+}
+
+#endif
+
+/*
+ * Unmaps the table and frees c.  The shared memory object stays for
+ * the next process.
+ */
+void close_mac_cache(struct mac_cache *c)
+{
+  if (c == NULL)
+    return;
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+  if (c->header != NULL)
+    munmap(c->header, c->maplen);
+#endif
+  free(c);
+}
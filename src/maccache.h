@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MACCACHE_INCL
+#define MACCACHE_INCL 1
+
+#include <sys/types.h>
+
+/* The name of the shared memory object that a user's wake processes
+ * share, before the user id that open_mac_cache adds. */
+#define MAC_CACHE_NAME "/wake-macs"
+
+/* The first slot of the table, which says what it is. */
+struct mac_cache_header {
+  u_int32_t magic;
+  u_int32_t slots;
+  u_int64_t reserved;
+};
+
+/* A mac address, in the low 48 bits of key with MAC_CACHE_USED set,
+ * and when it was last woken, in milliseconds on the monotonic clock.
+ * A key of 0 is an empty slot, and keys never change once set. */
+struct mac_cache_slot {
+  u_int64_t key;
+  u_int64_t when;
+};
+
+/*
+ * A table of recently woken mac addresses in shared memory, with one
+ * copy for every wake process that a user runs on the machine.  Slots
+ * are claimed and times updated with compare and swap, so no process
+ * ever waits for another.
+ */
+struct mac_cache {
+  struct mac_cache_header *header;
+  struct mac_cache_slot *slots;
+  size_t size; /* always a power of 2 */
+  size_t maplen;
+};
+
+struct mac_cache *open_mac_cache(const char *name);
+
+int mac_cache_claim(struct mac_cache *c, const unsigned char *mac,
+  unsigned long window_ms, u_int64_t *stamp);
+
+void mac_cache_unclaim(struct mac_cache *c, const unsigned char *mac,
+  u_int64_t stamp);
+
+void close_mac_cache(struct mac_cache *c);
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mcast6.h"
+#include "netlink.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+/* How many (message, interface) pairs go into one batch. */
+#define MCAST6_BATCH 1024
+
+/* One message on its way out of one interface, with everything its
+ * msghdr points at. */
+struct mcast6_slot {
+  size_t owner; /* which message this is */
+  int ifindex;
+  struct sockaddr_in6 addr;
+  struct iovec iov;
+  struct msghdr hdr;
+#ifdef IPV6_PKTINFO
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+  } control;
+#endif
+};
+
+/*
+ * Opens a sender for the multicast group, at port, out of every
+ * interface that load_ipv6_links finds.  The packets are kept on the
+ * link and not looped back to us.
+ *
+ * Returns a pointer to the sender, which must be released with
+ * close_mcast6_sender, or NULL on error.
+ */
+struct mcast6_sender *open_mcast6_sender(u_int16_t port,
+  const struct in6_addr *group)
+{
+  struct mcast6_sender *m;
+  const int hops = 1, loop = 0;
+  int error;
+
+  m = calloc(1, sizeof(struct mcast6_sender));
+  if (m == NULL)
+    return NULL;
+  m->fd = -1;
+  m->group.sin6_family = AF_INET6;
+  m->group.sin6_port = htons(port);
+  m->group.sin6_addr = *group;
+
+  m->slots = calloc(MCAST6_BATCH, sizeof(struct mcast6_slot));
+#ifdef HAVE_SENDMMSG
+  m->vec = calloc(MCAST6_BATCH, sizeof(struct mmsghdr));
+  if (m->vec == NULL)
+    goto CLEAN_UP;
+#endif
+  if (m->slots == NULL)
+    goto CLEAN_UP;
+
+  m->fd = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (m->fd == -1)
+    goto CLEAN_UP;
+  setsockopt(m->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+  setsockopt(m->fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop));
+  if (load_ipv6_links(&m->ifindexes, &m->count) == -1)
+    goto CLEAN_UP;
+
+  return m;
+
+CLEAN_UP:
+  error = errno;
+  close_mcast6_sender(m);
+  errno = error;
+  return NULL;
+}
+
+/*
+ * Looks up m's interfaces again, after they have changed.
+ *
+ * Returns 0 on success or -1 on error, when the old ones are kept.
+ */
+int refresh_mcast6_sender(struct mcast6_sender *m)
+{
+  int *ifindexes;
+  size_t count;
+
+  if (load_ipv6_links(&ifindexes, &count) == -1)
+    return -1;
+  free(m->ifindexes);
+  m->ifindexes = ifindexes;
+  m->count = count;
+  return 0;
+}
+
+/*
+ * Sets slot up to send message owner of msgs to m's group out of
+ * interface ifindex.  The scope id picks the interface for a
+ * link-local group, and IPV6_PKTINFO, where we have it, for any other.
+ */
+static void fill_mcast6_slot(struct mcast6_sender *m,
+  struct mcast6_slot *slot, const char *msgs, const size_t msglen,
+  size_t owner, int ifindex)
+{
+#ifdef IPV6_PKTINFO
+  struct cmsghdr *cmsg;
+  struct in6_pktinfo *info;
+#endif
+
+  slot->owner = owner;
+  slot->ifindex = ifindex;
+  slot->addr = m->group;
+  slot->addr.sin6_scope_id = ifindex;
+  slot->iov.iov_base = (void *) (msgs + owner * msglen);
+  slot->iov.iov_len = msglen;
+  memset(&slot->hdr, 0, sizeof(struct msghdr));
+  slot->hdr.msg_name = &slot->addr;
+  slot->hdr.msg_namelen = sizeof(struct sockaddr_in6);
+  slot->hdr.msg_iov = &slot->iov;
+  slot->hdr.msg_iovlen = 1;
+#ifdef IPV6_PKTINFO
+  memset(&slot->control, 0, sizeof(slot->control));
+  slot->hdr.msg_control = slot->control.buf;
+  slot->hdr.msg_controllen = sizeof(slot->control.buf);
+  cmsg = CMSG_FIRSTHDR(&slot->hdr);
+  cmsg->cmsg_level = IPPROTO_IPV6;
+  cmsg->cmsg_type = IPV6_PKTINFO;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+  info = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+  info->ipi6_ifindex = ifindex;
+#endif
+}
+
+/*
+ * Sends the first n slots of m's batch and records how each message
+ * went, as send_bcast_batch does.  Without IPV6_PKTINFO the interface
+ * can only be set for the whole socket, with IPV6_MULTICAST_IF, so the
+ * slots go one at a time, and the batch is built an interface at a
+ * time to keep that to one change per interface.
+ */
+static void send_mcast6_batch(struct mcast6_sender *m, size_t n,
+  int *status)
+{
+  struct mcast6_slot *slots = m->slots;
+  size_t k;
+
+#if defined(HAVE_SENDMMSG) && defined(IPV6_PKTINFO)
+  struct mmsghdr *vec = m->vec;
+  size_t done;
+  int r;
+
+  for (k = 0; k < n; k++) {
+    memset(&vec[k], 0, sizeof(struct mmsghdr));
+    vec[k].msg_hdr = slots[k].hdr;
+  }
+  for (done = 0; done < n;) {
+    r = sendmmsg(m->fd, vec + done, n - done, 0);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      if (status[slots[done].owner] != 0)
+        status[slots[done].owner] = errno;
+      done++;
+    }
+    else {
+      for (k = done; k < done + r; k++)
+        status[slots[k].owner] = 0;
+      done += r;
+    }
+  }
+#else
+  for (k = 0; k < n; k++) {
+#ifndef IPV6_PKTINFO
+    if (k == 0 || slots[k].ifindex != slots[k - 1].ifindex)
+      setsockopt(m->fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &slots[k].ifindex,
+        sizeof(int));
+#endif
+    if (sendmsg(m->fd, &slots[k].hdr, 0) == -1) {
+      if (status[slots[k].owner] != 0)
+        status[slots[k].owner] = errno;
+    }
+    else
+      status[slots[k].owner] = 0;
+  }
+#endif
+}
+
+/*
+ * Sends count messages of msglen bytes each, stored back to back in
+ * msgs, to m's group out of every one of its interfaces.  Messages
+ * and interfaces are gathered into batches of up to MCAST6_BATCH
+ * pairs, each sent with as few sendmmsg calls as it takes.  See
+ * broadcaster_send_directed for the meaning of results.
+ *
+ * Returns the number of messages that were sent on at least one
+ * interface or -1 on error.
+ */
+ssize_t mcast6_send_msgs(struct mcast6_sender *m, const char *msgs,
+  const size_t count, const size_t msglen, int *results)
+{
+  size_t i, j, k, end, n = 0, sent = 0, window;
+  int *status;
+
+  status = calloc(count ? count : 1, sizeof(int));
+  if (status == NULL)
+    return -1;
+  for (i = 0; i < count; i++)
+    status[i] = m->count ? EIO : ENETUNREACH;
+
+  /* Take as many messages at a time as fill a batch on every
+   * interface, and lay them out an interface at a time. */
+  window = m->count ? MCAST6_BATCH / m->count : 0;
+  if (window == 0)
+    window = 1;
+  for (i = 0; i < count && m->count > 0; i = end) {
+    end = count - i > window ? i + window : count;
+    for (j = 0; j < m->count; j++)
+      for (k = i; k < end; k++) {
+        fill_mcast6_slot(m, &m->slots[n++], msgs, msglen, k,
+          m->ifindexes[j]);
+        if (n == MCAST6_BATCH) {
+          send_mcast6_batch(m, n, status);
+          n = 0;
+        }
+      }
+    if (n > 0) {
+      send_mcast6_batch(m, n, status);
+      n = 0;
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    if (status[i] == 0)
+      sent++;
+    if (results != NULL)
+      results[i] = status[i];
+  }
+  free(status);
+
+  return sent;
+}
+
+/*
+ * Closes the socket and frees everything open_mcast6_sender allocated.
+ */
+void close_mcast6_sender(struct mcast6_sender *m)
+{
+  if (m == NULL)
+    return;
+  if (m->fd != -1)
+    close(m->fd);
+  free(m->ifindexes);
+  free(m->slots);
+#ifdef HAVE_SENDMMSG
+  free(m->vec);
+#endif
+  free(m);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MCAST6_INCL
+#define MCAST6_INCL 1
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* The group magic packets go to unless told otherwise: every node on
+ * the link. */
+#define MCAST6_GROUP "ff02::1"
+
+struct mcast6_slot;
+
+/*
+ * One UDP socket that sends to an IPv6 multicast group out of every
+ * interface in ifindexes, with the interface chosen message by
+ * message, so that one sendmmsg can cover many hosts and interfaces.
+ * slots and vec are the batch being built.
+ */
+struct mcast6_sender {
+  int fd;
+  struct sockaddr_in6 group;
+  int *ifindexes;
+  size_t count;
+  struct mcast6_slot *slots;
+#ifdef HAVE_SENDMMSG
+  struct mmsghdr *vec;
+#endif
+};
+
+struct mcast6_sender *open_mcast6_sender(u_int16_t port,
+  const struct in6_addr *group);
+
+int refresh_mcast6_sender(struct mcast6_sender *m);
+
+ssize_t mcast6_send_msgs(struct mcast6_sender *m, const char *msgs,
+  const size_t count, const size_t msglen, int *results);
+
+void close_mcast6_sender(struct mcast6_sender *m);
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "nametrie.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Folds an ASCII letter to lower case, the way the host index does. */
+#define FOLD(c) (((c) >= 'A' && (c) <= 'Z') ? (c) + ('a' - 'A') : (c))
+
+/* A host's name as the builder sorts it. */
+struct trie_name {
+  const unsigned char *name;
+  size_t len;
+  u_int32_t host;
+};
+
+/* Orders names without regard to case and, for names that are the
+ * same but for case, by position in the file. */
+static int compare_trie_names(const void *a, const void *b)
+{
+  const struct trie_name *x = a, *y = b;
+  size_t i, len = x->len < y->len ? x->len : y->len;
+
+  for (i = 0; i < len; i++)
+    if (FOLD(x->name[i]) != FOLD(y->name[i]))
+      return FOLD(x->name[i]) - FOLD(y->name[i]);
+  if (x->len != y->len)
+    return x->len < y->len ? -1 : 1;
+  return x->host < y->host ? -1 : x->host > y->host;
+}
+
+/*
+ * Adds the node for the sorted names from lo up to hi, which all
+ * begin with the same depth bytes, but for case, and then its
+ * children.  Since the names are sorted, what they all have in common
+ * is what the first and last have in common.  Of names that differ
+ * only in case, the first in the file is the one kept, as in the host
+ * index.
+ *
+ * Returns the number of the new node.
+ */
+static u_int32_t add_trie_node(struct name_trie *trie,
+  const struct trie_name *names, size_t lo, size_t hi, size_t depth)
+{
+  struct name_trie_node *node;
+  u_int32_t n = trie->count++, child, last = NAME_TRIE_NONE;
+  const struct trie_name *first = &names[lo], *end = &names[hi - 1];
+  size_t common = depth, i = lo, j;
+  int c;
+
+  while (common < first->len && common < end->len
+      && FOLD(first->name[common]) == FOLD(end->name[common]))
+    common++;
+
+  node = &trie->nodes[n];
+  node->label = (const char *) first->name + depth;
+  node->label_len = common - depth;
+  node->child = NAME_TRIE_NONE;
+  node->sibling = NAME_TRIE_NONE;
+  node->host = NAME_TRIE_NONE;
+  node->hosts = 0;
+  if (first->len == common) {
+    node->host = first->host;
+    node->hosts = 1;
+    while (i < hi && names[i].len == common)
+      i++;
+  }
+
+  /* The rest go to one child for each byte that comes next. */
+  while (i < hi) {
+    c = FOLD(names[i].name[common]);
+    for (j = i + 1; j < hi && FOLD(names[j].name[common]) == c; j++)
+      ;
+    child = add_trie_node(trie, names, i, j, common);
+    if (last == NAME_TRIE_NONE)
+      trie->nodes[n].child = child;
+    else
+      trie->nodes[last].sibling = child;
+    trie->nodes[n].hosts += trie->nodes[child].hosts;
+    last = child;
+    i = j;
+  }
+
+  return n;
+}
+
+/*
+ * Builds a radix trie of the names of the count hosts, folded to lower
+ * case, with each name leading to its position in hosts.  The trie
+ * points into the names, so they must outlive it.
+ *
+ * Returns a pointer to the trie, which must be freed with
+ * free_name_trie, or NULL on error.
+ */
+struct name_trie *build_name_trie(const struct hostinfo *hosts,
+  size_t count)
+{
+  struct name_trie *trie;
+  struct trie_name *names;
+  size_t i;
+
+  trie = malloc(sizeof(struct name_trie));
+  names = malloc((count + 1) * sizeof(struct trie_name));
+  /* Every node but the root holds a host or has 2 or more children. */
+  if (trie != NULL)
+    trie->nodes = malloc((2 * count + 1) * sizeof(struct name_trie_node));
+  if (trie == NULL || names == NULL || trie->nodes == NULL) {
+    if (trie != NULL)
+      free(trie->nodes);
+    free(trie);
+    free(names);
+    return NULL;
+  }
+  trie->count = 0;
+
+  for (i = 0; i < count; i++) {
+    names[i].name = (const unsigned char *) hosts[i].name;
+    names[i].len = strlen(hosts[i].name);
+    names[i].host = i;
+  }
+  if (count == 0) {
+    names[0].name = (const unsigned char *) "";
+    names[0].len = 0;
+    names[0].host = NAME_TRIE_NONE;
+    count = 1;
+  }
+  else
+    qsort(names, count, sizeof(struct trie_name), compare_trie_names);
+  add_trie_node(trie, names, 0, count, 0);
+  free(names);
+
+  return trie;
+}
+
+/* Copies the hosts in the subtree at n to ids in order of name. */
+static u_int32_t *collect_trie_hosts(const struct name_trie *trie,
+  u_int32_t n, u_int32_t *ids)
+{
+  const struct name_trie_node *node = &trie->nodes[n];
+
+  if (node->host != NAME_TRIE_NONE)
+    *ids++ = node->host;
+  for (n = node->child; n != NAME_TRIE_NONE; n = trie->nodes[n].sibling)
+    ids = collect_trie_hosts(trie, n, ids);
+
+  return ids;
+}
+
+/*
+ * Finds every host whose name begins with the len bytes of prefix,
+ * without regard to case.  Walking down to the prefix costs no more
+ * than its length, with a short list of siblings at each node, and
+ * gathering the hosts no more than the number found, since each node
+ * below holds a host or branches.
+ *
+ * Returns 0 with *ids, in order of name, and *count set, or -1 if
+ * there is no memory for the ids.  *ids must be freed with free.
+ */
+int name_trie_prefix(const struct name_trie *trie, const char *prefix,
+  size_t len, u_int32_t **ids, size_t *count)
+{
+  const struct name_trie_node *node;
+  u_int32_t n = 0;
+  size_t i = 0, k;
+
+  *ids = NULL;
+  *count = 0;
+  for (;;) {
+    node = &trie->nodes[n];
+    for (k = 0; k < node->label_len && i < len; k++, i++)
+      if (FOLD((unsigned char) node->label[k])
+          != FOLD((unsigned char) prefix[i]))
+        return 0;
+    if (i == len)
+      break;
+    for (n = node->child; n != NAME_TRIE_NONE; n = trie->nodes[n].sibling)
+      if (FOLD((unsigned char) trie->nodes[n].label[0])
+          == FOLD((unsigned char) prefix[i]))
+        break;
+    if (n == NAME_TRIE_NONE)
+      return 0;
+  }
+
+  if (node->hosts == 0)
+    return 0;
+  *ids = malloc(node->hosts * sizeof(u_int32_t));
+  if (*ids == NULL)
+    return -1;
+  *count = collect_trie_hosts(trie, n, *ids) - *ids;
+
+  return 0;
+}
+
+/*
+ * Frees a trie.  The names it points into are left alone.
+ */
+void free_name_trie(struct name_trie *trie)
+{
+  if (trie == NULL)
+    return;
+  free(trie->nodes);
+  free(trie);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NAMETRIE_INCL
+#define NAMETRIE_INCL 1
+
+#include "hostinfo.h"
+#include <sys/types.h>
+
+/* What a node has in place of a child, sibling or host it lacks. */
+#define NAME_TRIE_NONE ((u_int32_t) -1)
+
+/*
+ * A node of a radix trie of host names.  Its label is the next
+ * label_len bytes of the names below it, pointing into one of them,
+ * and is matched without regard to case.  Children are chained
+ * through sibling in order, and hosts counts the distinct names in
+ * the node's subtree.
+ */
+struct name_trie_node {
+  const char *label;
+  u_int32_t label_len;
+  u_int32_t child;
+  u_int32_t sibling;
+  u_int32_t host;
+  u_int32_t hosts;
+};
+
+/* The nodes of a trie in one array, with the root first. */
+struct name_trie {
+  struct name_trie_node *nodes;
+  size_t count;
+};
+
+struct name_trie *build_name_trie(const struct hostinfo *hosts,
+  size_t count);
+
+int name_trie_prefix(const struct name_trie *trie, const char *prefix,
+  size_t len, u_int32_t **ids, size_t *count);
+
+void free_name_trie(struct name_trie *trie);
+
+#endif
@@ -0,0 +1,557 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "netlink.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#ifdef HAVE_LINUX_RTNETLINK_H
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
+/* Turns a prefix length into a netmask in network byte order. */
+static u_int32_t prefix_mask(unsigned int prefix)
+{
+  return prefix == 0 ? 0 : htonl(0xFFFFFFFFU << (32 - prefix));
+}
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+
+/* Enough room for one read of a dump from the kernel. */
+#define NETLINK_BUFSIZE 65536
+
+/* The table being filled in by a dump and how much room it has. */
+struct dump_ctx {
+  struct route_table *rt;
+  size_t room;
+};
+
+/*
+ * Makes room for one more element of size bytes in *array, which
+ * holds count elements and has room for *room of them.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int grow_dump_array(void **array, size_t count, size_t *room,
+  size_t size)
+{
+  void *t;
+
+  if (count < *room)
+    return 0;
+  t = realloc(*array, (*room ? *room * 2 : 16) * size);
+  if (t == NULL)
+    return -1;
+  *array = t;
+  *room = *room ? *room * 2 : 16;
+  return 0;
+}
+
+/*
+ * Asks the kernel, through the netlink socket fd, to dump every object
+ * of one kind in the address family, routes for RTM_GETROUTE,
+ * addresses for RTM_GETADDR or links for RTM_GETLINK, and hands each
+ * message of the dump to handle along with ctx.
+ *
+ * Returns 0 once the dump is done or -1 on error.
+ */
+static int netlink_dump(int fd, int type, int family,
+  int (*handle)(struct nlmsghdr *, void *), void *ctx)
+{
+  struct {
+    struct nlmsghdr nh;
+    union {
+      struct rtmsg rtm;
+      struct ifaddrmsg ifa;
+      struct ifinfomsg ifi;
+    } body;
+  } req;
+  struct nlmsghdr *nh;
+  struct nlmsgerr *err;
+  char *buf;
+  ssize_t n;
+  u_int32_t seq = getpid() ^ type;
+  int error = 0;
+
+  memset(&req, 0, sizeof(req));
+  req.nh.nlmsg_len = NLMSG_LENGTH(type == RTM_GETROUTE
+    ? sizeof(struct rtmsg) : type == RTM_GETLINK ? sizeof(struct ifinfomsg)
+    : sizeof(struct ifaddrmsg));
+  req.nh.nlmsg_type = type;
+  req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.nh.nlmsg_seq = seq;
+  /* All of the bodies start with the address family. */
+  req.body.rtm.rtm_family = family;
+
+  if (send(fd, &req, req.nh.nlmsg_len, 0) == -1)
+    return -1;
+  buf = malloc(NETLINK_BUFSIZE);
+  if (buf == NULL)
+    return -1;
+
+  for (;;) {
+    n = recv(fd, buf, NETLINK_BUFSIZE, 0);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      error = errno;
+      break;
+    }
+    if (n == 0) {
+      error = EPROTO;
+      break;
+    }
+    for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, n);
+         nh = NLMSG_NEXT(nh, n)) {
+      if (nh->nlmsg_seq != seq)
+        continue;
+      if (nh->nlmsg_type == NLMSG_DONE)
+        goto DONE;
+      if (nh->nlmsg_type == NLMSG_ERROR) {
+        err = NLMSG_DATA(nh);
+        error = err->error ? -err->error : EPROTO;
+        goto DONE;
+      }
+      if (handle(nh, ctx) == -1) {
+        error = errno;
+        goto DONE;
+      }
+    }
+  }
+
+DONE:
+  free(buf);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+/* Keeps a route from a RTM_GETROUTE dump if it is one we can use. */
+static int add_dumped_route(struct nlmsghdr *nh, void *arg)
+{
+  struct dump_ctx *ctx = arg;
+  struct rtmsg *rtm = NLMSG_DATA(nh);
+  struct route_entry route;
+  struct rtattr *rta;
+  int len = RTM_PAYLOAD(nh);
+  u_int32_t table;
+
+  if (nh->nlmsg_type != RTM_NEWROUTE || rtm->rtm_family != AF_INET
+      || rtm->rtm_type != RTN_UNICAST)
+    return 0;
+#ifdef RTNH_F_LINKDOWN
+  if (rtm->rtm_flags & RTNH_F_LINKDOWN)
+    return 0;
+#endif
+
+  memset(&route, 0, sizeof(route));
+  route.dst_len = rtm->rtm_dst_len;
+  table = rtm->rtm_table;
+  for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    switch (rta->rta_type) {
+    case RTA_TABLE:
+      memcpy(&table, RTA_DATA(rta), sizeof(u_int32_t));
+      break;
+    case RTA_DST:
+      memcpy(&route.dst, RTA_DATA(rta), sizeof(u_int32_t));
+      break;
+    case RTA_GATEWAY:
+      memcpy(&route.gateway, RTA_DATA(rta), sizeof(u_int32_t));
+      break;
+    case RTA_OIF:
+      memcpy(&route.oif, RTA_DATA(rta), sizeof(int));
+      break;
+    case RTA_PRIORITY:
+      memcpy(&route.priority, RTA_DATA(rta), sizeof(u_int32_t));
+      break;
+    }
+  /* Multipath routes have no single interface, so leave them out. */
+  if (table != RT_TABLE_MAIN || route.oif == 0)
+    return 0;
+
+  if (grow_dump_array((void **) &ctx->rt->routes, ctx->rt->nroutes,
+        &ctx->room, sizeof(struct route_entry)) == -1)
+    return -1;
+  ctx->rt->routes[ctx->rt->nroutes++] = route;
+  return 0;
+}
+
+/* Keeps an address from a RTM_GETADDR dump. */
+static int add_dumped_addr(struct nlmsghdr *nh, void *arg)
+{
+  struct dump_ctx *ctx = arg;
+  struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+  struct link_addr addr;
+  struct rtattr *rta;
+  int len = IFA_PAYLOAD(nh), have_local = 0;
+
+  if (nh->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != AF_INET
+      || ifa->ifa_scope == RT_SCOPE_HOST)
+    return 0;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.ifindex = ifa->ifa_index;
+  addr.prefix = ifa->ifa_prefixlen;
+  for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    switch (rta->rta_type) {
+    case IFA_LOCAL:
+      memcpy(&addr.local, RTA_DATA(rta), sizeof(u_int32_t));
+      have_local = 1;
+      break;
+    case IFA_ADDRESS:
+      if (!have_local)
+        memcpy(&addr.local, RTA_DATA(rta), sizeof(u_int32_t));
+      break;
+    case IFA_BROADCAST:
+      memcpy(&addr.broadcast, RTA_DATA(rta), sizeof(u_int32_t));
+      break;
+    }
+
+  if (grow_dump_array((void **) &ctx->rt->addrs, ctx->rt->naddrs,
+        &ctx->room, sizeof(struct link_addr)) == -1)
+    return -1;
+  ctx->rt->addrs[ctx->rt->naddrs++] = addr;
+  return 0;
+}
+
+/*
+ * Reads the IPv4 routes of the main table and the IPv4 addresses of
+ * the local interfaces from the kernel with rtnetlink dumps, once, so
+ * that any number of hosts can be looked up in them.
+ *
+ * Returns a pointer to the table, which must be freed with
+ * free_route_table, or NULL on error.
+ */
+struct route_table *load_route_table(void)
+{
+  struct route_table *rt;
+  struct dump_ctx ctx;
+  int fd, error = 0;
+
+  rt = calloc(1, sizeof(struct route_table));
+  if (rt == NULL)
+    return NULL;
+  fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  ctx.rt = rt;
+  ctx.room = 0;
+  if (netlink_dump(fd, RTM_GETROUTE, AF_INET, add_dumped_route,
+        &ctx) == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Dumping routes\n");
+#endif
+    error = errno;
+    goto CLEAN_UP;
+  }
+  ctx.room = 0;
+  if (netlink_dump(fd, RTM_GETADDR, AF_INET, add_dumped_addr, &ctx) == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Dumping addresses\n");
+#endif
+    error = errno;
+  }
+
+CLEAN_UP:
+  if (fd != -1)
+    close(fd);
+  if (error) {
+    free_route_table(rt);
+    errno = error;
+    return NULL;
+  }
+
+  return rt;
+}
+
+/* The interfaces that IPv6 multicast can go out of, as they are found. */
+struct link_ctx {
+  int *ifindexes;
+  unsigned char *has_addr;
+  size_t count;
+  size_t room;
+};
+
+/* Keeps a link from a RTM_GETLINK dump if it is up, not the loopback
+ * interface and can send multicast. */
+static int add_dumped_link(struct nlmsghdr *nh, void *arg)
+{
+  struct link_ctx *ctx = arg;
+  struct ifinfomsg *ifi = NLMSG_DATA(nh);
+  void *t;
+
+  if (nh->nlmsg_type != RTM_NEWLINK || (ifi->ifi_flags & IFF_UP) == 0
+      || (ifi->ifi_flags & IFF_LOOPBACK)
+      || (ifi->ifi_flags & IFF_MULTICAST) == 0)
+    return 0;
+
+  if (ctx->count == ctx->room) {
+    t = realloc(ctx->has_addr, ctx->room ? ctx->room * 2 : 16);
+    if (t == NULL)
+      return -1;
+    ctx->has_addr = t;
+  }
+  if (grow_dump_array((void **) &ctx->ifindexes, ctx->count, &ctx->room,
+        sizeof(int)) == -1)
+    return -1;
+  ctx->has_addr[ctx->count] = 0;
+  ctx->ifindexes[ctx->count++] = ifi->ifi_index;
+  return 0;
+}
+
+/* Marks the link that an address from an IPv6 RTM_GETADDR dump is on,
+ * since without one the kernel has nothing to send from. */
+static int mark_dumped_addr6(struct nlmsghdr *nh, void *arg)
+{
+  struct link_ctx *ctx = arg;
+  struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+  size_t i;
+
+  if (nh->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != AF_INET6
+      || ifa->ifa_scope == RT_SCOPE_HOST)
+    return 0;
+  for (i = 0; i < ctx->count; i++)
+    if (ctx->ifindexes[i] == (int) ifa->ifa_index)
+      ctx->has_addr[i] = 1;
+  return 0;
+}
+
+/*
+ * Finds the interfaces that IPv6 multicast can go out of: those that
+ * are up, are not the loopback interface, can send multicast and have
+ * an IPv6 address.  Unlike SIOCGIFCONF, rtnetlink tells us about
+ * interfaces that only have IPv6 addresses.
+ *
+ * Returns 0 with *ifindexes, which must be freed with free, and
+ * *count set, or -1 on error.
+ */
+int load_ipv6_links(int **ifindexes, size_t *count)
+{
+  struct link_ctx ctx;
+  size_t i, n = 0;
+  int fd, error = 0;
+
+  memset(&ctx, 0, sizeof(ctx));
+  fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd == -1)
+    return -1;
+  if (netlink_dump(fd, RTM_GETLINK, AF_UNSPEC, add_dumped_link, &ctx) == -1
+      || netlink_dump(fd, RTM_GETADDR, AF_INET6, mark_dumped_addr6,
+        &ctx) == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Dumping IPv6 links\n");
+#endif
+    error = errno;
+  }
+  close(fd);
+  if (error) {
+    free(ctx.ifindexes);
+    free(ctx.has_addr);
+    errno = error;
+    return -1;
+  }
+
+  for (i = 0; i < ctx.count; i++)
+    if (ctx.has_addr[i])
+      ctx.ifindexes[n++] = ctx.ifindexes[i];
+  free(ctx.has_addr);
+  *ifindexes = ctx.ifindexes;
+  *count = n;
+  return 0;
+}
+
+/*
+ * Opens a netlink socket that hears about links and IPv4 and IPv6
+ * addresses coming, going or changing.  It never blocks, so that
+ * link_watch_changed can poll it cheaply before every send.
+ *
+ * Returns the socket or -1 on error.
+ */
+int open_link_watch(void)
+{
+  struct sockaddr_nl sa;
+  int fd, error;
+
+  fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+    NETLINK_ROUTE);
+  if (fd == -1)
+    return -1;
+  memset(&sa, 0, sizeof(sa));
+  sa.nl_family = AF_NETLINK;
+  sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+  if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) == -1) {
+    error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * Reads every event waiting on fd, a socket from open_link_watch.
+ *
+ * Returns 1 if a link or address changed since the last call, 0 if
+ * none did or -1 on error.  If the kernel had to drop events because
+ * we fell behind, that counts as a change.
+ */
+int link_watch_changed(int fd)
+{
+  /* Only links and addresses are sent to the socket, so every event
+   * is a change and there is no need to read more than a bit. */
+  char buf[64];
+  int changed = 0;
+
+  for (;;) {
+    if (recv(fd, buf, sizeof(buf), 0) != -1)
+      changed = 1;
+    else if (errno == ENOBUFS)
+      changed = 1;
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return changed;
+    else if (errno != EINTR)
+      return -1;
+  }
+}
+
+#else /* no rtnetlink */
+
+struct route_table *load_route_table(void)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+int load_ipv6_links(int **ifindexes, size_t *count)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+int open_link_watch(void)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+int link_watch_changed(int fd)
+{
+  return 0;
+}
+
+#endif
+
+/*
+ * Finds the route the kernel would most likely use for ipaddr: the
+ * one with the longest matching prefix and, of those, the lowest
+ * metric.
+ *
+ * Returns a pointer to the route or NULL if none matches.
+ */
+const struct route_entry *find_route(const struct route_table *rt,
+  u_int32_t ipaddr)
+{
+  const struct route_entry *best = NULL, *r;
+  size_t i;
+
+  for (i = 0; i < rt->nroutes; i++) {
+    r = &rt->routes[i];
+    if ((ipaddr & prefix_mask(r->dst_len)) != r->dst)
+      continue;
+    if (best == NULL || r->dst_len > best->dst_len
+        || (r->dst_len == best->dst_len && r->priority < best->priority))
+      best = r;
+  }
+
+  return best;
+}
+
+/*
+ * Works out where a magic packet for the host at ipaddr, on a subnet
+ * with the given prefix length, should go so that it reaches only
+ * that subnet.  The route to the host picks the interface.  If the
+ * subnet is known, the packet goes to its broadcast address; if not,
+ * and the host is on a directly connected subnet, it goes to the
+ * broadcast address of the interface's address on that subnet.
+ *
+ * Returns 0 with dest filled in, or -1, leaving dest alone, if there
+ * is no way to aim the packet and it should go everywhere as usual.
+ */
+int find_wake_dest(const struct route_table *rt, u_int32_t ipaddr,
+  unsigned int prefix, struct bcast_dest *dest)
+{
+  const struct route_entry *route;
+  const struct link_addr *a;
+  u_int32_t mask, broadcast = 0;
+  size_t i;
+
+  route = find_route(rt, ipaddr);
+  if (route == NULL) {
+    errno = ENETUNREACH;
+    return -1;
+  }
+
+  /* A /31 or /32 says nothing about the subnet. */
+  if (prefix < 31) {
+    mask = prefix_mask(prefix);
+    broadcast = (ipaddr & mask) | ~mask;
+  }
+  else if (route->gateway == 0)
+    for (i = 0; i < rt->naddrs && broadcast == 0; i++) {
+      a = &rt->addrs[i];
+      mask = prefix_mask(a->prefix);
+      if (a->ifindex == route->oif && a->prefix < 31
+          && (a->local & mask) == (ipaddr & mask))
+        broadcast = a->broadcast ? a->broadcast : (a->local & mask) | ~mask;
+    }
+  if (broadcast == 0) {
+    errno = EDESTADDRREQ;
+    return -1;
+  }
+
+  memset(dest, 0, sizeof(struct bcast_dest));
+  dest->addr.sin_family = AF_INET;
+  dest->addr.sin_addr.s_addr = broadcast;
+  dest->ifindex = route->oif;
+  return 0;
+}
+
+/*
+ * Frees everything load_route_table allocated.
+ */
+void free_route_table(struct route_table *rt)
+{
+  if (rt == NULL)
+    return;
+  free(rt->routes);
+  free(rt->addrs);
+  free(rt);
+}
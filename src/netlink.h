@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NETLINK_INCL
+#define NETLINK_INCL 1
+
+#include "broadcast.h"
+#include <sys/types.h>
+
+/* An IPv4 unicast route from the main routing table.  Addresses are
+ * in network byte order. */
+struct route_entry {
+  u_int32_t dst;
+  u_int32_t gateway; /* 0 for a directly connected subnet */
+  u_int32_t priority;
+  int oif;
+  unsigned char dst_len;
+};
+
+/* An IPv4 address of a local interface. */
+struct link_addr {
+  u_int32_t local;
+  u_int32_t broadcast; /* 0 if the interface has none */
+  int ifindex;
+  unsigned char prefix;
+};
+
+/* The routes and addresses, as dumped from the kernel at one time. */
+struct route_table {
+  struct route_entry *routes;
+  size_t nroutes;
+  struct link_addr *addrs;
+  size_t naddrs;
+};
+
+struct route_table *load_route_table(void);
+
+const struct route_entry *find_route(const struct route_table *rt,
+  u_int32_t ipaddr);
+
+int find_wake_dest(const struct route_table *rt, u_int32_t ipaddr,
+  unsigned int prefix, struct bcast_dest *dest);
+
+void free_route_table(struct route_table *rt);
+
+int load_ipv6_links(int **ifindexes, size_t *count);
+
+int open_link_watch(void);
+
+int link_watch_changed(int fd);
+
+#endif
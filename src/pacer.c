@@ -0,0 +1,315 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pacer.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
+/* The most packets handed to broadcaster_send_msgs at once. */
+#define PACE_BATCH 1024
+
+#define NSEC_PER_SEC 1000000000LL
+
+/*
+ * A host waiting for its next packet.  The queue is a min-heap on due
+ * time, then on seq, so that hosts due at the same moment go out in
+ * the order they were queued.
+ */
+struct pace_event {
+  long long due; /* nanoseconds on the monotonic clock */
+  size_t seq;
+  size_t host;
+  unsigned int left; /* packets still to send, counting this one */
+};
+
+static long long pace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Returns a delay of up to jitter_ms milliseconds, in nanoseconds,
+ * chosen at random.  random() gives only 31 bits, so two draws are
+ * put together, and the draws past the last whole multiple of the
+ * range are thrown back so that no delay is likelier than another.
+ */
+static long long pace_jitter(unsigned int jitter_ms)
+{
+  u_int64_t range = (u_int64_t) jitter_ms * 1000000 + 1;
+  u_int64_t limit = ((u_int64_t) 1 << 62) - ((u_int64_t) 1 << 62) % range;
+  u_int64_t draw;
+
+  do
+    draw = (u_int64_t) random() << 31 | (u_int64_t) random();
+  while (draw >= limit);
+  return draw % range;
+}
+
+static int pace_event_before(const struct pace_event *a,
+  const struct pace_event *b)
+{
+  return a->due < b->due || (a->due == b->due && a->seq < b->seq);
+}
+
+static void push_pace_event(struct pace_event *heap, size_t *n,
+  const struct pace_event *ev)
+{
+  size_t i = (*n)++, parent;
+
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (!pace_event_before(ev, &heap[parent]))
+      break;
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = *ev;
+}
+
+static void pop_pace_event(struct pace_event *heap, size_t *n,
+  struct pace_event *ev)
+{
+  struct pace_event last;
+  size_t i = 0, child;
+
+  *ev = heap[0];
+  last = heap[--*n];
+  for (;;) {
+    child = 2 * i + 1;
+    if (child >= *n)
+      break;
+    if (child + 1 < *n && pace_event_before(&heap[child + 1], &heap[child]))
+      child++;
+    if (!pace_event_before(&heap[child], &last))
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+}
+
+/*
+ * Blocks until the monotonic clock reaches when.  This uses the timer
+ * fd tfd if there is one, and nanosleep otherwise.
+ *
+ * Returns 0 or -1 on error.
+ */
+static int pace_sleep_until(int tfd, long long when)
+{
+  struct timespec ts;
+  long long delta;
+
+#ifdef HAVE_SYS_TIMERFD_H
+  struct itimerspec its;
+  u_int64_t expirations;
+
+  if (tfd != -1) {
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = when / NSEC_PER_SEC;
+    its.it_value.tv_nsec = when % NSEC_PER_SEC;
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+      return -1;
+    while (read(tfd, &expirations, sizeof(expirations)) == -1)
+      if (errno != EINTR)
+        return -1;
+    return 0;
+  }
+#endif
+
+  delta = when - pace_now();
+  if (delta <= 0)
+    return 0;
+  ts.tv_sec = delta / NSEC_PER_SEC;
+  ts.tv_nsec = delta % NSEC_PER_SEC;
+  while (nanosleep(&ts, &ts) == -1)
+    if (errno != EINTR)
+      return -1;
+  return 0;
+}
+
+/*
+ * Sends count messages of msglen bytes each, stored back to back in
+ * msgs, through b, paced as pace says.  If dests isn't NULL, message
+ * i goes where dests[i] says, as with broadcaster_send_directed.  The
+ * pacing is a token bucket holding up to pace->burst tokens that
+ * refills at pace->rate tokens a second; each packet takes a token.
+ * When no packet can go, this sleeps on a timer until the next host
+ * is due or the next token arrives, whichever is later, so it never
+ * spins.  Hosts that are ready go out together, up to PACE_BATCH at a
+ * time.
+ *
+ * If results isn't NULL, results[i] is set to 0 if every packet for
+ * message i was sent and to the errno value of the first that failed
+ * otherwise.  If report isn't NULL, it says how many packets went out
+ * and over how long.
+ *
+ * Returns the number of packets sent or -1 on error.
+ */
+ssize_t
+paced_send_msgs(struct broadcaster *b, const char *msgs, const size_t count,
+  const size_t msglen, const struct bcast_dest *dests, int *results,
+  const struct wake_pace *pace, struct pace_report *report)
+{
+  struct pace_event *heap = NULL, *taken = NULL, ev;
+  struct bcast_dest *stage_dests = NULL;
+  char *stage = NULL;
+  int *status = NULL;
+  size_t nheap = 0, seq = 0, n, i;
+  double tokens;
+  long long now, last, next, ready, start = 0, end = 0;
+  ssize_t sent = 0;
+  int tfd = -1, idle = 1, error = 0;
+
+  if (pace->burst == 0 || pace->repeat == 0 || pace->rate < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  heap = calloc(count ? count : 1, sizeof(struct pace_event));
+  taken = calloc(PACE_BATCH, sizeof(struct pace_event));
+  stage = malloc(PACE_BATCH * msglen);
+  status = calloc(PACE_BATCH, sizeof(int));
+  stage_dests = calloc(PACE_BATCH, sizeof(struct bcast_dest));
+  if (heap == NULL || taken == NULL || stage == NULL || status == NULL
+      || stage_dests == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+#ifdef HAVE_SYS_TIMERFD_H
+  tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+#ifdef DEBUG
+  if (tfd == -1)
+    fprintf(stderr, "No timer fd, using nanosleep: %s\n", strerror(errno));
+#endif
+#endif
+  if (pace->jitter_ms > 0)
+    srandom(time(NULL) ^ getpid());
+
+  /* Everyone is due now, in the order given. */
+  now = last = pace_now();
+  for (i = 0; i < count; i++) {
+    ev.due = now;
+    ev.seq = seq++;
+    ev.host = i;
+    ev.left = pace->repeat;
+    push_pace_event(heap, &nheap, &ev);
+    if (results != NULL)
+      results[i] = 0;
+  }
+  tokens = pace->burst;
+
+  while (nheap > 0) {
+    /*
+     * Only time spent idle fills the bucket past what the run has
+     * used.  Waking up late for a token just lets the packets we
+     * owe catch up, so that timer latency doesn't slow the rate.
+     */
+    now = pace_now();
+    if (pace->rate > 0) {
+      tokens += (now - last) * pace->rate / NSEC_PER_SEC;
+      if (idle && tokens > pace->burst)
+        tokens = pace->burst;
+    }
+    last = now;
+    idle = 0;
+
+    /* Take every host that is due, as far as the tokens go. */
+    n = 0;
+    while (nheap > 0 && heap[0].due <= now && n < PACE_BATCH
+        && (pace->rate == 0 || tokens >= 1)) {
+      pop_pace_event(heap, &nheap, &taken[n]);
+      memcpy(stage + n * msglen, msgs + taken[n].host * msglen, msglen);
+      if (dests != NULL)
+        stage_dests[n] = dests[taken[n].host];
+      n++;
+      if (pace->rate > 0)
+        tokens -= 1;
+    }
+
+    if (n > 0) {
+      if (start == 0)
+        start = now;
+      if (broadcaster_send_directed(b, stage, n, msglen,
+            dests != NULL ? stage_dests : NULL, status) == -1) {
+        error = errno;
+        goto CLEAN_UP;
+      }
+      end = pace_now();
+      for (i = 0; i < n; i++) {
+        ev = taken[i];
+        if (status[i] == 0)
+          sent++;
+        else if (results != NULL && results[ev.host] == 0)
+          results[ev.host] = status[i];
+        /* Queue the next repeat behind everyone already waiting. */
+        if (--ev.left > 0) {
+          ev.due = end;
+          if (pace->jitter_ms > 0)
+            ev.due += pace_jitter(pace->jitter_ms);
+          ev.seq = seq++;
+          push_pace_event(heap, &nheap, &ev);
+        }
+      }
+      continue;
+    }
+
+    /* Nothing can go yet: wait for the next host or the next token. */
+    next = heap[0].due;
+    idle = 1;
+    if (pace->rate > 0 && tokens < 1) {
+      ready = now + (long long) ((1 - tokens) * NSEC_PER_SEC / pace->rate) + 1;
+      if (ready >= next) {
+        next = ready;
+        idle = 0;
+      }
+    }
+    if (pace_sleep_until(tfd, next) == -1) {
+      error = errno;
+      goto CLEAN_UP;
+    }
+  }
+
+  if (report != NULL) {
+    report->packets = sent;
+    report->seconds = (double) (end - start) / NSEC_PER_SEC;
+  }
+
+CLEAN_UP:
+  if (tfd != -1)
+    close(tfd);
+  free(heap);
+  free(taken);
+  free(stage);
+  free(status);
+  free(stage_dests);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+
+  return sent;
+}
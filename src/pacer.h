@@ -0,0 +1,50 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PACER_INCL
+#define PACER_INCL 1
+
+#include "broadcast.h"
+#include <sys/types.h>
+
+/*
+ * How to pace a run of wakes.  At most burst packets go out back to
+ * back, after which they are held to rate per second (0 for no
+ * limit).  Every host is sent repeat times in all; each repeat waits
+ * for the host's turn to come round again plus a random 0 to
+ * jitter_ms milliseconds.
+ */
+struct wake_pace {
+  double rate;
+  unsigned int burst;
+  unsigned int repeat;
+  unsigned int jitter_ms;
+};
+
+/* What a paced run managed. */
+struct pace_report {
+  size_t packets; /* how many packets were sent */
+  double seconds; /* from the first packet to the last */
+};
+
+ssize_t
+paced_send_msgs(struct broadcaster *b, const char *msgs, const size_t count,
+  const size_t msglen, const struct bcast_dest *dests, int *results,
+  const struct wake_pace *pace, struct pace_report *report);
+
+#endif
@@ -0,0 +1,392 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "rawsend.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#ifdef HAVE_IFADDRS_H
+#include <ifaddrs.h>
+#endif
+#ifdef HAVE_LINUX_IF_PACKET_H
+#include <sys/mman.h>
+#include <net/if_arp.h>
+#include <linux/if_packet.h>
+#endif
+
+#if defined(HAVE_LINUX_IF_PACKET_H) && defined(HAVE_IFADDRS_H)
+
+/* The length of an Ethernet header: destination, source and type. */
+#define RAW_HDR_LEN 14
+
+/* The longest frame we build, header included. */
+#define RAW_FRAME_MAX 1514
+
+/*
+ * The transmit ring is RAW_RING_BLOCKS blocks of RAW_RING_BLOCK bytes,
+ * cut into frames of RAW_RING_FRAME bytes.  A frame slot has room for
+ * the ring's own header and a frame holding a magic packet.
+ */
+#define RAW_RING_FRAME 256
+#define RAW_RING_BLOCK 4096
+#define RAW_RING_BLOCKS 64
+
+/* Where the frame data starts in a slot of the ring. */
+#define RAW_RING_DATA (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+static const unsigned char raw_broadcast[6] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/*
+ * Gives link a transmit ring, if the kernel will map one.  Without
+ * one, frames are sent one at a time with send.
+ */
+static void map_raw_ring(struct raw_link *link)
+{
+  struct tpacket_req req;
+  int version = TPACKET_V2;
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = RAW_RING_BLOCK;
+  req.tp_block_nr = RAW_RING_BLOCKS;
+  req.tp_frame_size = RAW_RING_FRAME;
+  req.tp_frame_nr = RAW_RING_BLOCK / RAW_RING_FRAME * RAW_RING_BLOCKS;
+
+  if (setsockopt(link->fd, SOL_PACKET, PACKET_VERSION, &version,
+        sizeof(version)) == -1
+      || setsockopt(link->fd, SOL_PACKET, PACKET_TX_RING, &req,
+        sizeof(req)) == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "No transmit ring: %s\n", strerror(errno));
+#endif
+    return;
+  }
+
+  link->owners = calloc(req.tp_frame_nr, sizeof(size_t));
+  link->ring_size = (size_t) req.tp_block_size * req.tp_block_nr;
+  link->ring = mmap(NULL, link->ring_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED, link->fd, 0);
+  if (link->owners == NULL || link->ring == MAP_FAILED) {
+#ifdef DEBUG
+    fprintf(stderr, "Mapping transmit ring: %s\n", strerror(errno));
+#endif
+    if (link->ring != MAP_FAILED)
+      munmap(link->ring, link->ring_size);
+    free(link->owners);
+    link->owners = NULL;
+    link->ring = NULL;
+    /* Hand the ring back so that send works without it. */
+    memset(&req, 0, sizeof(req));
+    setsockopt(link->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req));
+    return;
+  }
+  link->frame_size = req.tp_frame_size;
+  link->frame_nr = req.tp_frame_nr;
+}
+
+/*
+ * Opens a packet socket bound to the interface ifindex, whose
+ * hardware address is hwaddr, and sets up its transmit ring.  The
+ * socket's protocol is 0, so it never receives anything.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int open_raw_link(struct raw_link *link, int ifindex,
+  const unsigned char *hwaddr)
+{
+  struct sockaddr_ll sll;
+  int error;
+
+  memset(link, 0, sizeof(struct raw_link));
+  link->ifindex = ifindex;
+  memcpy(link->hwaddr, hwaddr, 6);
+
+  link->fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+  if (link->fd == -1)
+    return -1;
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_ifindex = ifindex;
+  if (bind(link->fd, (struct sockaddr *) &sll, sizeof(sll)) == -1) {
+    error = errno;
+    close(link->fd);
+    errno = error;
+    return -1;
+  }
+
+  map_raw_ring(link);
+  return 0;
+}
+
+/*
+ * Finds every interface that is up, isn't the loopback interface, can
+ * broadcast and is Ethernet, and opens a packet socket on each.  This
+ * needs CAP_NET_RAW.
+ *
+ * Returns a pointer to the sender, which must be closed with
+ * close_raw_sender, or NULL on error.
+ */
+struct raw_sender *open_raw_sender(void)
+{
+  struct raw_sender *r;
+  struct ifaddrs *ifap = NULL, *ifa;
+  struct sockaddr_ll *sll;
+  size_t max = 0;
+  int error = 0;
+
+  r = calloc(1, sizeof(struct raw_sender));
+  if (r == NULL)
+    return NULL;
+  if (getifaddrs(&ifap) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next)
+    max++;
+  r->links = calloc(max + 1, sizeof(struct raw_link));
+  if (r->links == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+    if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_PACKET)
+      continue;
+    if ((ifa->ifa_flags & IFF_UP) == 0 || (ifa->ifa_flags & IFF_LOOPBACK)
+        || (ifa->ifa_flags & IFF_BROADCAST) == 0)
+      continue;
+    sll = (struct sockaddr_ll *) ifa->ifa_addr;
+    if (sll->sll_hatype != ARPHRD_ETHER || sll->sll_halen != 6)
+      continue;
+    if (open_raw_link(&r->links[r->count], sll->sll_ifindex,
+          sll->sll_addr) == -1) {
+#ifdef DEBUG
+      fprintf(stderr, "Opening packet socket on %s\n", ifa->ifa_name);
+#endif
+      error = errno;
+      goto CLEAN_UP;
+    }
+    r->count++;
+  }
+
+CLEAN_UP:
+  if (ifap != NULL)
+    freeifaddrs(ifap);
+  if (error) {
+    close_raw_sender(r);
+    errno = error;
+    return NULL;
+  }
+
+  return r;
+}
+
+/* Writes a broadcast frame from link carrying msg into buf. */
+static size_t build_raw_frame(const struct raw_link *link, char *buf,
+  const char *msg, size_t msglen)
+{
+  memcpy(buf, raw_broadcast, 6);
+  memcpy(buf + 6, link->hwaddr, 6);
+  buf[12] = RAW_ETHERTYPE >> 8;
+  buf[13] = RAW_ETHERTYPE & 0xFF;
+  memcpy(buf + RAW_HDR_LEN, msg, msglen);
+  return RAW_HDR_LEN + msglen;
+}
+
+/* Records how sending message owner went on one interface. */
+static void set_raw_status(int *status, size_t owner, int error)
+{
+  if (error == 0)
+    status[owner] = 0;
+  else if (status[owner] != 0)
+    status[owner] = error;
+}
+
+/*
+ * Has the kernel send every frame queued in link's ring, with one
+ * send call, and records how each one went.
+ */
+static void flush_raw_link(struct raw_link *link, int *status)
+{
+  struct tpacket2_hdr *hdr;
+  unsigned int i, frame;
+  int error = 0;
+
+  if (link->queued == 0)
+    return;
+  while (send(link->fd, NULL, 0, 0) == -1)
+    if (errno != EINTR) {
+      error = errno;
+      break;
+    }
+
+  frame = (link->head + link->frame_nr - link->queued) % link->frame_nr;
+  for (i = 0; i < link->queued; i++) {
+    hdr = (struct tpacket2_hdr *) (link->ring + frame * link->frame_size);
+    switch (hdr->tp_status) {
+    case TP_STATUS_AVAILABLE:
+      set_raw_status(status, link->owners[frame], 0);
+      break;
+    case TP_STATUS_WRONG_FORMAT:
+      set_raw_status(status, link->owners[frame], EINVAL);
+      hdr->tp_status = TP_STATUS_AVAILABLE;
+      break;
+    default:
+      /* Left behind when the send failed; drop it. */
+      set_raw_status(status, link->owners[frame], error ? error : EIO);
+      hdr->tp_status = TP_STATUS_AVAILABLE;
+    }
+    frame = (frame + 1) % link->frame_nr;
+  }
+  link->queued = 0;
+}
+
+/*
+ * Puts a frame carrying message owner in link's ring, sending what is
+ * already there first if the ring is full.  Links without a ring send
+ * the frame straight away.
+ */
+static void queue_raw_frame(struct raw_link *link, const char *msg,
+  size_t msglen, size_t owner, int *status)
+{
+  struct tpacket2_hdr *hdr;
+  char buf[RAW_FRAME_MAX];
+  size_t len;
+
+  if (link->ring == NULL || RAW_RING_DATA + RAW_HDR_LEN + msglen
+      > link->frame_size) {
+    len = build_raw_frame(link, buf, msg, msglen);
+    while (send(link->fd, buf, len, 0) == -1)
+      if (errno != EINTR) {
+        set_raw_status(status, owner, errno);
+        return;
+      }
+    set_raw_status(status, owner, 0);
+    return;
+  }
+
+  hdr = (struct tpacket2_hdr *) (link->ring + link->head * link->frame_size);
+  if (link->queued == link->frame_nr || hdr->tp_status != TP_STATUS_AVAILABLE)
+    flush_raw_link(link, status);
+  if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+    set_raw_status(status, owner, EBUSY);
+    return;
+  }
+
+  hdr->tp_len = build_raw_frame(link, (char *) hdr + RAW_RING_DATA, msg,
+    msglen);
+  /* The frame must be complete before the kernel may take it. */
+  __sync_synchronize();
+  hdr->tp_status = TP_STATUS_SEND_REQUEST;
+  link->owners[link->head] = owner;
+  link->head = (link->head + 1) % link->frame_nr;
+  link->queued++;
+}
+
+/*
+ * Sends count messages of msglen bytes each, stored back to back in
+ * msgs, as raw Ethernet broadcast frames of type RAW_ETHERTYPE.  A
+ * message goes out of every interface of r, unless dests[i] names an
+ * interface, when it only goes out of that one.  Frames wait in each
+ * interface's transmit ring until it fills or every message has been
+ * queued, and each ring is then sent with one system call.
+ *
+ * results and the return value are as for broadcaster_send_directed.
+ */
+ssize_t raw_send_msgs(struct raw_sender *r, const char *msgs,
+  const size_t count, const size_t msglen, const struct bcast_dest *dests,
+  int *results)
+{
+  size_t i, k, sent = 0;
+  int *status;
+
+  if (msglen > RAW_FRAME_MAX - RAW_HDR_LEN) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  status = calloc(count ? count : 1, sizeof(int));
+  if (status == NULL)
+    return -1;
+  for (i = 0; i < count; i++)
+    status[i] = ENETUNREACH;
+
+  for (i = 0; i < count; i++)
+    for (k = 0; k < r->count; k++)
+      if (dests == NULL || dests[i].ifindex == 0
+          || dests[i].ifindex == r->links[k].ifindex)
+        queue_raw_frame(&r->links[k], msgs + i * msglen, msglen, i, status);
+  for (k = 0; k < r->count; k++)
+    flush_raw_link(&r->links[k], status);
+
+  for (i = 0; i < count; i++) {
+    if (status[i] == 0)
+      sent++;
+    if (results != NULL)
+      results[i] = status[i];
+  }
+  free(status);
+
+  return sent;
+}
+
+/*
+ * Unmaps the rings, closes the sockets and frees the sender.
+ */
+void close_raw_sender(struct raw_sender *r)
+{
+  size_t k;
+
+  if (r == NULL)
+    return;
+  for (k = 0; k < r->count; k++) {
+    if (r->links[k].ring != NULL)
+      munmap(r->links[k].ring, r->links[k].ring_size);
+    free(r->links[k].owners);
+    close(r->links[k].fd);
+  }
+  free(r->links);
+  free(r);
+}
+
+#else /* no packet sockets */
+
+struct raw_sender *open_raw_sender(void)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+ssize_t raw_send_msgs(struct raw_sender *r, const char *msgs,
+  const size_t count, const size_t msglen, const struct bcast_dest *dests,
+  int *results)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+void close_raw_sender(struct raw_sender *r)
+{
+}
+
+#endif
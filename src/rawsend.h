@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAWSEND_INCL
+#define RAWSEND_INCL 1
+
+#include "broadcast.h"
+#include <sys/types.h>
+
+/* The EtherType of a wake on LAN frame. */
+#define RAW_ETHERTYPE 0x0842
+
+/*
+ * One Ethernet interface that raw frames go out of: a packet socket
+ * bound to it and, where the system has one, a transmit ring mapped
+ * from the kernel.  owners says which message each frame of the ring
+ * holds while it waits to be sent.
+ */
+struct raw_link {
+  int fd;
+  int ifindex;
+  unsigned char hwaddr[6];
+  char *ring;
+  size_t ring_size;
+  unsigned int frame_size;
+  unsigned int frame_nr;
+  unsigned int head;
+  unsigned int queued;
+  size_t *owners;
+};
+
+/* Every interface that raw frames can go out of. */
+struct raw_sender {
+  struct raw_link *links;
+  size_t count;
+};
+
+struct raw_sender *open_raw_sender(void);
+
+ssize_t raw_send_msgs(struct raw_sender *r, const char *msgs,
+  const size_t count, const size_t msglen, const struct bcast_dest *dests,
+  int *results);
+
+void close_raw_sender(struct raw_sender *r);
+
+#endif
@@ -0,0 +1,711 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "relay.h"
+#include "build_msg.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+/*
+ * A request is a UDP datagram or part of a TCP stream holding either
+ * magic packets or mac addresses in text, separated by white space,
+ * such as
+ *
+ *     00:11:22:33:44:55 00:11:22:33:44:66
+ *
+ * No reply is sent.  A mac address that was sent for less than
+ * window_ms ago is dropped, and the rest are queued and sent together
+ * flush_ms after the first of them arrived, or as soon as RELAY_BATCH
+ * are waiting.
+ */
+
+/* The most magic packets sent in one burst. */
+#define RELAY_BATCH 1024
+
+/* The longest datagram read, and how many are read at once. */
+#define RELAY_MSG_MAX 2048
+#define RELAY_RECV_BATCH 64
+
+/* How many reads one socket gets before the others, and the queue,
+ * have their turn.  epoll is level triggered, so whatever is left is
+ * read next time around. */
+#define RELAY_READ_ROUNDS 16
+
+/* How big a receive buffer to ask for on the UDP socket, so that a
+ * burst of requests waits there while a burst of wakes goes out. */
+#define RELAY_RCVBUF (4 * 1024 * 1024)
+
+/* How much of a TCP stream is held while waiting for the end of a
+ * word. */
+#define RELAY_CONN_BUF 4096
+
+/* How many events to take from epoll_wait at once. */
+#define RELAY_EVENTS 64
+
+/* The smallest table of sent mac addresses.  It must be a power of 2. */
+#define RELAY_MIN_SEEN 256
+
+/* A TCP client, with what it has sent that hasn't been used yet. */
+struct relay_conn {
+  int fd;
+  size_t len;
+  struct relay_conn *prev;
+  struct relay_conn *next;
+  unsigned char buf[RELAY_CONN_BUF];
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+
+/* Set by the signal handler to make run_wake_relay return. */
+static volatile sig_atomic_t relay_stopping;
+
+static void stop_wake_relay(int signum)
+{
+  (void) signum;
+  relay_stopping = 1;
+}
+
+/* Returns the monotonic clock in milliseconds. */
+static long long relay_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Hashes a mac address with FNV-1a. */
+static u_int32_t hash_relay_mac(const unsigned char *mac)
+{
+  u_int32_t h = 2166136261U;
+  int i;
+
+  for (i = 0; i < 6; i++) {
+    h ^= mac[i];
+    h *= 16777619U;
+  }
+  return h;
+}
+
+/* Returns the slot of r's table holding mac or the empty one where it
+ * belongs. */
+static struct relay_seen *find_relay_seen(struct relay_seen *seen,
+  size_t size, const unsigned char *mac)
+{
+  size_t mask = size - 1, i = hash_relay_mac(mac) & mask;
+
+  while (seen[i].used && memcmp(seen[i].mac, mac, 6) != 0)
+    i = (i + 1) & mask;
+  return &seen[i];
+}
+
+/*
+ * Makes room in r's table for one more mac address.  Addresses sent
+ * longer than the window ago no longer matter, so they are left out
+ * when the table is rebuilt, and it only grows if it is still more
+ * than a quarter full without them.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int grow_relay_seen(struct wake_relay *r, long long now)
+{
+  struct relay_seen *seen, *slot;
+  size_t size = r->seen_size, count = 0, i;
+
+  for (i = 0; i < r->seen_size; i++)
+    if (r->seen[i].used && now - r->seen[i].when < r->window_ms)
+      count++;
+  if (count * 4 > size)
+    size *= 2;
+
+  seen = calloc(size, sizeof(struct relay_seen));
+  if (seen == NULL)
+    return -1;
+  for (i = 0; i < r->seen_size; i++)
+    if (r->seen[i].used && now - r->seen[i].when < r->window_ms) {
+      slot = find_relay_seen(seen, size, r->seen[i].mac);
+      *slot = r->seen[i];
+    }
+  free(r->seen);
+  r->seen = seen;
+  r->seen_size = size;
+  r->seen_count = count;
+  return 0;
+}
+
+/*
+ * Says whether a packet for mac should go out now, that is, whether
+ * none has been sent or queued for it within the window, and if so
+ * records that one is.  If the table can't grow, the packet goes out
+ * anyway.
+ */
+static int relay_mac_due(struct wake_relay *r, const unsigned char *mac,
+  long long now)
+{
+  struct relay_seen *slot;
+
+  if (r->window_ms == 0)
+    return 1;
+  if ((r->seen_count + 1) * 2 > r->seen_size
+      && grow_relay_seen(r, now) == -1)
+    return 1;
+  slot = find_relay_seen(r->seen, r->seen_size, mac);
+  if (slot->used && now - slot->when < r->window_ms)
+    return 0;
+  if (!slot->used) {
+    memcpy(slot->mac, mac, 6);
+    slot->used = 1;
+    r->seen_count++;
+  }
+  slot->when = now;
+  return 1;
+}
+
+/*
+ * Sends every queued magic packet in one go, out of every interface,
+ * with the broadcaster's sendmmsg batches.
+ */
+static void flush_wake_relay(struct wake_relay *r)
+{
+  size_t i;
+
+  if (r->queued == 0)
+    return;
+  if (broadcaster_send_msgs(r->b, r->magic, r->queued, MAGIC_PACKET_LEN,
+        r->results) == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Relaying %lu packets: %s\n",
+      (unsigned long) r->queued, strerror(errno));
+#endif
+    r->stats.failed += r->queued;
+  }
+  else
+    for (i = 0; i < r->queued; i++)
+      if (r->results[i] == 0)
+        r->stats.sent++;
+      else
+        r->stats.failed++;
+  r->stats.bursts++;
+  r->queued = 0;
+}
+
+/* Queues a magic packet for mac unless one went out for it lately. */
+static void queue_relay_wake(struct wake_relay *r, const unsigned char *mac,
+  long long now)
+{
+  r->stats.requests++;
+  if (!relay_mac_due(r, mac, now)) {
+    r->stats.coalesced++;
+    return;
+  }
+  build_magic_packet(mac, r->magic + r->queued * MAGIC_PACKET_LEN);
+  if (r->queued++ == 0)
+    r->deadline = now + r->flush_ms;
+  if (r->queued == RELAY_BATCH)
+    flush_wake_relay(r);
+}
+
+/*
+ * Checks whether the MAGIC_PACKET_LEN bytes at p are a magic packet:
+ * six bytes of 0xFF and then the same mac address sixteen times.
+ *
+ * Returns 1 with mac filled in if they are or 0 if they aren't.
+ */
+static int read_magic_packet(const unsigned char *p, unsigned char *mac)
+{
+  int i;
+
+  for (i = 0; i < 6; i++)
+    if (p[i] != 0xFF)
+      return 0;
+  for (i = 2; i <= 16; i++)
+    if (memcmp(p + 6, p + 6 * i, 6) != 0)
+      return 0;
+  memcpy(mac, p + 6, 6);
+  return 1;
+}
+
+/* Tells whether c separates the words of a request. */
+static int relay_space(unsigned char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v'
+    || c == '\f' || c == '\0';
+}
+
+/*
+ * Queues a wake for every magic packet and mac address in the len
+ * bytes at buf.  Unless final is set, more may follow, so a word or
+ * packet that runs to the end is left for next time.
+ *
+ * Returns how many bytes were used.
+ */
+static size_t parse_relay_request(struct wake_relay *r,
+  const unsigned char *buf, size_t len, int final, long long now)
+{
+  unsigned char mac[6];
+  size_t p = 0, q;
+
+  while (p < len) {
+    if (relay_space(buf[p])) {
+      p++;
+      continue;
+    }
+    if (buf[p] == 0xFF) {
+      if (len - p < MAGIC_PACKET_LEN && !final)
+        break;
+      if (len - p >= MAGIC_PACKET_LEN && read_magic_packet(buf + p, mac)) {
+        queue_relay_wake(r, mac, now);
+        p += MAGIC_PACKET_LEN;
+        continue;
+      }
+    }
+    for (q = p; q < len && !relay_space(buf[q]); q++)
+      ;
+    if (q == len && !final)
+      break;
+    if (parse_macaddr((const char *) buf + p, q - p, mac, NULL))
+      queue_relay_wake(r, mac, now);
+    else
+      r->stats.invalid++;
+    p = q;
+  }
+
+  return p;
+}
+
+/*
+ * Handles one datagram.  One that starts with a magic packet is taken
+ * to be just that, whatever follows it, such as a SecureOn password.
+ */
+static void handle_relay_datagram(struct wake_relay *r,
+  const unsigned char *buf, size_t len, long long now)
+{
+  unsigned char mac[6];
+
+  if (len >= MAGIC_PACKET_LEN && read_magic_packet(buf, mac))
+    queue_relay_wake(r, mac, now);
+  else
+    parse_relay_request(r, buf, len, 1, now);
+}
+
+/* Reads the datagrams waiting on the UDP socket, a batch at a time
+ * with recvmmsg where we have it, for RELAY_READ_ROUNDS batches at
+ * most. */
+static void read_relay_datagrams(struct wake_relay *r)
+{
+  long long now;
+  ssize_t len;
+  int rounds;
+#ifdef HAVE_RECVMMSG
+  struct mmsghdr vec[RELAY_RECV_BATCH];
+  struct iovec iov[RELAY_RECV_BATCH];
+  int i, n;
+
+  for (i = 0; i < RELAY_RECV_BATCH; i++) {
+    iov[i].iov_base = r->recv_bufs + i * RELAY_MSG_MAX;
+    iov[i].iov_len = RELAY_MSG_MAX;
+  }
+  for (rounds = 0; rounds < RELAY_READ_ROUNDS; rounds++) {
+    memset(vec, 0, sizeof(vec));
+    for (i = 0; i < RELAY_RECV_BATCH; i++) {
+      vec[i].msg_hdr.msg_iov = &iov[i];
+      vec[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg(r->udp_fd, vec, RELAY_RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    now = relay_now();
+    for (i = 0; i < n; i++) {
+      len = vec[i].msg_len;
+      handle_relay_datagram(r, iov[i].iov_base, len, now);
+    }
+  }
+#else
+  for (rounds = 0; rounds < RELAY_READ_ROUNDS * RELAY_RECV_BATCH;
+      rounds++) {
+    len = recv(r->udp_fd, r->recv_bufs, RELAY_MSG_MAX, MSG_DONTWAIT);
+    if (len == -1) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    handle_relay_datagram(r, (unsigned char *) r->recv_bufs, len,
+      relay_now());
+  }
+#endif
+}
+
+/* Closes a TCP client and forgets it. */
+static void drop_relay_conn(struct wake_relay *r, struct relay_conn *c)
+{
+  if (c->prev != NULL)
+    c->prev->next = c->next;
+  else
+    r->conns = c->next;
+  if (c->next != NULL)
+    c->next->prev = c->prev;
+  close(c->fd);
+  free(c);
+}
+
+/* Takes every connection waiting on the TCP socket. */
+static void accept_relay_conns(struct wake_relay *r)
+{
+  struct epoll_event ev;
+  struct relay_conn *c;
+  int fd;
+
+  while ((fd = accept4(r->tcp_fd, NULL, NULL,
+          SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+    c = malloc(sizeof(struct relay_conn));
+    if (c == NULL) {
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    c->len = 0;
+    c->prev = NULL;
+    c->next = r->conns;
+    if (r->conns != NULL)
+      r->conns->prev = c;
+    r->conns = c;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+#ifdef DEBUG
+      fprintf(stderr, "Watching client: %s\n", strerror(errno));
+#endif
+      drop_relay_conn(r, c);
+    }
+  }
+}
+
+/*
+ * Reads what is waiting from a TCP client, RELAY_READ_ROUNDS buffers
+ * at most, and queues the wakes in it.  A word too long to be a mac
+ * address is thrown away.
+ *
+ * Returns 0, or -1 once the client has hung up or failed and should be
+ * dropped.
+ */
+static int read_relay_conn(struct wake_relay *r, struct relay_conn *c)
+{
+  ssize_t n;
+  size_t used;
+  int rounds;
+
+  for (rounds = 0; rounds < RELAY_READ_ROUNDS; rounds++) {
+    n = recv(c->fd, c->buf + c->len, RELAY_CONN_BUF - c->len, 0);
+    if (n == -1)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+        ? 0 : -1;
+    if (n == 0) {
+      parse_relay_request(r, c->buf, c->len, 1, relay_now());
+      return -1;
+    }
+    c->len += n;
+    used = parse_relay_request(r, c->buf, c->len, 0, relay_now());
+    if (used == 0 && c->len == RELAY_CONN_BUF) {
+      r->stats.invalid++;
+      used = c->len;
+    }
+    memmove(c->buf, c->buf + used, c->len - used);
+    c->len -= used;
+  }
+
+  return 0;
+}
+
+/*
+ * Opens a nonblocking socket of the given type on port, for IPv6 and
+ * IPv4 both where the system lets one socket do that, and for IPv4
+ * alone otherwise.  A UDP socket gets a big receive buffer, as far as
+ * the system allows, and a TCP socket is left listening.
+ *
+ * Returns the socket or -1 on error.
+ */
+static int open_relay_socket(int type, u_int16_t port)
+{
+  struct sockaddr_in6 sin6;
+  struct sockaddr_in sin;
+  const int on = 1, off = 0, rcvbuf = RELAY_RCVBUF;
+  int fd, error;
+
+  fd = socket(AF_INET6, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd != -1) {
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    if (type == SOCK_STREAM)
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&sin6, 0, sizeof(sin6));
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_port = htons(port);
+    sin6.sin6_addr = in6addr_any;
+    if (bind(fd, (struct sockaddr *) &sin6, sizeof(sin6)) == -1) {
+      error = errno;
+      close(fd);
+      errno = error;
+      return -1;
+    }
+  }
+  else if (errno == EAFNOSUPPORT) {
+    fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+      return -1;
+    if (type == SOCK_STREAM)
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *) &sin, sizeof(sin)) == -1) {
+      error = errno;
+      close(fd);
+      errno = error;
+      return -1;
+    }
+  }
+  else
+    return -1;
+
+  if (type == SOCK_DGRAM)
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  else if (listen(fd, SOMAXCONN) == -1) {
+    error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  return fd;
+}
+
+/* Adds one of the listening sockets to r's epoll set. */
+static int watch_relay_fd(struct wake_relay *r, int *fd)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = fd;
+  return epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, *fd, &ev);
+}
+
+/*
+ * Opens a relay listening on port, over UDP and TCP, that sends the
+ * wakes it hears about with b.  Repeats for a mac address within
+ * window_ms milliseconds are dropped, 0 meaning never, and wakes are
+ * held for up to flush_ms milliseconds to be sent together.
+ *
+ * Returns a pointer to the relay, which must be released with
+ * close_wake_relay, or NULL on error.
+ */
+struct wake_relay *open_wake_relay(u_int16_t port, struct broadcaster *b,
+  unsigned int window_ms, unsigned int flush_ms)
+{
+  struct wake_relay *r;
+  int error = 0;
+
+  r = calloc(1, sizeof(struct wake_relay));
+  if (r == NULL)
+    return NULL;
+  r->udp_fd = -1;
+  r->tcp_fd = -1;
+  r->epoll_fd = -1;
+  r->b = b;
+  r->window_ms = window_ms;
+  r->flush_ms = flush_ms;
+
+  r->seen_size = RELAY_MIN_SEEN;
+  r->seen = calloc(r->seen_size, sizeof(struct relay_seen));
+  r->magic = malloc(RELAY_BATCH * MAGIC_PACKET_LEN);
+  r->results = calloc(RELAY_BATCH, sizeof(int));
+  r->recv_bufs = malloc(RELAY_RECV_BATCH * RELAY_MSG_MAX);
+  if (r->seen == NULL || r->magic == NULL || r->results == NULL
+      || r->recv_bufs == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (r->epoll_fd == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Creating epoll instance\n");
+#endif
+    error = errno;
+    goto CLEAN_UP;
+  }
+  r->udp_fd = open_relay_socket(SOCK_DGRAM, port);
+  if (r->udp_fd == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Opening UDP port %u\n", port);
+#endif
+    error = errno;
+    goto CLEAN_UP;
+  }
+  r->tcp_fd = open_relay_socket(SOCK_STREAM, port);
+  if (r->tcp_fd == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Opening TCP port %u\n", port);
+#endif
+    error = errno;
+    goto CLEAN_UP;
+  }
+  if (watch_relay_fd(r, &r->udp_fd) == -1
+      || watch_relay_fd(r, &r->tcp_fd) == -1)
+    error = errno;
+
+CLEAN_UP:
+  if (error) {
+    close_wake_relay(r);
+    errno = error;
+    return NULL;
+  }
+
+  return r;
+}
+
+/*
+ * Relays wakes until SIGINT or SIGTERM arrives.  epoll_pwait waits no
+ * longer than the time left until the queued wakes are due, so they
+ * go out on time however busy or quiet the sockets are.  Whatever is
+ * still queued is sent before returning.
+ *
+ * Returns 0 when stopped by a signal or -1 on error.
+ */
+int run_wake_relay(struct wake_relay *r)
+{
+  struct epoll_event events[RELAY_EVENTS];
+  struct sigaction sa;
+  sigset_t stop, old, waiting;
+  long long now;
+  int n, i, timeout, error;
+  void *ptr;
+
+  /* No SA_RESTART, so that epoll_pwait returns when we are told to
+   * stop. */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop_wake_relay;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  relay_stopping = 0;
+
+  /* The signals are only let in while waiting, so one that comes
+   * after relay_stopping is checked still cuts the wait short and the
+   * queue is flushed. */
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  sigprocmask(SIG_BLOCK, &stop, &old);
+  waiting = old;
+  sigdelset(&waiting, SIGINT);
+  sigdelset(&waiting, SIGTERM);
+
+  while (!relay_stopping) {
+    timeout = -1;
+    if (r->queued > 0) {
+      now = relay_now();
+      timeout = r->deadline > now ? (int) (r->deadline - now) : 0;
+    }
+    n = epoll_pwait(r->epoll_fd, events, RELAY_EVENTS, timeout, &waiting);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      error = errno;
+      sigprocmask(SIG_SETMASK, &old, NULL);
+      errno = error;
+      return -1;
+    }
+    for (i = 0; i < n; i++) {
+      ptr = events[i].data.ptr;
+      if (ptr == &r->udp_fd)
+        read_relay_datagrams(r);
+      else if (ptr == &r->tcp_fd)
+        accept_relay_conns(r);
+      else if (((events[i].events & EPOLLIN)
+            && read_relay_conn(r, ptr) == -1)
+          || (events[i].events & (EPOLLHUP | EPOLLERR)))
+        drop_relay_conn(r, ptr);
+    }
+    if (r->queued > 0 && relay_now() >= r->deadline)
+      flush_wake_relay(r);
+  }
+  flush_wake_relay(r);
+  sigprocmask(SIG_SETMASK, &old, NULL);
+
+  return 0;
+}
+
+#else /* no epoll */
+
+struct wake_relay *open_wake_relay(u_int16_t port, struct broadcaster *b,
+  unsigned int window_ms, unsigned int flush_ms)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+int run_wake_relay(struct wake_relay *r)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
+
+/*
+ * Closes the sockets, clients included, and frees what open_wake_relay
+ * allocated.  The broadcaster belongs to the caller.
+ */
+void close_wake_relay(struct wake_relay *r)
+{
+  struct relay_conn *c;
+
+  if (r == NULL)
+    return;
+  while ((c = r->conns) != NULL) {
+    r->conns = c->next;
+    close(c->fd);
+    free(c);
+  }
+  if (r->udp_fd != -1)
+    close(r->udp_fd);
+  if (r->tcp_fd != -1)
+    close(r->tcp_fd);
+  if (r->epoll_fd != -1)
+    close(r->epoll_fd);
+  free(r->seen);
+  free(r->magic);
+  free(r->results);
+  free(r->recv_bufs);
+  free(r);
+}
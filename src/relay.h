@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RELAY_INCL
+#define RELAY_INCL 1
+
+#include "broadcast.h"
+#include <sys/types.h>
+
+/* The port wake --relay listens on when it isn't given one.  It is not
+ * port 9, so that the relay never hears its own magic packets. */
+#define WAKE_RELAY_PORT 4009
+
+/* What a relay has done since it started. */
+struct relay_stats {
+  unsigned long requests;  /* mac addresses asked for */
+  unsigned long coalesced; /* of those, dropped as repeats */
+  unsigned long invalid;   /* words that weren't mac addresses */
+  unsigned long sent;      /* magic packets that went out */
+  unsigned long failed;    /* magic packets that didn't */
+  unsigned long bursts;    /* times the queue was sent */
+};
+
+/* A mac address the relay has sent a packet for, and when. */
+struct relay_seen {
+  long long when; /* milliseconds on the monotonic clock */
+  unsigned char mac[6];
+  unsigned char used;
+};
+
+struct relay_conn;
+
+/*
+ * A running relay: the UDP and TCP sockets it listens on, the epoll
+ * instance that watches them and the TCP clients, the table of
+ * recently sent mac addresses, and the magic packets queued for the
+ * next burst, which goes out flush_ms after the first of them was
+ * queued.
+ */
+struct wake_relay {
+  int udp_fd;
+  int tcp_fd;
+  int epoll_fd;
+  struct broadcaster *b;
+  unsigned int window_ms;
+  unsigned int flush_ms;
+  struct relay_seen *seen;
+  size_t seen_size;
+  size_t seen_count;
+  char *magic;
+  int *results;
+  size_t queued;
+  long long deadline;
+  char *recv_bufs;
+  struct relay_conn *conns;
+  struct relay_stats stats;
+};
+
+struct wake_relay *open_wake_relay(u_int16_t port, struct broadcaster *b,
+  unsigned int window_ms, unsigned int flush_ms);
+
+int run_wake_relay(struct wake_relay *r);
+
+void close_wake_relay(struct wake_relay *r);
+
+#endif
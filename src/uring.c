@@ -0,0 +1,579 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "uring.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/syscall.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+
+/* How many submissions the ring holds. */
+#define URING_ENTRIES 256
+
+/* How many messages can be in the registered buffer at once. */
+#define URING_SLOTS 1024
+
+/* How many sockets the registered file table has room for. */
+#define URING_TARGETS 256
+
+/*
+ * There is no wrapper for these in the C library, so we make the
+ * system calls ourselves rather than depend on liburing.
+ */
+static int sys_io_uring_setup(unsigned int entries,
+  struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+  unsigned int min_complete, unsigned int flags)
+{
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+    NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+  unsigned int nr_args)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Creates the ring and maps its queues.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int map_uring(struct uring_sender *u)
+{
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  memset(&p, 0, sizeof(p));
+  u->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+  if (u->ring_fd == -1)
+    return -1;
+
+  u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  u->cq_ring_size = p.cq_off.cqes
+    + p.cq_entries * sizeof(struct io_uring_cqe);
+  /* Newer kernels put both queues in one mapping. */
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_ring_size > u->sq_ring_size)
+      u->sq_ring_size = u->cq_ring_size;
+    u->cq_ring_size = 0;
+  }
+  sq = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED)
+    return -1;
+  u->sq_ring = sq;
+  if (u->cq_ring_size == 0)
+    cq = sq;
+  else {
+    cq = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED)
+      return -1;
+    u->cq_ring = cq;
+  }
+  u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) {
+    u->sqes = NULL;
+    return -1;
+  }
+
+  u->sq_head = (unsigned int *) (sq + p.sq_off.head);
+  u->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+  u->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned int *) (sq + p.sq_off.array);
+  u->cq_head = (unsigned int *) (cq + p.cq_off.head);
+  u->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+  u->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+  u->cqes = cq + p.cq_off.cqes;
+  u->sq_entries = p.sq_entries;
+  u->cq_entries = p.cq_entries;
+  return 0;
+}
+
+/*
+ * Puts fd, a UDP socket connected to addr, in the registered file
+ * table as target index, which is either the next free one or one
+ * whose socket is to be replaced.  The sender owns fd from then on,
+ * and closes it even if this fails.
+ *
+ * Returns index or -1 on error.
+ */
+static int set_uring_target(struct uring_sender *u, size_t index,
+  const struct sockaddr_in *addr, int ifindex, int fd)
+{
+  struct uring_target *t = &u->targets[index];
+  struct io_uring_files_update update;
+  int error;
+
+  memset(&update, 0, sizeof(update));
+  update.offset = index;
+  update.fds = (unsigned long) &fd;
+  if (sys_io_uring_register(u->ring_fd, IORING_REGISTER_FILES_UPDATE,
+        &update, 1) != 1) {
+#ifdef DEBUG
+    fprintf(stderr, "Adding ring target: %s\n", strerror(errno));
+#endif
+    error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  if (index < u->count)
+    close(t->fd);
+  else
+    u->count++;
+  t->addr = *addr;
+  t->ifindex = ifindex;
+  t->fd = fd;
+  t->used = ++u->clock;
+  t->inflight = 0;
+
+  return index;
+}
+
+/*
+ * Sets up an io_uring to send to every broadcast address known to b.
+ * The buffer that messages are copied into and the file table that
+ * holds the sockets are both registered with the kernel up front, so
+ * that sends don't have to map either of them each time.
+ *
+ * Returns a pointer to a struct uring_sender that must be released
+ * with close_uring_sender or NULL on error, for instance when the
+ * kernel has no io_uring.
+ */
+struct uring_sender *open_uring_sender(const struct broadcaster *b)
+{
+  struct uring_sender *u;
+  struct iovec iov;
+  int *fds = NULL;
+  int fd, error = 0;
+  size_t k;
+
+  u = calloc(1, sizeof(struct uring_sender));
+  if (u == NULL)
+    return NULL;
+  u->ring_fd = -1;
+  u->port = b->port;
+  u->bufs = calloc(URING_SLOTS, URING_SLOT);
+  u->owners = calloc(URING_SLOTS, sizeof(size_t));
+  u->pending = calloc(URING_SLOTS, sizeof(unsigned int));
+  u->targets = calloc(URING_TARGETS, sizeof(struct uring_target));
+  fds = malloc(URING_TARGETS * sizeof(int));
+  if (u->bufs == NULL || u->owners == NULL || u->pending == NULL
+      || u->targets == NULL || fds == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  if (map_uring(u) == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Setting up io_uring: %s\n", strerror(errno));
+#endif
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  iov.iov_base = u->bufs;
+  iov.iov_len = URING_SLOTS * URING_SLOT;
+  if (sys_io_uring_register(u->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1)
+      == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Registering buffers: %s\n", strerror(errno));
+#endif
+    error = errno;
+    goto CLEAN_UP;
+  }
+  /* Start with an empty table and fill it in as targets are added. */
+  for (k = 0; k < URING_TARGETS; k++)
+    fds[k] = -1;
+  if (sys_io_uring_register(u->ring_fd, IORING_REGISTER_FILES, fds,
+        URING_TARGETS) == -1) {
+#ifdef DEBUG
+    fprintf(stderr, "Registering files: %s\n", strerror(errno));
+#endif
+    error = errno;
+    goto CLEAN_UP;
+  }
+
+  /* The broadcaster's pool is already bound and connected, so share
+   * its sockets. */
+  for (k = 0; k < b->count; k++) {
+    if (k == URING_TARGETS) {
+      error = ENFILE;
+      goto CLEAN_UP;
+    }
+    fd = dup(b->fds[k]);
+    if (fd == -1 || set_uring_target(u, k, &b->addrs[k], 0, fd) == -1) {
+      error = errno;
+      goto CLEAN_UP;
+    }
+  }
+  u->flood = u->count;
+
+CLEAN_UP:
+  free(fds);
+  if (error) {
+    close_uring_sender(u);
+    errno = error;
+    return NULL;
+  }
+
+  return u;
+}
+
+/* Records how one send of message owner went. */
+static void set_uring_status(int *status, size_t owner, int error)
+{
+  if (error == 0)
+    status[owner] = 0;
+  else if (status[owner] != 0)
+    status[owner] = error;
+}
+
+/*
+ * Hands the kernel every submission queued so far and takes in the
+ * completions that are ready, first waiting for at least wait of
+ * them.  Each completion is charged to the message in its slot.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int reap_uring(struct uring_sender *u, int *status, unsigned int wait)
+{
+  struct io_uring_cqe *cqe;
+  unsigned int head, tail, slot;
+  int r;
+
+  if (wait > u->inflight)
+    wait = u->inflight;
+  for (;;) {
+    r = sys_io_uring_enter(u->ring_fd, u->queued, wait,
+      wait ? IORING_ENTER_GETEVENTS : 0);
+    if (r >= 0) {
+      u->queued -= r;
+      break;
+    }
+    if (errno == EINTR)
+      continue;
+    /* The completion queue is full, so empty it before going on. */
+    if ((errno == EAGAIN || errno == EBUSY)
+        && *u->cq_head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+      break;
+#ifdef DEBUG
+    fprintf(stderr, "Entering io_uring: %s\n", strerror(errno));
+#endif
+    return -1;
+  }
+
+  head = *u->cq_head;
+  tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    cqe = (struct io_uring_cqe *) u->cqes + (head & *u->cq_mask);
+    slot = cqe->user_data & 0xFFFFFFFF;
+    set_uring_status(status, u->owners[slot], cqe->res < 0 ? -cqe->res : 0);
+    u->targets[cqe->user_data >> 32].inflight--;
+    u->pending[slot]--;
+    u->inflight--;
+    head++;
+  }
+  __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/*
+ * Queues a send of the message in slot to target, making room first
+ * if the submission queue is full or the completion queue could
+ * overflow.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int queue_uring_send(struct uring_sender *u, size_t target,
+  unsigned int slot, size_t msglen, int *status)
+{
+  struct io_uring_sqe *sqe;
+  unsigned int tail, index;
+
+  while (u->queued == u->sq_entries || u->inflight == u->cq_entries)
+    if (reap_uring(u, status, 1) == -1)
+      return -1;
+
+  tail = *u->sq_tail;
+  index = tail & *u->sq_mask;
+  sqe = (struct io_uring_sqe *) u->sqes + index;
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  /* A write on a connected datagram socket is a send, and this one
+   * reads from the registered buffer through a registered file. */
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->fd = target;
+  sqe->addr = (unsigned long) (u->bufs + (size_t) slot * URING_SLOT);
+  sqe->len = msglen;
+  sqe->buf_index = 0;
+  /* The completion says which slot and target it was for. */
+  sqe->user_data = slot | (u_int64_t) target << 32;
+  u->sq_array[index] = index;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  u->queued++;
+  u->inflight++;
+  u->pending[slot]++;
+  u->targets[target].inflight++;
+  return 0;
+}
+
+/*
+ * Picks where a new subnet target goes: the next free slot of the
+ * file table or, once it is full, the slot of the subnet used longest
+ * ago, after waiting for any sends to it to complete.  The sockets
+ * shared with the broadcaster are never replaced.
+ *
+ * Returns the index or -1 on error, with errno set to ENFILE if
+ * those sockets fill the table.
+ */
+static int pick_uring_slot(struct uring_sender *u, int *status)
+{
+  size_t k, oldest;
+
+  if (u->count < URING_TARGETS)
+    return u->count;
+  if (u->flood == URING_TARGETS) {
+    errno = ENFILE;
+    return -1;
+  }
+  oldest = u->flood;
+  for (k = u->flood + 1; k < u->count; k++)
+    if (u->targets[k].used < u->targets[oldest].used)
+      oldest = k;
+  while (u->targets[oldest].inflight > 0)
+    if (reap_uring(u, status, 1) == -1)
+      return -1;
+
+  return oldest;
+}
+
+/*
+ * Opens a UDP socket connected to addr at u's port, sending out of
+ * interface ifindex, and adds it as a target.
+ *
+ * Returns the index of the target or -1 on error.
+ */
+static int add_uring_subnet(struct uring_sender *u,
+  const struct sockaddr_in *addr, int ifindex, int *status)
+{
+  struct sockaddr_in sin;
+  const int on = 1;
+  int fd, k, error;
+
+  k = pick_uring_slot(u, status);
+  if (k == -1)
+    return -1;
+  sin = *addr;
+  sin.sin_port = htons(u->port);
+  fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+#ifdef IP_UNICAST_IF
+  {
+    /* This one takes the index in network byte order. */
+    int index = htonl(ifindex);
+    setsockopt(fd, IPPROTO_IP, IP_UNICAST_IF, &index, sizeof(index));
+  }
+#endif
+  if (connect(fd, (struct sockaddr *) &sin, sizeof(sin)) == -1) {
+    error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+
+  return set_uring_target(u, k, &sin, ifindex, fd);
+}
+
+/*
+ * Finds the target for dest, adding it if no message has gone there
+ * lately.
+ *
+ * Returns the index of the target or -1 on error.
+ */
+static int find_uring_target(struct uring_sender *u,
+  const struct bcast_dest *dest, int *status)
+{
+  size_t k;
+
+  for (k = u->flood; k < u->count; k++)
+    if (u->targets[k].ifindex == dest->ifindex
+        && u->targets[k].addr.sin_addr.s_addr == dest->addr.sin_addr.s_addr) {
+      u->targets[k].used = ++u->clock;
+      return k;
+    }
+  return add_uring_subnet(u, &dest->addr, dest->ifindex, status);
+}
+
+/*
+ * Sends count messages of msglen bytes each, stored back to back in
+ * msgs, through the ring.  Each message is copied into a slot of the
+ * registered buffer and a write of it is queued for every broadcast
+ * address, or for dests[i] alone if that names an interface.  The
+ * queued writes go to the kernel in batches, and completions are
+ * taken in as they arrive rather than after every send, so sending
+ * only waits when it needs a slot back.
+ *
+ * results and the return value are as for broadcaster_send_directed,
+ * except that results is filled in on error, too, so that the caller
+ * can tell which messages went out.  Before returning on error, this
+ * waits for whatever is still in flight, so that the next call isn't
+ * handed completions from this one; if even that fails, u->inflight
+ * isn't 0 and the ring can't be used again.
+ */
+ssize_t uring_send_msgs(struct uring_sender *u, const char *msgs,
+  const size_t count, const size_t msglen, const struct bcast_dest *dests,
+  int *results)
+{
+  size_t i, k, sent = 0;
+  unsigned int slot;
+  int *status, target, error = 0;
+
+  if (msglen > URING_SLOT) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  status = results != NULL ? results : calloc(count ? count : 1,
+    sizeof(int));
+  if (status == NULL)
+    return -1;
+  for (i = 0; i < count; i++)
+    status[i] = ENETUNREACH;
+
+  for (i = 0; i < count && error == 0; i++) {
+    target = -1;
+    if (dests != NULL && dests[i].ifindex != 0) {
+      target = find_uring_target(u, &dests[i], status);
+      if (target == -1) {
+        status[i] = errno;
+        continue;
+      }
+    }
+    else if (u->flood == 0)
+      continue;
+
+    /* Wait for the slot's last message to finish going out. */
+    slot = u->next_slot;
+    while (u->pending[slot] > 0 && error == 0)
+      if (reap_uring(u, status, 1) == -1)
+        error = errno;
+    if (error)
+      break;
+    u->next_slot = (slot + 1) % URING_SLOTS;
+    memcpy(u->bufs + (size_t) slot * URING_SLOT, msgs + i * msglen, msglen);
+    u->owners[slot] = i;
+
+    if (target != -1) {
+      if (queue_uring_send(u, target, slot, msglen, status) == -1)
+        error = errno;
+    }
+    else
+      for (k = 0; k < u->flood && error == 0; k++)
+        if (queue_uring_send(u, k, slot, msglen, status) == -1)
+          error = errno;
+  }
+  while (u->inflight > 0 && error == 0)
+    if (reap_uring(u, status, u->inflight) == -1)
+      error = errno;
+  if (error)
+    while (u->inflight > 0 && reap_uring(u, status, u->inflight) == 0)
+      ;
+
+  for (i = 0; i < count; i++)
+    if (status[i] == 0)
+      sent++;
+  if (status != results)
+    free(status);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+
+  return sent;
+}
+
+/*
+ * Closes the ring and the sockets and frees the sender.  Closing the
+ * ring drops the registered buffer and files along with it.
+ */
+void close_uring_sender(struct uring_sender *u)
+{
+  size_t k;
+
+  if (u == NULL)
+    return;
+  if (u->sqes != NULL)
+    munmap(u->sqes, u->sqes_size);
+  if (u->cq_ring != NULL)
+    munmap(u->cq_ring, u->cq_ring_size);
+  if (u->sq_ring != NULL)
+    munmap(u->sq_ring, u->sq_ring_size);
+  if (u->ring_fd != -1)
+    close(u->ring_fd);
+  for (k = 0; k < u->count; k++)
+    close(u->targets[k].fd);
+  free(u->targets);
+  free(u->pending);
+  free(u->owners);
+  free(u->bufs);
+  free(u);
+}
+
+#else /* no io_uring */
+
+struct uring_sender *open_uring_sender(const struct broadcaster *b)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+ssize_t uring_send_msgs(struct uring_sender *u, const char *msgs,
+  const size_t count, const size_t msglen, const struct bcast_dest *dests,
+  int *results)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+void close_uring_sender(struct uring_sender *u)
+{
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef URING_INCL
+#define URING_INCL 1
+
+#include "broadcast.h"
+#include <sys/types.h>
+
+/* The longest message the ring sends; longer ones take the blocking
+ * path. */
+#define URING_SLOT 256
+
+/*
+ * One address that messages go to, through a UDP socket connected to
+ * it and registered with the ring as file index.  If ifindex isn't 0,
+ * the socket sends out of that interface only.  used says when a
+ * message last went there, and inflight how many sends to it have not
+ * completed, so that the one used longest ago can be replaced once
+ * the table is full.
+ */
+struct uring_target {
+  struct sockaddr_in addr;
+  int ifindex;
+  int fd;
+  unsigned long used;
+  unsigned int inflight;
+};
+
+/*
+ * An io_uring with the submission and completion queues mapped from
+ * the kernel, a registered buffer cut into slots of URING_SLOT bytes
+ * that messages are copied into, and a registered file table holding
+ * a socket for each target.  The first flood targets share the
+ * broadcaster's pool of sockets; the rest are added as directed
+ * messages need them, taking over the slot of the subnet used longest
+ * ago when the table is full.  owners and pending say which message
+ * each slot holds and how many sends of it have not completed yet.
+ */
+struct uring_sender {
+  int ring_fd;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  void *sqes;
+  size_t sqes_size;
+  void *cqes;
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  unsigned int sq_entries;
+  unsigned int cq_entries;
+  unsigned int queued;
+  unsigned int inflight;
+  char *bufs;
+  size_t *owners;
+  unsigned int *pending;
+  unsigned int next_slot;
+  struct uring_target *targets;
+  size_t count;
+  size_t flood;
+  unsigned long clock; /* counts messages sent to subnets */
+  u_int16_t port;
+};
+
+struct uring_sender *open_uring_sender(const struct broadcaster *b);
+
+ssize_t uring_send_msgs(struct uring_sender *u, const char *msgs,
+  const size_t count, const size_t msglen, const struct bcast_dest *dests,
+  int *results);
+
+void close_uring_sender(struct uring_sender *u);
+
+#endif
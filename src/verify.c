@@ -0,0 +1,895 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "verify.h"
+#include "netlink.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/ip_icmp.h>
+#endif
+#ifdef HAVE_LINUX_IF_PACKET_H
+#include <net/if_arp.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#endif
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+
+#define NSEC_PER_SEC 1000000000LL
+
+/* How long a probe has to be answered before the next one. */
+#define VERIFY_INTERVAL NSEC_PER_SEC
+
+/* How soon to try a probe again when the socket had no room for it. */
+#define VERIFY_RETRY (NSEC_PER_SEC / 10)
+
+/* How much send buffer to ask for per host.  Probes to hosts that are
+ * down wait in it for ARP to give up on them. */
+#define VERIFY_SNDBUF_PER_HOST 1024
+
+/* The most hosts woken again with one broadcaster_send_directed. */
+#define VERIFY_BATCH 1024
+
+/* The most events taken from epoll at once. */
+#define VERIFY_EVENTS 256
+
+/* The length of an ARP packet for IPv4 over Ethernet. */
+#define ARP_LEN 28
+
+/* What the epoll data of the timer and the probe socket hold; for a
+ * TCP connection, it is the host's index. */
+#define VERIFY_TIMER_TAG ((u_int64_t) -1)
+#define VERIFY_SOCK_TAG ((u_int64_t) -2)
+
+/* What a host is waiting for in the queue. */
+#define VERIFY_PROBE_EVENT 0
+#define VERIFY_WAKE_EVENT 1
+
+/*
+ * A probe or a wake waiting to go out.  The queue is a min-heap on
+ * due time, then on seq, as in the pacer.  Each host waiting for an
+ * answer has one of each queued.
+ */
+struct verify_event {
+  long long due; /* nanoseconds on the monotonic clock */
+  size_t seq;
+  size_t host;
+  int kind;
+};
+
+/* A host being probed. */
+struct verify_host {
+  u_int32_t ipaddr;
+  u_int32_t source; /* what to ask from, for ARP */
+  int ifindex; /* where to ask, for ARP */
+  int fd; /* the TCP connection being tried, or -1 */
+  long long backoff; /* how long until the next wake after this one */
+};
+
+/* Maps an address that answered back to its host. */
+struct verify_addr {
+  u_int32_t ipaddr;
+  size_t host;
+};
+
+/* The hardware address of an interface that ARP requests go out of. */
+struct verify_link {
+  int ifindex;
+  unsigned char hwaddr[6];
+};
+
+/* Everything one verify_wake run works with. */
+struct verify_ctx {
+  struct broadcaster *b;
+  const char *msgs;
+  size_t msglen;
+  const struct bcast_dest *dests;
+  const struct wake_verify *v;
+  struct verify_result *results;
+  struct verify_host *hosts;
+  size_t count;
+  struct verify_addr *addrs;
+  size_t naddrs;
+  struct verify_event *heap;
+  size_t nheap;
+  size_t seq;
+  struct verify_link *links;
+  size_t nlinks;
+  char *stage; /* hosts to wake again, VERIFY_BATCH at most */
+  struct bcast_dest *stage_dests;
+  size_t *staged;
+  int *status;
+  size_t nstage;
+  int epfd;
+  int tfd;
+  int sock; /* for ICMP or ARP */
+  int raw; /* whether ICMP replies come with their IP header */
+  u_int16_t ident;
+  u_int16_t ping_seq;
+  size_t waiting; /* hosts that haven't answered yet */
+  size_t connects; /* TCP connections being tried */
+  size_t max_connects;
+  long long start;
+};
+
+static long long verify_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int verify_event_before(const struct verify_event *a,
+  const struct verify_event *b)
+{
+  return a->due < b->due || (a->due == b->due && a->seq < b->seq);
+}
+
+static void push_verify_event(struct verify_ctx *ctx, size_t host, int kind,
+  long long due)
+{
+  struct verify_event ev;
+  size_t i = ctx->nheap++, parent;
+
+  ev.due = due;
+  ev.seq = ctx->seq++;
+  ev.host = host;
+  ev.kind = kind;
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (!verify_event_before(&ev, &ctx->heap[parent]))
+      break;
+    ctx->heap[i] = ctx->heap[parent];
+    i = parent;
+  }
+  ctx->heap[i] = ev;
+}
+
+static void pop_verify_event(struct verify_ctx *ctx, struct verify_event *ev)
+{
+  struct verify_event *heap = ctx->heap, last;
+  size_t i = 0, child, n;
+
+  *ev = heap[0];
+  last = heap[--ctx->nheap];
+  n = ctx->nheap;
+  for (;;) {
+    child = 2 * i + 1;
+    if (child >= n)
+      break;
+    if (child + 1 < n && verify_event_before(&heap[child + 1], &heap[child]))
+      child++;
+    if (!verify_event_before(&heap[child], &last))
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+}
+
+static int compare_verify_addrs(const void *a, const void *b)
+{
+  const struct verify_addr *x = a, *y = b;
+
+  if (x->ipaddr != y->ipaddr)
+    return x->ipaddr < y->ipaddr ? -1 : 1;
+  return x->host < y->host ? -1 : x->host > y->host;
+}
+
+/* Says whether host is still waiting for an answer. */
+static int verify_waiting(const struct verify_ctx *ctx, size_t host)
+{
+  return !ctx->results[host].up && ctx->results[host].error == 0
+    && ctx->hosts[host].ipaddr != 0;
+}
+
+/* Gives up on the TCP connection being tried for host, if any. */
+static void drop_verify_connect(struct verify_ctx *ctx, size_t host)
+{
+  if (ctx->hosts[host].fd == -1)
+    return;
+  close(ctx->hosts[host].fd);
+  ctx->hosts[host].fd = -1;
+  ctx->connects--;
+}
+
+/* Records that host answered at now. */
+static void mark_verify_up(struct verify_ctx *ctx, size_t host, long long now)
+{
+  if (!verify_waiting(ctx, host))
+    return;
+  ctx->results[host].up = 1;
+  ctx->results[host].seconds = (double) (now - ctx->start) / NSEC_PER_SEC;
+  drop_verify_connect(ctx, host);
+  ctx->waiting--;
+}
+
+/* Records that something answered from ipaddr, which is every host
+ * with that address. */
+static void mark_verify_addr_up(struct verify_ctx *ctx, u_int32_t ipaddr,
+  long long now)
+{
+  size_t lo = 0, hi = ctx->naddrs, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (ctx->addrs[mid].ipaddr < ipaddr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (; lo < ctx->naddrs && ctx->addrs[lo].ipaddr == ipaddr; lo++)
+    mark_verify_up(ctx, ctx->addrs[lo].host, now);
+}
+
+/* The Internet checksum of len bytes at data. */
+static u_int16_t icmp_checksum(const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  u_int32_t sum = 0;
+
+  for (; len > 1; len -= 2, p += 2)
+    sum += (p[0] << 8) | p[1];
+  if (len)
+    sum += p[0] << 8;
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return htons(~sum & 0xFFFF);
+}
+
+/*
+ * Makes the probe socket's send buffer big enough for a probe to every
+ * host, going past the system's limit if we are allowed to.
+ */
+static void grow_verify_sndbuf(struct verify_ctx *ctx)
+{
+  int size = ctx->count < 1024 * 1024 ? ctx->count * VERIFY_SNDBUF_PER_HOST
+    : 1024 * 1024 * VERIFY_SNDBUF_PER_HOST;
+
+#ifdef SO_SNDBUFFORCE
+  if (setsockopt(ctx->sock, SOL_SOCKET, SO_SNDBUFFORCE, &size,
+        sizeof(size)) == 0)
+    return;
+#endif
+  setsockopt(ctx->sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+}
+
+/*
+ * Opens the socket for ICMP probes: a ping socket if the system lets
+ * us have one, which needs no privileges, and a raw socket if not.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int open_icmp_probe(struct verify_ctx *ctx)
+{
+  ctx->sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+    IPPROTO_ICMP);
+  if (ctx->sock == -1) {
+    ctx->sock = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+      IPPROTO_ICMP);
+    ctx->raw = 1;
+  }
+  ctx->ident = getpid() & 0xFFFF;
+  if (ctx->sock == -1)
+    return -1;
+  grow_verify_sndbuf(ctx);
+  return 0;
+}
+
+/* Sends host a ping.  Returns -1, with errno set, if it couldn't go. */
+static int send_icmp_probe(struct verify_ctx *ctx, size_t host)
+{
+  struct sockaddr_in sin;
+  struct {
+    struct icmphdr hdr;
+    char data[8];
+  } ping;
+
+  memset(&ping, 0, sizeof(ping));
+  ping.hdr.type = ICMP_ECHO;
+  ping.hdr.un.echo.id = htons(ctx->ident);
+  ping.hdr.un.echo.sequence = htons(ctx->ping_seq++);
+  memcpy(ping.data, "wake-up!", 8);
+  ping.hdr.checksum = icmp_checksum(&ping, sizeof(ping));
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = ctx->hosts[host].ipaddr;
+  return sendto(ctx->sock, &ping, sizeof(ping), 0, (struct sockaddr *) &sin,
+    sizeof(sin)) == -1 ? -1 : 0;
+}
+
+/* Reads every ICMP message waiting and marks the hosts whose echo
+ * replies are among them. */
+static void read_icmp_replies(struct verify_ctx *ctx, long long now)
+{
+  unsigned char buf[512];
+  struct sockaddr_in from;
+  socklen_t fromlen;
+  struct icmphdr *icmp;
+  ssize_t len;
+  size_t off;
+
+  for (;;) {
+    fromlen = sizeof(from);
+    len = recvfrom(ctx->sock, buf, sizeof(buf), 0, (struct sockaddr *) &from,
+      &fromlen);
+    if (len == -1) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    /* Raw sockets hand us the IP header as well. */
+    off = ctx->raw ? (buf[0] & 0x0F) * 4 : 0;
+    if (len < (ssize_t) (off + sizeof(struct icmphdr)))
+      continue;
+    icmp = (struct icmphdr *) (buf + off);
+    if (icmp->type != ICMP_ECHOREPLY)
+      continue;
+    if (ctx->raw && icmp->un.echo.id != htons(ctx->ident))
+      continue;
+    mark_verify_addr_up(ctx, from.sin_addr.s_addr, now);
+  }
+}
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+
+/*
+ * Finds the hardware address of interface ifindex, looking it up the
+ * first time it is asked for.
+ *
+ * Returns the link or NULL on error.
+ */
+static struct verify_link *find_verify_link(struct verify_ctx *ctx,
+  int ifindex)
+{
+  struct verify_link *link;
+  struct ifreq ifr;
+  size_t k;
+  void *t;
+
+  for (k = 0; k < ctx->nlinks; k++)
+    if (ctx->links[k].ifindex == ifindex)
+      return &ctx->links[k];
+
+  memset(&ifr, 0, sizeof(ifr));
+  if (if_indextoname(ifindex, ifr.ifr_name) == NULL
+      || ioctl(ctx->sock, SIOCGIFHWADDR, &ifr) == -1)
+    return NULL;
+  if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+    errno = EAFNOSUPPORT;
+    return NULL;
+  }
+  t = realloc(ctx->links, (ctx->nlinks + 1) * sizeof(struct verify_link));
+  if (t == NULL)
+    return NULL;
+  ctx->links = t;
+  link = &ctx->links[ctx->nlinks++];
+  link->ifindex = ifindex;
+  memcpy(link->hwaddr, ifr.ifr_hwaddr.sa_data, 6);
+  return link;
+}
+
+/*
+ * Opens a packet socket for ARP and works out, from the routes, which
+ * interface and address to ask for each host from.  A host that isn't
+ * on a subnet we are on can't be asked, and gets an error instead.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int open_arp_probe(struct verify_ctx *ctx)
+{
+  struct route_table *rt;
+  const struct route_entry *route;
+  struct verify_host *h;
+  size_t i, k;
+  u_int32_t mask;
+
+  ctx->sock = socket(AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+    htons(ETH_P_ARP));
+  if (ctx->sock == -1)
+    return -1;
+  grow_verify_sndbuf(ctx);
+  rt = load_route_table();
+  if (rt == NULL)
+    return -1;
+
+  for (i = 0; i < ctx->count; i++) {
+    h = &ctx->hosts[i];
+    if (h->ipaddr == 0)
+      continue;
+    route = find_route(rt, h->ipaddr);
+    if (route == NULL || route->gateway != 0) {
+      ctx->results[i].error = ENETUNREACH;
+      continue;
+    }
+    h->ifindex = route->oif;
+    /* Ask from an address on the host's subnet if the interface has
+     * one, and from any of its addresses if not. */
+    for (k = 0; k < rt->naddrs; k++) {
+      if (rt->addrs[k].ifindex != h->ifindex)
+        continue;
+      mask = rt->addrs[k].prefix == 0 ? 0
+        : htonl(0xFFFFFFFFU << (32 - rt->addrs[k].prefix));
+      if (h->source == 0
+          || (rt->addrs[k].local & mask) == (h->ipaddr & mask))
+        h->source = rt->addrs[k].local;
+    }
+    if (h->source == 0 || find_verify_link(ctx, h->ifindex) == NULL)
+      ctx->results[i].error = h->source == 0 ? EADDRNOTAVAIL : errno;
+  }
+
+  free_route_table(rt);
+  return 0;
+}
+
+/* Asks who has host's address.  Returns -1, with errno set, if the
+ * request couldn't go. */
+static int send_arp_probe(struct verify_ctx *ctx, size_t host)
+{
+  const struct verify_host *h = &ctx->hosts[host];
+  const struct verify_link *link = find_verify_link(ctx, h->ifindex);
+  unsigned char arp[ARP_LEN];
+  struct sockaddr_ll sll;
+
+  if (link == NULL)
+    return -1;
+  /* Ethernet and IPv4, a request, from us to the host. */
+  arp[0] = ARPHRD_ETHER >> 8;
+  arp[1] = ARPHRD_ETHER & 0xFF;
+  arp[2] = ETH_P_IP >> 8;
+  arp[3] = ETH_P_IP & 0xFF;
+  arp[4] = 6;
+  arp[5] = 4;
+  arp[6] = ARPOP_REQUEST >> 8;
+  arp[7] = ARPOP_REQUEST & 0xFF;
+  memcpy(arp + 8, link->hwaddr, 6);
+  memcpy(arp + 14, &h->source, 4);
+  memset(arp + 18, 0, 6);
+  memcpy(arp + 24, &h->ipaddr, 4);
+
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons(ETH_P_ARP);
+  sll.sll_ifindex = h->ifindex;
+  sll.sll_halen = 6;
+  memset(sll.sll_addr, 0xFF, 6);
+  return sendto(ctx->sock, arp, sizeof(arp), 0, (struct sockaddr *) &sll,
+    sizeof(sll)) == -1 ? -1 : 0;
+}
+
+/* Reads every ARP packet waiting.  A reply from a host is an answer,
+ * and so is a request it makes, which a machine that has just come up
+ * often does to announce itself. */
+static void read_arp_replies(struct verify_ctx *ctx, long long now)
+{
+  unsigned char buf[256];
+  u_int32_t sender;
+  ssize_t len;
+
+  for (;;) {
+    len = recv(ctx->sock, buf, sizeof(buf), 0);
+    if (len == -1) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (len < ARP_LEN || buf[4] != 6 || buf[5] != 4)
+      continue;
+    memcpy(&sender, buf + 14, 4);
+    mark_verify_addr_up(ctx, sender, now);
+  }
+}
+
+#else /* no packet sockets */
+
+static int open_arp_probe(struct verify_ctx *ctx)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+static int send_arp_probe(struct verify_ctx *ctx, size_t host)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+static void read_arp_replies(struct verify_ctx *ctx, long long now)
+{
+}
+
+#endif
+
+/*
+ * Starts a TCP connection to host on the chosen port, first giving up
+ * on the one from the last probe if it is still being tried.  Either
+ * a connection or a refusal means the host is up.  Probes are skipped
+ * while there are as many connections being tried as we have room
+ * for.
+ */
+static void send_tcp_probe(struct verify_ctx *ctx, size_t host, long long now)
+{
+  struct verify_host *h = &ctx->hosts[host];
+  struct sockaddr_in sin;
+  struct epoll_event ev;
+
+  drop_verify_connect(ctx, host);
+  if (ctx->connects >= ctx->max_connects)
+    return;
+  h->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (h->fd == -1)
+    return;
+  ctx->connects++;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(ctx->v->port);
+  sin.sin_addr.s_addr = h->ipaddr;
+  if (connect(h->fd, (struct sockaddr *) &sin, sizeof(sin)) == 0
+      || errno == ECONNREFUSED) {
+    mark_verify_up(ctx, host, now);
+    return;
+  }
+  if (errno != EINPROGRESS) {
+    drop_verify_connect(ctx, host);
+    return;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLOUT;
+  ev.data.u64 = host;
+  if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, h->fd, &ev) == -1)
+    drop_verify_connect(ctx, host);
+}
+
+/* Sees how the TCP connection being tried for host went. */
+static void check_tcp_probe(struct verify_ctx *ctx, size_t host, long long now)
+{
+  int error = 0;
+  socklen_t len = sizeof(error);
+
+  if (host >= ctx->count || ctx->hosts[host].fd == -1)
+    return;
+  if (getsockopt(ctx->hosts[host].fd, SOL_SOCKET, SO_ERROR, &error, &len)
+      == -1)
+    error = errno;
+  if (error == 0 || error == ECONNREFUSED)
+    mark_verify_up(ctx, host, now);
+  else if (error != EINPROGRESS)
+    drop_verify_connect(ctx, host);
+}
+
+/* Wakes every host staged to be woken again, in one batch. */
+static void flush_verify_wakes(struct verify_ctx *ctx)
+{
+  size_t i;
+
+  if (ctx->nstage == 0)
+    return;
+  if (broadcaster_send_directed(ctx->b, ctx->stage, ctx->nstage,
+        ctx->msglen, ctx->dests != NULL ? ctx->stage_dests : NULL,
+        ctx->status) != -1)
+    for (i = 0; i < ctx->nstage; i++)
+      if (ctx->status[i] == 0)
+        ctx->results[ctx->staged[i]].wakes++;
+  ctx->nstage = 0;
+}
+
+/* Puts host in the next batch to be woken again. */
+static void stage_verify_wake(struct verify_ctx *ctx, size_t host)
+{
+  if (ctx->nstage == VERIFY_BATCH)
+    flush_verify_wakes(ctx);
+  memcpy(ctx->stage + ctx->nstage * ctx->msglen,
+    ctx->msgs + host * ctx->msglen, ctx->msglen);
+  if (ctx->dests != NULL)
+    ctx->stage_dests[ctx->nstage] = ctx->dests[host];
+  ctx->staged[ctx->nstage++] = host;
+}
+
+/* Sends every probe and wake that is due by now. */
+static void run_verify_events(struct verify_ctx *ctx, long long now)
+{
+  struct verify_event ev;
+  struct verify_host *h;
+  int sent;
+
+  while (ctx->nheap > 0 && ctx->heap[0].due <= now) {
+    pop_verify_event(ctx, &ev);
+    /* Hosts that have answered leave their events behind. */
+    if (!verify_waiting(ctx, ev.host))
+      continue;
+    h = &ctx->hosts[ev.host];
+    if (ev.kind == VERIFY_WAKE_EVENT) {
+      stage_verify_wake(ctx, ev.host);
+      push_verify_event(ctx, ev.host, VERIFY_WAKE_EVENT, now + h->backoff);
+      h->backoff *= 2;
+      continue;
+    }
+    switch (ctx->v->probe) {
+    case VERIFY_ICMP:
+      sent = send_icmp_probe(ctx, ev.host);
+      break;
+    case VERIFY_ARP:
+      sent = send_arp_probe(ctx, ev.host);
+      break;
+    default:
+      sent = 0;
+      send_tcp_probe(ctx, ev.host, now);
+    }
+    /* A probe that found no room goes again soon; any other failure
+     * waits for the next round like a probe that wasn't answered. */
+    push_verify_event(ctx, ev.host, VERIFY_PROBE_EVENT, now
+      + (sent == -1 && (errno == EAGAIN || errno == ENOBUFS) ? VERIFY_RETRY
+        : VERIFY_INTERVAL));
+  }
+  flush_verify_wakes(ctx);
+}
+
+/* Arms the timer to go off at when, on the monotonic clock. */
+static int set_verify_timer(struct verify_ctx *ctx, long long when)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = when / NSEC_PER_SEC;
+  its.it_value.tv_nsec = when % NSEC_PER_SEC;
+  /* Zero would disarm it. */
+  if (when <= 0)
+    its.it_value.tv_nsec = 1;
+  return timerfd_settime(ctx->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Makes room for as many TCP connections as the file limit allows,
+ * keeping some descriptors back for everything else. */
+static size_t verify_connect_room(void)
+{
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+    return 64;
+  if (rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+      getrlimit(RLIMIT_NOFILE, &rl);
+  }
+  if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > 65536)
+    return 65536;
+  return rl.rlim_cur > 128 ? rl.rlim_cur - 64 : 64;
+}
+
+/*
+ * Finds out which of the count hosts that were just woken with msgs,
+ * msglen bytes each and sent to dests as for broadcaster_send_directed,
+ * actually come up.  Host i is probed at ipaddrs[i], as v says; hosts
+ * with no address can't be, and their results say EDESTADDRREQ.  Hosts
+ * that don't answer are woken again through b with exponential
+ * backoff until they do or the time runs out.
+ *
+ * Everything is driven by one epoll loop: the probes share one socket,
+ * or have one each for TCP, the replies come in as they arrive, and a
+ * timer fd goes off when the next probe or wake is due.  So thousands
+ * of hosts can be waited on at once without a thread for each.
+ *
+ * results must have room for count of them, which are filled in.
+ *
+ * Returns the number of hosts that came up or -1 on error.
+ */
+ssize_t
+verify_wake(struct broadcaster *b, const char *msgs, const size_t count,
+  const size_t msglen, const struct bcast_dest *dests,
+  const u_int32_t *ipaddrs, const struct wake_verify *v,
+  struct verify_result *results)
+{
+  struct verify_ctx ctx;
+  struct epoll_event ev, events[VERIFY_EVENTS];
+  long long now, deadline, when;
+  u_int64_t expirations;
+  ssize_t up = 0;
+  size_t i;
+  int n, k, error = 0;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.b = b;
+  ctx.msgs = msgs;
+  ctx.msglen = msglen;
+  ctx.dests = dests;
+  ctx.v = v;
+  ctx.results = results;
+  ctx.count = count;
+  ctx.epfd = ctx.tfd = ctx.sock = -1;
+  ctx.start = verify_now();
+  deadline = ctx.start + v->timeout * NSEC_PER_SEC;
+
+  ctx.hosts = calloc(count ? count : 1, sizeof(struct verify_host));
+  ctx.addrs = calloc(count ? count : 1, sizeof(struct verify_addr));
+  ctx.heap = calloc(count ? 2 * count : 1, sizeof(struct verify_event));
+  ctx.stage = malloc(VERIFY_BATCH * msglen);
+  ctx.stage_dests = calloc(VERIFY_BATCH, sizeof(struct bcast_dest));
+  ctx.staged = calloc(VERIFY_BATCH, sizeof(size_t));
+  ctx.status = calloc(VERIFY_BATCH, sizeof(int));
+  if (ctx.hosts == NULL || ctx.addrs == NULL || ctx.heap == NULL
+      || ctx.stage == NULL || ctx.stage_dests == NULL || ctx.staged == NULL
+      || ctx.status == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  for (i = 0; i < count; i++) {
+    memset(&results[i], 0, sizeof(struct verify_result));
+    results[i].wakes = 1;
+    ctx.hosts[i].ipaddr = ipaddrs[i];
+    ctx.hosts[i].fd = -1;
+    ctx.hosts[i].backoff = 4LL * v->delay * NSEC_PER_SEC;
+    if (ipaddrs[i] == 0)
+      results[i].error = EDESTADDRREQ;
+  }
+
+  switch (v->probe) {
+  case VERIFY_ICMP:
+    if (open_icmp_probe(&ctx) == -1) {
+      error = errno;
+      goto CLEAN_UP;
+    }
+    break;
+  case VERIFY_ARP:
+    if (open_arp_probe(&ctx) == -1) {
+      error = errno;
+      goto CLEAN_UP;
+    }
+    break;
+  case VERIFY_TCP:
+    ctx.max_connects = verify_connect_room();
+    break;
+  default:
+    error = EINVAL;
+    goto CLEAN_UP;
+  }
+
+  ctx.epfd = epoll_create1(EPOLL_CLOEXEC);
+  ctx.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (ctx.epfd == -1 || ctx.tfd == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = VERIFY_TIMER_TAG;
+  if (epoll_ctl(ctx.epfd, EPOLL_CTL_ADD, ctx.tfd, &ev) == -1) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  if (ctx.sock != -1) {
+    ev.data.u64 = VERIFY_SOCK_TAG;
+    if (epoll_ctl(ctx.epfd, EPOLL_CTL_ADD, ctx.sock, &ev) == -1) {
+      error = errno;
+      goto CLEAN_UP;
+    }
+  }
+
+  /* Probe everyone after the delay, and wake them again after twice
+   * that, unless they have answered. */
+  for (i = 0; i < count; i++) {
+    if (!verify_waiting(&ctx, i))
+      continue;
+    ctx.addrs[ctx.naddrs].ipaddr = ipaddrs[i];
+    ctx.addrs[ctx.naddrs++].host = i;
+    push_verify_event(&ctx, i, VERIFY_PROBE_EVENT,
+      ctx.start + v->delay * NSEC_PER_SEC);
+    push_verify_event(&ctx, i, VERIFY_WAKE_EVENT,
+      ctx.start + 2LL * v->delay * NSEC_PER_SEC);
+    ctx.waiting++;
+  }
+  qsort(ctx.addrs, ctx.naddrs, sizeof(struct verify_addr),
+    compare_verify_addrs);
+
+  while (ctx.waiting > 0) {
+    now = verify_now();
+    if (now >= deadline)
+      break;
+    run_verify_events(&ctx, now);
+    if (ctx.waiting == 0)
+      break;
+
+    when = ctx.nheap > 0 && ctx.heap[0].due < deadline ? ctx.heap[0].due
+      : deadline;
+    if (set_verify_timer(&ctx, when) == -1) {
+      error = errno;
+      goto CLEAN_UP;
+    }
+    n = epoll_wait(ctx.epfd, events, VERIFY_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      error = errno;
+      goto CLEAN_UP;
+    }
+    now = verify_now();
+    for (k = 0; k < n; k++) {
+      if (events[k].data.u64 == VERIFY_TIMER_TAG) {
+        while (read(ctx.tfd, &expirations, sizeof(expirations)) == -1
+            && errno == EINTR)
+          ;
+      }
+      else if (events[k].data.u64 == VERIFY_SOCK_TAG) {
+        if (v->probe == VERIFY_ARP)
+          read_arp_replies(&ctx, now);
+        else
+          read_icmp_replies(&ctx, now);
+      }
+      else
+        check_tcp_probe(&ctx, events[k].data.u64, now);
+    }
+  }
+
+  for (i = 0; i < count; i++)
+    if (results[i].up)
+      up++;
+
+CLEAN_UP:
+  if (ctx.connects > 0)
+    for (i = 0; i < count; i++)
+      if (ctx.hosts[i].fd != -1)
+        close(ctx.hosts[i].fd);
+  if (ctx.sock != -1)
+    close(ctx.sock);
+  if (ctx.tfd != -1)
+    close(ctx.tfd);
+  if (ctx.epfd != -1)
+    close(ctx.epfd);
+  free(ctx.hosts);
+  free(ctx.addrs);
+  free(ctx.heap);
+  free(ctx.links);
+  free(ctx.stage);
+  free(ctx.stage_dests);
+  free(ctx.staged);
+  free(ctx.status);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+
+  return up;
+}
+
+#else /* no epoll or timer fd */
+
+ssize_t
+verify_wake(struct broadcaster *b, const char *msgs, const size_t count,
+  const size_t msglen, const struct bcast_dest *dests,
+  const u_int32_t *ipaddrs, const struct wake_verify *v,
+  struct verify_result *results)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
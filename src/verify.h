@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef VERIFY_INCL
+#define VERIFY_INCL 1
+
+#include "broadcast.h"
+#include <sys/types.h>
+
+/* How to tell that a host is up: it answers a ping, an ARP request
+ * or a TCP connection. */
+#define VERIFY_ICMP 0
+#define VERIFY_ARP 1
+#define VERIFY_TCP 2
+
+/*
+ * How to verify a run of wakes.  Hosts are probed with probe, once a
+ * second, starting delay seconds, at least 1, after the wake.  A host
+ * that hasn't answered is woken again 2 * delay seconds after the
+ * first wake, and then after twice as long each time, until timeout
+ * seconds have gone by.
+ */
+struct wake_verify {
+  int probe;
+  u_int16_t port; /* for VERIFY_TCP */
+  unsigned int delay;
+  unsigned int timeout;
+};
+
+/* How one host did. */
+struct verify_result {
+  int up;
+  double seconds; /* from the first wake until it answered */
+  unsigned int wakes; /* how many times it was woken in all */
+  int error; /* why it couldn't be probed, or 0 */
+};
+
+ssize_t
+verify_wake(struct broadcaster *b, const char *msgs, const size_t count,
+  const size_t msglen, const struct bcast_dest *dests,
+  const u_int32_t *ipaddrs, const struct wake_verify *v,
+  struct verify_result *results);
+
+#endif
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2012,2016 Jason J.A. Stephenson <jason@sigio.com>
+ * Copyright © 2012,2016,2026 Jason J.A. Stephenson <jason@sigio.com>
  *
  * This file is part of wake.
  *
@@ -17,70 +17,1108 @@
  * along with wake.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "hostinfo.h"
-#include "list.h"
+#include "hostsmap.h"
+#include "hostsdb.h"
+#include "hostsshm.h"
+#include "hosttable.h"
+#include "hostreload.h"
+#include "inventory.h"
 #include "broadcast.h"
 #include "build_msg.h"
+#include "daemon.h"
+#include "pacer.h"
+#include "netlink.h"
+#include "verify.h"
+#include "mcast6.h"
+#include "relay.h"
+#include "maccache.h"
+#include "list.h"
 
 #include <sys/types.h>
-#include <regex.h>
+#include <getopt.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
 
-int main(int argc, char *argv[])
+/* Up to this many hosts, scan wake.hosts for them rather than
+ * indexing the whole file. */
+#define STREAM_MAX_HOSTS 16
+
+/* How many times, and how many milliseconds apart, to look again for
+ * a copy of wake.hosts that another wake is publishing before parsing
+ * the file here. */
+#define SHM_WAIT_TRIES 50
+#define SHM_WAIT_MS 20
+
+/* The routes, loaded the first time a host with an address needs them. */
+static struct route_table *routes;
+static int routes_loaded;
+
+static struct option long_options[] = {
+  {"compile", no_argument, NULL, 'c'},
+  {"list", no_argument, NULL, 'l'},
+  {"shm", no_argument, NULL, 'S'},
+  {"file", required_argument, NULL, 'f'},
+  {"format", required_argument, NULL, 'F'},
+  {"daemon", optional_argument, NULL, 'd'},
+  {"relay", optional_argument, NULL, 'R'},
+  {"window", required_argument, NULL, 'W'},
+  {"interval", required_argument, NULL, 'i'},
+  {"rate", required_argument, NULL, 'r'},
+  {"burst", required_argument, NULL, 'b'},
+  {"repeat", required_argument, NULL, 'n'},
+  {"jitter", required_argument, NULL, 'j'},
+  {"transport", required_argument, NULL, 't'},
+  {"group", required_argument, NULL, 'g'},
+  {"suppress", required_argument, NULL, 's'},
+  {"verify", optional_argument, NULL, 'V'},
+  {"wait", required_argument, NULL, 'w'},
+  {"timeout", required_argument, NULL, 'T'},
+  {"help", no_argument, NULL, 'h'},
+  {NULL, 0, NULL, 0}
+};
+
+static void usage(FILE *out)
+{
+  fprintf(out,
+    "usage: wake [-c] [-l] [-S] [-f FILE] [-F FORMAT] [-d[SOCKET]]\n"
+    "            [-R[PORT]] [-W MS] [-i MS] [-r RATE] [-b BURST] [-n COUNT]\n"
+    "            [-j MS] [-t udp|raw|uring|ipv6] [-g GROUP] [-s SECS]\n"
+    "            [-V[PROBE]] [-w SECS] [-T SECS]\n"
+    "            [host | pattern | @tag[&@tag...] ...]\n"
+    "  -c, --compile           compile wake.hosts into wake.hosts.db, exit\n"
+    "  -l, --list              print the hosts sorted by name and exit\n"
+    "  -S, --shm               look hosts up in a copy of wake.hosts shared\n"
+    "                          with other wake processes, making it if\n"
+    "                          it is missing or out of date\n"
+    "  -f, --file=FILE         read the hosts from FILE, not wake.hosts\n"
+    "  -F, --format=FORMAT     FILE is in FORMAT: hosts, ethers, csv or\n"
+    "                          json (default: guessed from its name)\n"
+    "  -d, --daemon[=SOCKET]   serve wake requests on a UNIX socket\n"
+    "                          (default " WAKE_DAEMON_SOCKET ")\n"
+    "  -R, --relay[=PORT]      send on the wakes asked for over UDP or TCP\n"
+    "                          at PORT (default %u)\n"
+    "  -W, --window=MS         relay a mac address at most once in MS\n"
+    "                          milliseconds (default 1000)\n"
+    "  -i, --interval=MS       relay wakes together, at most MS\n"
+    "                          milliseconds after they arrive (default 10)\n"
+    "  -r, --rate=RATE         send at most RATE packets a second\n"
+    "  -b, --burst=BURST       but allow BURST at once (default 1)\n"
+    "  -n, --repeat=COUNT      send each host COUNT packets (default 1)\n"
+    "  -j, --jitter=MS         wait up to MS more milliseconds at random\n"
+    "                          before each repeat\n"
+    "  -t, --transport=udp|raw|uring|ipv6\n"
+    "                          send UDP datagrams (the default), raw\n"
+    "                          Ethernet frames, which needs CAP_NET_RAW,\n"
+    "                          UDP datagrams through an io_uring, or\n"
+    "                          UDP datagrams to an IPv6 multicast group\n"
+    "  -g, --group=GROUP       send to IPv6 multicast GROUP instead of\n"
+    "                          " MCAST6_GROUP "; implies -t ipv6\n"
+    "  -s, --suppress=SECS     skip hosts that any wake on this machine\n"
+    "                          woke in the last SECS seconds\n"
+    "  -V, --verify[=PROBE]    check that the hosts come up, with PROBE\n"
+    "                          icmp (the default), arp or tcp:PORT, and\n"
+    "                          wake the ones that don't again\n"
+    "  -w, --wait=SECS         start checking SECS seconds after the wake\n"
+    "                          (default 30)\n"
+    "  -T, --timeout=SECS      stop checking after SECS seconds\n"
+    "                          (default 300)\n"
+    "  -h, --help              print this message and exit\n",
+    WAKE_RELAY_PORT);
+}
+
+/*
+ * Loads the hosts from hostsfname, in the given format, into a host
+ * table.  If report is set and the file is not in the wake.hosts
+ * format, it also says how many rows it read, and how fast.
+ *
+ * Returns the table or NULL with errno set on error.
+ */
+static struct host_table *load_hosts(char *hostsfname, int format,
+  int report)
+{
+  struct inventory_stats stats;
+  struct host_table *table;
+
+  if (format == INVENTORY_HOSTS)
+    return load_host_table(hostsfname);
+  table = load_inventory(hostsfname, format, &stats);
+  if (table != NULL && report) {
+    printf("Read %lu rows from %s in %.3f seconds", stats.rows, hostsfname,
+      stats.seconds);
+    if (stats.seconds > 0)
+      printf(" (%.0f rows/sec)", stats.rows / stats.seconds);
+    if (stats.skipped > 0)
+      printf(", skipped %lu", stats.skipped);
+    printf("\n");
+  }
+
+  return table;
+}
+
+/*
+ * Compiles the hosts file at hostsfname, in the given format, into
+ * hostsfname.db.
+ *
+ * Returns 0 on success or an errno value on failure.
+ */
+static int compile_wake_hosts(char *hostsfname, int format)
+{
+  struct hosts_map *map = NULL;
+  struct host_table *table = NULL;
+  char *dbpath;
+  int count, rv = 0;
+
+  dbpath = malloc(strlen(hostsfname) + 4);
+  if (dbpath == NULL)
+    goto FAILED;
+  if (format == INVENTORY_HOSTS)
+    map = map_wake_hosts_file(hostsfname);
+  else
+    table = load_hosts(hostsfname, format, 1);
+  if (map == NULL && table == NULL)
+    goto FAILED;
+  sprintf(dbpath, "%s.db", hostsfname);
+
+  count = map != NULL ? compile_hosts_db(map, dbpath)
+    : compile_host_table(table, dbpath);
+  if (count == -1) {
+    rv = errno;
+    fprintf(stderr, "Can't compile %s: %s\n", dbpath, strerror(rv));
+  }
+  else
+    printf("Compiled %d hosts into %s\n", count, dbpath);
+  goto CLEAN_UP;
+
+FAILED:
+  rv = errno;
+  fprintf(stderr, "Can't parse file %s: %s\n", hostsfname, strerror(rv));
+
+CLEAN_UP:
+  unmap_wake_hosts_file(map);
+  free_host_table(table);
+  free(dbpath);
+
+  return rv;
+}
+
+/*
+ * Attaches to the copy of the wake.hosts file at hostsfname in shared
+ * memory, publishing one first if there is none, the file has changed
+ * since it was made or the wake that was making it died.  If another
+ * wake is publishing it, that one is waited for, for a while.
+ *
+ * Returns the database or NULL with errno set on error.
+ */
+static struct hosts_db *open_shared_hosts(char *hostsfname)
+{
+  const struct timespec pause = {0, SHM_WAIT_MS * 1000000L};
+  struct hosts_db *db;
+  int tries;
+
+  for (tries = 0; ; tries++) {
+    db = attach_hosts_shm(hostsfname);
+    if (db == NULL) {
+#ifdef DEBUG
+      if (errno != EAGAIN)
+        fprintf(stderr, "Publishing %s: %s\n", hostsfname,
+          strerror(errno));
+#endif
+      db = publish_hosts_shm(hostsfname);
+    }
+    if (db != NULL || errno != EAGAIN || tries == SHM_WAIT_TRIES)
+      break;
+    nanosleep(&pause, NULL);
+  }
+
+  return db;
+}
+
+/*
+ * Reads a whole number of at least min from the argument of option
+ * name, complaining if it isn't one.
+ *
+ * Returns 0 on success or EINVAL.
+ */
+static int parse_count_arg(const char *arg, const char *name,
+  unsigned long min, unsigned int *value)
+{
+  unsigned long n;
+  char *end;
+
+  errno = 0;
+  n = strtoul(arg, &end, 10);
+  if (errno != 0 || end == arg || *end != 0 || arg[0] == '-' || n < min
+      || n > (unsigned int) -1) {
+    fprintf(stderr, "Invalid --%s: %s\n", name, arg);
+    return EINVAL;
+  }
+  *value = n;
+  return 0;
+}
+
+/*
+ * Sends the nhosts packets in magic through b, to dests, at the pace
+ * given and tells the user how close it came to the rate asked for.
+ *
+ * Returns the number of packets sent or -1 on error.
+ */
+static ssize_t send_paced(struct broadcaster *b, const char *magic,
+  size_t nhosts, const struct bcast_dest *dests, int *results,
+  const struct wake_pace *pace)
+{
+  struct pace_report report;
+  ssize_t sent;
+
+  sent = paced_send_msgs(b, magic, nhosts, MAGIC_PACKET_LEN, dests, results,
+    pace, &report);
+
+  if (sent != -1) {
+    /* Packets after the first show the rate over the time taken. */
+    printf("Sent %lu packets in %.3f seconds", (unsigned long) report.packets,
+      report.seconds);
+    if (report.packets > 1 && report.seconds > 0)
+      printf(", %.1f per second", (report.packets - 1) / report.seconds);
+    if (pace->rate > 0)
+      printf(" (target %.1f)", pace->rate);
+    printf("\n");
+  }
+
+  return sent;
+}
+
+/*
+ * Reads the argument of --verify: icmp, arp or tcp:PORT, or tcp alone
+ * for the ssh port.
+ *
+ * Returns 0 on success or EINVAL.
+ */
+static int parse_verify_arg(const char *arg, struct wake_verify *v)
+{
+  unsigned int port = 22;
+
+  if (arg == NULL || strcmp(arg, "icmp") == 0)
+    v->probe = VERIFY_ICMP;
+  else if (strcmp(arg, "arp") == 0)
+    v->probe = VERIFY_ARP;
+  else if (strncmp(arg, "tcp", 3) == 0 && (arg[3] == 0 || arg[3] == ':')) {
+    if (arg[3] == ':' && parse_count_arg(arg + 4, "verify", 1, &port))
+      return EINVAL;
+    if (port > 65535) {
+      fprintf(stderr, "Invalid --verify: %s\n", arg);
+      return EINVAL;
+    }
+    v->probe = VERIFY_TCP;
+    v->port = port;
+  }
+  else {
+    fprintf(stderr, "Invalid --verify: %s\n", arg);
+    return EINVAL;
+  }
+  return 0;
+}
+
+/*
+ * Waits for the nhosts hosts just woken with magic, through b, to
+ * come up, as v says, and tells the user how each one did.
+ *
+ * Returns 0 if they all came up, EHOSTDOWN if some didn't or an errno
+ * value if they couldn't be checked.
+ */
+static int verify_woken(struct broadcaster *b, const char *magic,
+  size_t nhosts, const struct bcast_dest *dests, const u_int32_t *ipaddrs,
+  char **woken, const struct wake_verify *v)
+{
+  struct verify_result *results;
+  ssize_t up;
+  size_t j;
+  int error;
+
+  results = calloc(nhosts, sizeof(struct verify_result));
+  if (results == NULL)
+    return errno;
+  up = verify_wake(b, magic, nhosts, MAGIC_PACKET_LEN, dests, ipaddrs, v,
+    results);
+  if (up == -1) {
+    error = errno;
+    fprintf(stderr, "Can't verify: %s\n", strerror(error));
+    free(results);
+    return error;
+  }
+
+  for (j = 0; j < nhosts; j++)
+    if (results[j].error != 0)
+      printf("%s: can't verify: %s\n", woken[j],
+        strerror(results[j].error));
+    else if (results[j].up)
+      printf("%s: up after %.1f seconds, woken %u time%s\n", woken[j],
+        results[j].seconds, results[j].wakes,
+        results[j].wakes == 1 ? "" : "s");
+    else
+      printf("%s: down, woken %u time%s\n", woken[j], results[j].wakes,
+        results[j].wakes == 1 ? "" : "s");
+  printf("%ld of %lu hosts came up\n", (long) up, (unsigned long) nhosts);
+
+  free(results);
+  return (size_t) up == nhosts ? 0 : EHOSTDOWN;
+}
+
+/*
+ * Prints every host in the file, one to a line as in wake.hosts,
+ * sorted by name without regard to case.  Hosts with the same name
+ * stay in the order of the file.  A big inventory is sorted in chunks,
+ * a thread for each processor, which are then merged.
+ *
+ * Returns 0 on success or an errno value on failure.
+ */
+static int list_wake_hosts(char *hostsfname, int format)
+{
+  struct host_table *table;
+  struct hostinfo *host;
+  list_handle_t *handle;
+  list_t *node;
+  struct in_addr addr;
+  char ipaddr[INET_ADDRSTRLEN];
+  long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t i;
+  int error = 0;
+
+  table = load_hosts(hostsfname, format, 0);
+  if (table == NULL) {
+    error = errno;
+    fprintf(stderr, "Can't parse file %s: %s\n", hostsfname,
+      strerror(error));
+    return error;
+  }
+  handle = new_list_handle();
+  for (i = 0; handle != NULL && i < table->count; i++)
+    if (list_handle_append(handle, &table->hosts[i]) == NULL)
+      break;
+  if (handle == NULL || i < table->count
+      || list_handle_sort_parallel(handle,
+        (int (*)(void *, void *)) hostcasecmpname,
+        nthreads > 0 ? nthreads : 1) == -1) {
+    error = errno;
+    fprintf(stderr, "Can't sort hosts: %s\n", strerror(error));
+    goto CLEAN_UP;
+  }
+
+  for (node = handle->head; node != NULL; node = node->next) {
+    host = node->data;
+    printf("%s %s", host->name, host->macaddr);
+    if (host->ipaddr != 0) {
+      addr.s_addr = host->ipaddr;
+      printf(" %s", inet_ntop(AF_INET, &addr, ipaddr, sizeof(ipaddr)));
+      if (host->prefix != 32)
+        printf("/%u", host->prefix);
+    }
+    printf("\n");
+  }
+
+CLEAN_UP:
+  if (handle != NULL)
+    free_list_handle(handle);
+  free_host_table(table);
+  return error;
+}
+
+/*
+ * Finds the interfaces to wake hosts through and gets ready to send
+ * to them with transport, and to group if it isn't NULL, telling the
+ * user if that can't be done.
+ *
+ * Returns the broadcaster or NULL on error.
+ */
+static struct broadcaster *open_wake_broadcaster(int transport,
+  const char *group)
+{
+  struct broadcaster *b;
+  int error;
+
+  b = open_broadcaster(9);
+  if (b == NULL) {
+    fprintf(stderr, "Can't find interfaces: %s\n", strerror(errno));
+    return NULL;
+  }
+  if (group != NULL)
+    broadcaster_set_group(b, group);
+  if (broadcaster_set_transport(b, transport) == -1) {
+    error = errno;
+    fprintf(stderr, "Can't send %s: %s\n",
+      transport == BCAST_RAW ? "raw frames" : "IPv6 multicast",
+      strerror(error));
+    close_broadcaster(b);
+    errno = error;
+    return NULL;
+  }
+
+  return b;
+}
+
+/*
+ * Loads wake.hosts and the interface list once and answers wake
+ * requests on the UNIX socket at sockpath until told to stop.  A file
+ * in the wake.hosts format is watched and reloaded as it is edited,
+ * where that can be done; others are loaded once.  The daemon keeps
+ * its routes up to date itself.
+ *
+ * Returns 0 on success or an errno value on failure.
+ */
+static int serve_wake_daemon(char *hostsfname, int format,
+  const char *sockpath, int transport, const char *group)
+{
+  struct host_table *table = NULL;
+  struct host_reloader *reloader = NULL;
+  struct broadcaster *b = NULL;
+  struct wake_daemon *d = NULL;
+  unsigned long count;
+  int error = 0;
+
+  if (format == INVENTORY_HOSTS) {
+    reloader = open_host_reloader(hostsfname);
+#ifdef DEBUG
+    if (reloader == NULL)
+      fprintf(stderr, "Can't watch %s: %s\n", hostsfname, strerror(errno));
+#endif
+  }
+  if (reloader == NULL) {
+    table = load_hosts(hostsfname, format, 1);
+    if (table == NULL) {
+      error = errno;
+      fprintf(stderr, "Can't parse file %s: %s\n", hostsfname,
+        strerror(error));
+      goto CLEAN_UP;
+    }
+  }
+  b = open_wake_broadcaster(transport, group);
+  if (b == NULL) {
+    error = errno;
+    goto CLEAN_UP;
+  }
+  d = open_wake_daemon(sockpath, table, reloader, b);
+  if (d == NULL) {
+    error = errno;
+    fprintf(stderr, "Can't listen on %s: %s\n", sockpath, strerror(error));
+    goto CLEAN_UP;
+  }
+
+  if (reloader != NULL) {
+    count = host_version_count(host_reloader_enter(reloader));
+    host_reloader_leave(reloader);
+  }
+  else
+    count = table->count;
+  printf("Serving %lu hosts from %s on %s%s\n", count, hostsfname,
+    sockpath, reloader != NULL ? ", reloading on change" : "");
+  fflush(stdout);
+  if (run_wake_daemon(d) == -1) {
+    error = errno;
+    fprintf(stderr, "Daemon stopped: %s\n", strerror(error));
+  }
+
+CLEAN_UP:
+  close_wake_daemon(d);
+  close_host_reloader(reloader);
+  close_broadcaster(b);
+  free_host_table(table);
+  return error;
+}
+
+/*
+ * Relays the wakes asked for at port, over UDP or TCP, to the local
+ * interfaces until told to stop, and then says what it did.
+ *
+ * Returns 0 on success or an errno value on failure.
+ */
+static int serve_wake_relay(unsigned int port, int transport,
+  const char *group, unsigned int window_ms, unsigned int flush_ms)
+{
+  struct broadcaster *b;
+  struct wake_relay *r = NULL;
+  int error = 0;
+
+  b = open_wake_broadcaster(transport, group);
+  if (b == NULL)
+    return errno;
+  r = open_wake_relay(port, b, window_ms, flush_ms);
+  if (r == NULL) {
+    error = errno;
+    fprintf(stderr, "Can't listen on port %u: %s\n", port, strerror(error));
+    goto CLEAN_UP;
+  }
+
+  printf("Relaying wakes from port %u\n", port);
+  fflush(stdout);
+  if (run_wake_relay(r) == -1) {
+    error = errno;
+    fprintf(stderr, "Relay stopped: %s\n", strerror(error));
+  }
+  printf("Relayed %lu of %lu wakes in %lu bursts, %lu repeats dropped",
+    r->stats.sent, r->stats.requests, r->stats.bursts, r->stats.coalesced);
+  if (r->stats.failed > 0)
+    printf(", %lu failed", r->stats.failed);
+  if (r->stats.invalid > 0)
+    printf(", %lu invalid", r->stats.invalid);
+  printf("\n");
+
+CLEAN_UP:
+  close_wake_relay(r);
+  close_broadcaster(b);
+  return error;
+}
+
+/*
+ * Leaves out of the nhosts packets those for hosts that some wake
+ * process of this user, this one included, woke less than secs
+ * seconds ago, as the shared mac cache tells it, and moves the rest
+ * down to fill the gaps.  The ones that are kept are marked as woken
+ * now, with the time of each claim in stamps.
+ *
+ * Returns the number of packets left and sets *suppressed to the
+ * number left out.
+ */
+static size_t suppress_recent_wakes(struct mac_cache *cache,
+  unsigned int secs, char *magic, size_t nhosts, struct bcast_dest *dests,
+  u_int32_t *ipaddrs, char **woken, u_int64_t *stamps, size_t *suppressed)
+{
+  const unsigned char *mac;
+  size_t i, kept = 0;
+
+  *suppressed = 0;
+  for (i = 0; i < nhosts; i++) {
+    /* The mac address follows the six bytes of 0xFF. */
+    mac = (const unsigned char *) magic + i * MAGIC_PACKET_LEN + 6;
+    if (!mac_cache_claim(cache, mac, secs * 1000UL, &stamps[kept])) {
+      (*suppressed)++;
+      continue;
+    }
+    if (kept != i) {
+      memcpy(magic + kept * MAGIC_PACKET_LEN, magic + i * MAGIC_PACKET_LEN,
+        MAGIC_PACKET_LEN);
+      dests[kept] = dests[i];
+      ipaddrs[kept] = ipaddrs[i];
+      woken[kept] = woken[i];
+    }
+    kept++;
+  }
+
+  return kept;
+}
+
+/*
+ * Takes back the claims that suppress_recent_wakes made for the hosts
+ * whose packets didn't go out, as results says, or for all of them if
+ * failed is set, so that a retry isn't suppressed for a wake that
+ * never happened.
+ */
+static void unclaim_failed_wakes(struct mac_cache *cache,
+  const char *magic, size_t nhosts, const u_int64_t *stamps,
+  const int *results, int failed)
+{
+  size_t i;
+
+  for (i = 0; i < nhosts; i++)
+    if (failed || results[i] != 0)
+      mac_cache_unclaim(cache,
+        (const unsigned char *) magic + i * MAGIC_PACKET_LEN + 6, stamps[i]);
+}
+
+/*
+ * Fills in dest for a host at ipaddr on a subnet with the given
+ * prefix length: aimed at that subnet if the routes say how to reach
+ * it, and at every interface, as before, otherwise.
+ */
+static void choose_wake_dest(u_int32_t ipaddr, unsigned int prefix,
+  struct bcast_dest *dest)
+{
+  memset(dest, 0, sizeof(struct bcast_dest));
+  if (ipaddr == 0)
+    return;
+  if (!routes_loaded) {
+    routes_loaded = 1;
+    routes = load_route_table();
+#ifdef DEBUG
+    if (routes == NULL)
+      fprintf(stderr, "Can't load routes: %s\n", strerror(errno));
+#endif
+  }
+  if (routes != NULL)
+    find_wake_dest(routes, ipaddr, prefix, dest);
+}
+
+/*
+ * Tells the user that the mac address for a host is no good and
+ * where in it the problem is.
+ */
+static void report_invalid_mac(const char *macaddr, const char *name,
+  int namelen)
+{
+  unsigned char mac[6];
+  size_t errpos = 0;
+
+  parse_macaddr(macaddr, strlen(macaddr), mac, &errpos);
+  fprintf(stderr,
+    "Invalid mac address (%s) for host (%.*s) at character %lu.\n",
+    macaddr, namelen, name, (unsigned long) errpos + 1);
+}
+
+/*
+ * Looks up each of the count names in the compiled database and
+ * builds a magic packet in magic for every one with a valid mac
+ * address, says where to send it in dests and puts the host's IP
+ * address, or 0 if it has none, in ipaddrs.  The names that get a
+ * packet are copied to woken, in the same order as the packets.
+ *
+ * Returns the number of packets built.
+ */
+static size_t lookup_in_db(struct hosts_db *db, char *hostsfname,
+  int count, char **names, char *magic, struct bcast_dest *dests,
+  u_int32_t *ipaddrs, char **woken)
 {
-  extern int errno;
-  char magic[102];
-  int i = 0;
+  const struct hosts_db_entry *entry;
+  size_t nhosts = 0;
+  int i;
 
-  list_t *head;
+  for (i = 0; i < count; i++) {
+    entry = hosts_db_find(db, names[i], strlen(names[i]));
+    if (entry == NULL) {
+      fprintf(stderr, "Host not found in %s: %s\n", hostsfname, names[i]);
+      continue;
+    }
+    if ((entry->flags & HOSTS_DB_MAC_VALID) == 0) {
+      report_invalid_mac(db->names + entry->macaddr_off,
+        db->names + entry->name_off, entry->name_len);
+      continue;
+    }
+    build_magic_packet(entry->mac, magic + nhosts * MAGIC_PACKET_LEN);
+    choose_wake_dest(entry->ipaddr, entry->prefix, &dests[nhosts]);
+    ipaddrs[nhosts] = entry->ipaddr;
+    woken[nhosts++] = names[i];
+  }
+
+  return nhosts;
+}
+
+/*
+ * Says whether a name given on the command line picks out hosts,
+ * by tag or by a wildcard pattern, rather than naming just one.
+ */
+static int is_host_selector(const char *name)
+{
+  return name[0] == '@' || strpbrk(name, "*?[") != NULL;
+}
+
+/*
+ * Builds the magic packet for a host from a host table as the nth
+ * one, the way lookup_in_db does, under the given name.
+ *
+ * Returns 1 if it did or 0 if the host's mac address is no good.
+ */
+static size_t add_table_host(struct hostinfo *curhost, char *name,
+  size_t n, char *magic, struct bcast_dest *dests, u_int32_t *ipaddrs,
+  char **woken)
+{
+  if (!curhost->macvalid) {
+    report_invalid_mac(curhost->macaddr, curhost->name,
+      strlen(curhost->name));
+    return 0;
+  }
+  build_magic_packet(curhost->mac, magic + n * MAGIC_PACKET_LEN);
+  choose_wake_dest(curhost->ipaddr, curhost->prefix, &dests[n]);
+  ipaddrs[n] = curhost->ipaddr;
+  woken[n] = name;
+  return 1;
+}
+
+/*
+ * Like lookup_in_db, but takes the hosts from a host table.  If sels
+ * is not NULL, it holds the hosts picked out by each name that is a
+ * tag expression or a pattern.
+ */
+static size_t lookup_in_table(struct host_table *table, char *hostsfname,
+  int count, char **names, struct host_selection *sels, char *magic,
+  struct bcast_dest *dests, u_int32_t *ipaddrs, char **woken)
+{
   struct hostinfo *curhost;
+  size_t nhosts = 0, j;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (sels != NULL && is_host_selector(names[i])) {
+      if (sels[i].count == 0)
+        fprintf(stderr, "No hosts match in %s: %s\n", hostsfname,
+          names[i]);
+      for (j = 0; j < sels[i].count; j++) {
+        curhost = &table->hosts[sels[i].ids[j]];
+        nhosts += add_table_host(curhost, curhost->name, nhosts, magic,
+          dests, ipaddrs, woken);
+      }
+      continue;
+    }
+    curhost = host_table_find(table, names[i]);
+    if (curhost == NULL) {
+      fprintf(stderr, "Host not found in %s: %s\n", hostsfname, names[i]);
+      continue;
+    }
+    nhosts += add_table_host(curhost, names[i], nhosts, magic, dests,
+      ipaddrs, woken);
+  }
+
+  return nhosts;
+}
+
+/*
+ * Like lookup_in_db, but takes the hosts from the views of a map made
+ * by scan_wake_hosts_file, which has one view per name.
+ */
+static size_t lookup_in_map(struct hosts_map *map, char *hostsfname,
+  int count, char **names, char *magic, struct bcast_dest *dests,
+  u_int32_t *ipaddrs, char **woken)
+{
+  struct host_view *curhost;
+  char macaddr[18]; /* the mac address as text, nul-terminated */
+  size_t nhosts = 0;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    curhost = map->views[i].name_len ? &map->views[i] : NULL;
+    if (curhost == NULL) {
+      fprintf(stderr, "Host not found in %s: %s\n", hostsfname, names[i]);
+      continue;
+    }
 
-  /* Some regex stuff to validate the input. */
-  regex_t regexp;
-  char *repat = "^([[:xdigit:]]{1,2}([[:punct:]]|$)){6}";
-  int reflags = REG_EXTENDED | REG_NOSUB;
+    if (!curhost->macvalid) {
+      report_invalid_mac(host_view_macaddr(map, curhost, macaddr),
+        map->base + curhost->name_off, curhost->name_len);
+      continue;
+    }
+    build_magic_packet(curhost->mac, magic + nhosts * MAGIC_PACKET_LEN);
+    choose_wake_dest(curhost->ipaddr, curhost->prefix, &dests[nhosts]);
+    ipaddrs[nhosts] = curhost->ipaddr;
+    woken[nhosts++] = names[i];
+  }
+
+  return nhosts;
+}
+
+int main(int argc, char *argv[])
+{
+  char *magic, **woken;
+  struct bcast_dest *dests;
+  struct broadcaster *b;
+  int *results;
+  struct host_selection *sels = NULL;
+  size_t nhosts = 0, total, j;
+  int opt, compile = 0, listing = 0, shared = 0, format = -1, count, i;
+  const char *sockpath = NULL;
+  unsigned int relay_port = 0, window_ms = 1000, flush_ms = 10;
+  unsigned int suppress = 0;
+  size_t suppressed = 0;
+  struct mac_cache *cache = NULL;
+  u_int64_t *stamps = NULL;
+  ssize_t sent = 0; /* the number of hosts sent to, once it is known */
+  struct wake_pace pace = {0, 1, 1, 0};
+  int paced = 0, transport = BCAST_UDP;
+  const char *group = NULL;
+  struct in6_addr group6;
+  struct wake_verify verify = {VERIFY_ICMP, 0, 30, 300};
+  u_int32_t *ipaddrs;
+  int verifying = 0, rv = 0;
+  char *end;
+
+  struct hosts_db *db = NULL;
+  struct hosts_map *map = NULL;
+  struct host_table *table = NULL;
+  char *hostsfname, *hostsfile = NULL, *dbpath = NULL;
+
+  while ((opt = getopt_long(argc, argv,
+          "clSf:F:d::R::W:i:r:b:n:j:t:g:s:V::w:T:h", long_options,
+          NULL)) != -1)
+    switch (opt) {
+    case 'c':
+      compile = 1;
+      break;
+    case 'l':
+      listing = 1;
+      break;
+    case 'S':
+      shared = 1;
+      break;
+    case 'f':
+      hostsfile = optarg;
+      break;
+    case 'F':
+      format = parse_inventory_format(optarg);
+      if (format == -1) {
+        fprintf(stderr, "Invalid --format: %s\n", optarg);
+        return EINVAL;
+      }
+      break;
+    case 'd':
+      sockpath = optarg != NULL ? optarg : WAKE_DAEMON_SOCKET;
+      break;
+    case 'R':
+      relay_port = WAKE_RELAY_PORT;
+      if (optarg != NULL
+          && (parse_count_arg(optarg, "relay", 1, &relay_port)
+            || relay_port > 65535)) {
+        if (relay_port > 65535)
+          fprintf(stderr, "Invalid --relay: %s\n", optarg);
+        return EINVAL;
+      }
+      break;
+    case 'W':
+      if (parse_count_arg(optarg, "window", 0, &window_ms))
+        return EINVAL;
+      break;
+    case 'i':
+      if (parse_count_arg(optarg, "interval", 0, &flush_ms))
+        return EINVAL;
+      break;
+    case 'r':
+      errno = 0;
+      pace.rate = strtod(optarg, &end);
+      if (errno != 0 || end == optarg || *end != 0 || !(pace.rate > 0)) {
+        fprintf(stderr, "Invalid --rate: %s\n", optarg);
+        return EINVAL;
+      }
+      paced = 1;
+      break;
+    case 'b':
+      if (parse_count_arg(optarg, "burst", 1, &pace.burst))
+        return EINVAL;
+      paced = 1;
+      break;
+    case 'n':
+      if (parse_count_arg(optarg, "repeat", 1, &pace.repeat))
+        return EINVAL;
+      paced = 1;
+      break;
+    case 'j':
+      if (parse_count_arg(optarg, "jitter", 0, &pace.jitter_ms))
+        return EINVAL;
+      paced = 1;
+      break;
+    case 't':
+      if (strcmp(optarg, "udp") == 0)
+        transport = BCAST_UDP;
+      else if (strcmp(optarg, "raw") == 0)
+        transport = BCAST_RAW;
+      else if (strcmp(optarg, "uring") == 0)
+        transport = BCAST_URING;
+      else if (strcmp(optarg, "ipv6") == 0)
+        transport = BCAST_IPV6;
+      else {
+        fprintf(stderr, "Invalid --transport: %s\n", optarg);
+        return EINVAL;
+      }
+      break;
+    case 'g':
+      if (inet_pton(AF_INET6, optarg, &group6) != 1
+          || !IN6_IS_ADDR_MULTICAST(&group6)) {
+        fprintf(stderr, "Invalid --group: %s\n", optarg);
+        return EINVAL;
+      }
+      group = optarg;
+      transport = BCAST_IPV6;
+      break;
+    case 's':
+      if (parse_count_arg(optarg, "suppress", 1, &suppress))
+        return EINVAL;
+      break;
+    case 'V':
+      if (parse_verify_arg(optarg, &verify))
+        return EINVAL;
+      verifying = 1;
+      break;
+    case 'w':
+      if (parse_count_arg(optarg, "wait", 1, &verify.delay))
+        return EINVAL;
+      break;
+    case 'T':
+      if (parse_count_arg(optarg, "timeout", 1, &verify.timeout))
+        return EINVAL;
+      break;
+    case 'h':
+      usage(stdout);
+      return 0;
+    default:
+      usage(stderr);
+      return EINVAL;
+    }
+  count = argc - optind;
+
+  /* The relay only passes on mac addresses, so it needs no wake.hosts. */
+  if (relay_port != 0)
+    return serve_wake_relay(relay_port, transport, group, window_ms,
+      flush_ms);
 
   /* Look up file location. */
-  char *hostsfname = find_wake_hosts_file_path();
+  hostsfname = hostsfile != NULL ? hostsfile : find_wake_hosts_file_path();
   if (hostsfname == NULL) {
     fprintf(stderr, "Can't find wake.hosts file\n");
     exit(errno);
   }
+  if (format == -1)
+    format = guess_inventory_format(hostsfname);
+  if (shared && format != INVENTORY_HOSTS) {
+    fprintf(stderr, "Only a file in the wake.hosts format can be shared\n");
+    return EINVAL;
+  }
 
-  head  = parse_wake_hosts_file(hostsfname);
-  if (head == NULL) {
-    fprintf(stderr, "Can't parse file %s: %s\n", hostsfname,
-      strerror(errno));
+  if (compile)
+    return compile_wake_hosts(hostsfname, format);
+  if (listing)
+    return list_wake_hosts(hostsfname, format);
+  if (sockpath != NULL)
+    return serve_wake_daemon(hostsfname, format, sockpath, transport, group);
+
+  /* Only the host table knows the tags and has the trie of names, so
+   * with any tag expressions or patterns load it first, and pick out
+   * their hosts to see how many there are. */
+  total = count;
+  for (i = 0; i < count && !is_host_selector(argv[optind + i]); i++)
+    ;
+  if (i < count) {
+    table = load_hosts(hostsfname, format, 0);
+    sels = calloc(count, sizeof(struct host_selection));
+    if (table == NULL || sels == NULL) {
+      fprintf(stderr, "Can't parse file %s: %s\n", hostsfname,
+        strerror(errno));
+      exit(errno);
+    }
+    for (; i < count; i++)
+      if (is_host_selector(argv[optind + i])) {
+        if ((argv[optind + i][0] == '@'
+              ? host_table_select(table, argv[optind + i], &sels[i])
+              : host_table_match(table, argv[optind + i], &sels[i])) == -1) {
+          fprintf(stderr, "Can't select hosts %s: %s\n",
+            argv[optind + i], strerror(errno));
+          exit(errno);
+        }
+        total += sels[i].count;
+      }
+  }
+
+  /* Room for one magic packet, destination and result per host. */
+  magic = malloc((total + 1) * MAGIC_PACKET_LEN);
+  dests = calloc(total + 1, sizeof(struct bcast_dest));
+  ipaddrs = calloc(total + 1, sizeof(u_int32_t));
+  woken = calloc(total + 1, sizeof(char *));
+  results = calloc(total + 1, sizeof(int));
+  if (magic == NULL || dests == NULL || ipaddrs == NULL || woken == NULL
+      || results == NULL) {
+    fprintf(stderr, "%s\n", strerror(errno));
     exit(errno);
   }
 
-  if (regcomp(&regexp, repat, reflags) == 0) {
-    for (i = 1; i < argc; i++) {
-      curhost = find_host_by_name(head, argv[i]);
-      if (curhost == NULL) {
-        fprintf(stderr, "Host not found in %s: %s\n", hostsfname,
-          argv[i]);
-        continue;
-      }
+  /* Use the shared copy if asked to, else the compiled database if it
+   * is up to date, else the text. */
+  if (table == NULL && shared) {
+    db = open_shared_hosts(hostsfname);
+    if (db == NULL)
+      fprintf(stderr, "Can't share %s: %s\n", hostsfname, strerror(errno));
+  }
+  else if (table == NULL)
+    dbpath = find_wake_hosts_db_path(hostsfname);
+  if (dbpath != NULL) {
+    db = open_hosts_db(dbpath);
+#ifdef DEBUG
+    if (db == NULL)
+      fprintf(stderr, "Ignoring %s: %s\n", dbpath, strerror(errno));
+#endif
+  }
 
-      if (regexec(&regexp, curhost->macaddr, 0, NULL, 0) == REG_NOMATCH)
-        fprintf(stderr, "Invalid mac address (%s) for host (%s).\n",
-          curhost->macaddr, curhost->name);
-      else
-        if (build_msg(curhost->macaddr, magic) != NULL) {
-          if (broadcast_msg(9, magic, 102) == -1)
-            fprintf(stderr, "Unable to send broadcast: %s\n",
-              strerror(errno));
-        }
-        else
-          fprintf(stderr, "Failed to build magic packet for %s.\n",
-            curhost->name);
+  if (table != NULL)
+    nhosts = lookup_in_table(table, hostsfname, count, argv + optind, sels,
+      magic, dests, ipaddrs, woken);
+  else if (db != NULL)
+    nhosts = lookup_in_db(db, dbpath != NULL ? dbpath : hostsfname, count,
+      argv + optind, magic, dests, ipaddrs, woken);
+  else if (count <= STREAM_MAX_HOSTS && format == INVENTORY_HOSTS) {
+    /* For a few hosts, stop reading as soon as they are all found. */
+    map = scan_wake_hosts_file(hostsfname, argv + optind, count);
+    if (map == NULL) {
+      fprintf(stderr, "Can't parse file %s: %s\n", hostsfname,
+        strerror(errno));
+      exit(errno);
     }
-    regfree(&regexp);
+    nhosts = lookup_in_map(map, hostsfname, count, argv + optind, magic,
+      dests, ipaddrs, woken);
+  }
+  else {
+    /* Load the whole file into one block and index it. */
+    table = load_hosts(hostsfname, format, 0);
+    if (table == NULL) {
+      fprintf(stderr, "Can't parse file %s: %s\n", hostsfname,
+        strerror(errno));
+      exit(errno);
+    }
+    nhosts = lookup_in_table(table, hostsfname, count, argv + optind, NULL,
+      magic, dests, ipaddrs, woken);
   }
-  free_wake_hosts_list(head);
 
-  return 0;
+  if (suppress > 0 && nhosts > 0) {
+    cache = open_mac_cache(MAC_CACHE_NAME);
+    stamps = calloc(nhosts, sizeof(u_int64_t));
+    if (cache == NULL || stamps == NULL) {
+      fprintf(stderr, "Can't open the mac cache, not suppressing: %s\n",
+        strerror(errno));
+      close_mac_cache(cache);
+      cache = NULL;
+    }
+    else
+      nhosts = suppress_recent_wakes(cache, suppress, magic, nhosts, dests,
+        ipaddrs, woken, stamps, &suppressed);
+  }
+
+  /* Send all of the packets, in one go unless they are paced, and
+   * report any that failed. */
+  if (nhosts > 0) {
+    b = open_wake_broadcaster(transport, group);
+    if (b != NULL)
+      sent = paced ? send_paced(b, magic, nhosts, dests, results, &pace)
+        : broadcaster_send_directed(b, magic, nhosts, MAGIC_PACKET_LEN,
+          dests, results);
+    if (b != NULL && sent == -1)
+      fprintf(stderr, "Unable to send broadcast: %s\n", strerror(errno));
+    if (cache != NULL)
+      unclaim_failed_wakes(cache, magic, nhosts, stamps, results,
+        b == NULL || sent == -1);
+    if (b != NULL && sent != -1)
+      for (j = 0, sent = 0; j < nhosts; j++) {
+        if (results[j] != 0)
+          fprintf(stderr, "Unable to send broadcast for %s: %s\n",
+            woken[j], strerror(results[j]));
+        else
+          sent++;
+      }
+    if (b != NULL && verifying)
+      rv = verify_woken(b, magic, nhosts, dests, ipaddrs, woken, &verify);
+    close_broadcaster(b);
+  }
+  if (suppress > 0)
+    printf("%ld sent, %lu suppressed\n", (long) (sent > 0 ? sent : 0),
+      (unsigned long) suppressed);
+
+  for (i = 0; sels != NULL && i < count; i++)
+    free(sels[i].ids);
+  free(sels);
+  close_mac_cache(cache);
+  free(stamps);
+  free(results);
+  free(ipaddrs);
+  free(woken);
+  free(dests);
+  free(magic);
+  free_route_table(routes);
+  free_host_table(table);
+  unmap_wake_hosts_file(map);
+  close_hosts_db(db);
+
+  return rv;
 }
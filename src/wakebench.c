@@ -0,0 +1,528 @@
+/*
+ * Copyright © 2026 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of wake.
+ *
+ * wake is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wake is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wake.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Times the parts of wake that replaced a slower way of doing the same
+ * thing against that way.  It is built and run by make bench and is
+ * not installed.
+ *
+ *     wakebench [mac|sort|send] [COUNT]
+ *
+ * With no arguments, every benchmark is run at its default sizes.  Each
+ * one is run BENCH_ROUNDS times and the best round is reported.
+ */
+#include "broadcast.h"
+#include "build_msg.h"
+#include "hostinfo.h"
+#include "list.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#ifdef HAVE_REGEX_H
+#include <regex.h>
+#endif
+
+/* How many times each benchmark is run. */
+#define BENCH_ROUNDS 3
+
+/* How many mac addresses are parsed by default. */
+#define BENCH_MACS 200000
+
+/* The lengths of the lists sorted by default, and the longest one the
+ * old exchange sort is timed on, since it takes quadratic time. */
+static const size_t bench_sorts[] = { 10000, 100000, 1000000 };
+#define BENCH_EXCHANGE_MAX 10000
+
+/* How many packets are sent by default, how many go to the broadcaster
+ * at once, and the port they go to on the loopback interface. */
+#define BENCH_PACKETS 100000
+#define BENCH_SEND_BATCH 1024
+#define BENCH_PORT 47009
+
+/* Returns the monotonic clock in seconds. */
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns the processor time this process has used, in seconds. */
+static double bench_cpu(void)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * Writes into buf, MACADDR_MAXLEN + 1 bytes apart, count mac addresses
+ * written the ways people write them, with one or two digits a byte,
+ * either case and any of the usual separators.  About one in five is
+ * wrong in one of the ways people get them wrong.
+ *
+ * Returns how many of them are valid.
+ */
+static size_t make_mac_corpus(char *buf, size_t count)
+{
+  static const char digits[] = "0123456789abcdef0123456789ABCDEF";
+  static const char seps[] = ":-.";
+  char *s;
+  size_t i, valid = 0;
+  int j, k, sep;
+
+  srandom(1);
+  for (i = 0; i < count; i++) {
+    s = buf + i * (MACADDR_MAXLEN + 1);
+    sep = seps[random() % 3];
+    for (j = 0, k = 0; j < 6; j++) {
+      if (random() % 8 != 0)
+        s[k++] = digits[random() % 32];
+      s[k++] = digits[random() % 32];
+      if (j < 5)
+        s[k++] = sep;
+    }
+    s[k] = '\0';
+    switch (random() % 20) {
+    case 0: /* a letter that isn't a hex digit */
+      s[random() % k] = 'g';
+      break;
+    case 1: /* a byte short */
+      s[k - 3] = '\0';
+      break;
+    case 2: /* no separators at all */
+      for (j = 0; j < 12; j++)
+        s[j] = digits[random() % 16];
+      s[12] = '\0';
+      break;
+    case 3: /* spaces, which aren't punctuation */
+      for (j = 0; s[j] != '\0'; j++)
+        if (s[j] == sep)
+          s[j] = ' ';
+      break;
+    default:
+      valid++;
+    }
+  }
+
+  return valid;
+}
+
+#ifdef HAVE_REGEX_H
+
+/* How wake built a packet before parse_macaddr: strtol on every byte
+ * of every copy of the address, once regexec had passed it. */
+static char *build_msg_strtol(const char *macaddr, char *msgbuf)
+{
+  char *next = NULL;
+  int i;
+
+  memset(msgbuf, 0xFF, 6);
+  for (i = 6; i < MAGIC_PACKET_LEN; i++) {
+    if (i % 6 == 0)
+      next = (char *) macaddr;
+    msgbuf[i] = (char) strtol(next, &next, 16);
+    next++;
+  }
+
+  return msgbuf;
+}
+
+#endif
+
+/*
+ * Parses count mac addresses and builds their packets, the old way,
+ * with the regex wake used to check them and strtol, and the new way,
+ * with parse_macaddr.
+ */
+static int bench_mac(size_t count)
+{
+  char *corpus, packet[MAGIC_PACKET_LEN], *s;
+  unsigned char mac[6];
+  double start, best, t;
+  size_t valid, i, accepted = 0;
+  unsigned long sum = 0;
+  int round;
+#ifdef HAVE_REGEX_H
+  regex_t re;
+#endif
+
+  corpus = malloc(count * (MACADDR_MAXLEN + 1));
+  if (corpus == NULL)
+    return -1;
+  valid = make_mac_corpus(corpus, count);
+  printf("mac: %lu addresses, %lu of them valid\n", (unsigned long) count,
+    (unsigned long) valid);
+
+#ifdef HAVE_REGEX_H
+  if (regcomp(&re, "^([[:xdigit:]]{1,2}([[:punct:]]|$)){6}",
+        REG_EXTENDED | REG_NOSUB) != 0) {
+    free(corpus);
+    errno = EINVAL;
+    return -1;
+  }
+  for (round = 0, best = 0; round < BENCH_ROUNDS; round++) {
+    accepted = 0;
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+      s = corpus + i * (MACADDR_MAXLEN + 1);
+      if (regexec(&re, s, 0, NULL, 0) == 0) {
+        build_msg_strtol(s, packet);
+        sum += (unsigned char) packet[6];
+        accepted++;
+      }
+    }
+    t = bench_now() - start;
+    if (round == 0 || t < best)
+      best = t;
+  }
+  regfree(&re);
+  printf("  %-24s %8.1f ns/address, %lu accepted\n", "regexec + strtol",
+    best * 1e9 / count, (unsigned long) accepted);
+#else
+  printf("  %-24s no regex.h here\n", "regexec + strtol");
+#endif
+
+  for (round = 0, best = 0; round < BENCH_ROUNDS; round++) {
+    accepted = 0;
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+      s = corpus + i * (MACADDR_MAXLEN + 1);
+      if (parse_macaddr(s, strlen(s), mac, NULL)) {
+        build_magic_packet(mac, packet);
+        sum += (unsigned char) packet[6];
+        accepted++;
+      }
+    }
+    t = bench_now() - start;
+    if (round == 0 || t < best)
+      best = t;
+  }
+  printf("  %-24s %8.1f ns/address, %lu accepted\n", "parse_macaddr",
+    best * 1e9 / count, (unsigned long) accepted);
+
+  /* Keep the packets from being optimized away. */
+  if (sum == 1)
+    printf("\n");
+  free(corpus);
+  return 0;
+}
+
+/* How wake sorted its hosts before list_handle_sort: an exchange sort
+ * that swaps the data of neighbouring members. */
+static void exchange_sort_list(list_handle_t *handle,
+  int (*func)(void *, void *))
+{
+  list_t *first, *next;
+  size_t left = handle->length, i;
+
+  while (left-- > 1) {
+    first = handle->head;
+    for (i = 0; i < left; i++) {
+      next = first->next;
+      if (func(first->data, next->data) > 0)
+        swap_list_data(first, next);
+      first = next;
+    }
+  }
+}
+
+/* Returns a new list of the count hosts, in the order they are in. */
+static list_handle_t *make_host_list(struct hostinfo *hosts, size_t count)
+{
+  list_handle_t *handle = new_list_handle();
+  size_t i;
+
+  if (handle == NULL)
+    return NULL;
+  for (i = 0; i < count; i++)
+    if (list_handle_append(handle, &hosts[i]) == NULL) {
+      free_list_handle(handle);
+      return NULL;
+    }
+
+  return handle;
+}
+
+/* Returns whether the list is sorted by name and hosts with the same
+ * name are still in the order they were appended in. */
+static int host_list_sorted(const list_handle_t *handle)
+{
+  list_t *temp;
+  int cmp;
+
+  for (temp = handle->head; temp != NULL && temp->next != NULL;
+       temp = temp->next) {
+    cmp = hostcasecmpname(temp->data, temp->next->data);
+    if (cmp > 0 || (cmp == 0 && temp->data > temp->next->data))
+      return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Sorts a list of count hosts, with about four of each name, with the
+ * sort it is given, BENCH_ROUNDS times, and prints the best time.
+ */
+static int time_host_sort(const char *label, struct hostinfo *hosts,
+  size_t count, unsigned int nthreads)
+{
+  list_handle_t *handle;
+  double start, best = 0, t;
+  int round, sorted = 1;
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    handle = make_host_list(hosts, count);
+    if (handle == NULL)
+      return -1;
+    start = bench_now();
+    if (nthreads == 0)
+      exchange_sort_list(handle, (int (*)(void *, void *)) hostcasecmpname);
+    else if (list_handle_sort_parallel(handle,
+               (int (*)(void *, void *)) hostcasecmpname, nthreads) == -1) {
+      free_list_handle(handle);
+      return -1;
+    }
+    t = bench_now() - start;
+    if (round == 0 || t < best)
+      best = t;
+    sorted = sorted && host_list_sorted(handle);
+    free_list_handle(handle);
+  }
+  printf("  %-24s %8.1f ms%s\n", label, best * 1e3,
+    sorted ? "" : ", NOT SORTED");
+
+  return sorted ? 0 : -1;
+}
+
+/*
+ * Sorts count hosts by name the old way, with the exchange sort, when
+ * there are few enough of them, and the new ways, with list_handle_sort
+ * and list_handle_sort_parallel on a thread per processor.
+ */
+static int bench_sort(size_t count)
+{
+  struct hostinfo *hosts;
+  char *names, label[32];
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t i;
+  int err = 0;
+
+  if (ncpu < 1)
+    ncpu = 1;
+  hosts = calloc(count, sizeof(struct hostinfo));
+  names = malloc(count * 16);
+  if (hosts == NULL || names == NULL) {
+    free(hosts);
+    free(names);
+    return -1;
+  }
+  srandom(2);
+  for (i = 0; i < count; i++) {
+    hosts[i].name = names + i * 16;
+    snprintf(hosts[i].name, 16, random() % 2 ? "host%lu" : "HOST%lu",
+      (unsigned long) (random() % (count / 4 + 1)));
+  }
+  printf("sort: %lu hosts\n", (unsigned long) count);
+
+  if (count <= BENCH_EXCHANGE_MAX)
+    err = time_host_sort("exchange sort", hosts, count, 0);
+  if (err == 0)
+    err = time_host_sort("list_handle_sort", hosts, count, 1);
+  if (err == 0 && ncpu > 1) {
+    snprintf(label, sizeof(label), "%ld threads", ncpu);
+    err = time_host_sort(label, hosts, count, ncpu);
+  }
+
+  free(hosts);
+  free(names);
+  if (err == -1 && errno == 0)
+    errno = EINVAL;
+  return err;
+}
+
+/*
+ * Sends the count packets in msgs to dest with b, BENCH_SEND_BATCH of
+ * them at a time, with transport, BENCH_ROUNDS times, and prints the
+ * best rate and the processor time each packet took in that round.
+ */
+static int time_send(struct broadcaster *b, int transport,
+  const char *msgs, size_t count, const struct bcast_dest *dests)
+{
+  double start, cpu, best = 0, bestcpu = 0, t;
+  size_t i, n, sent = 0;
+  ssize_t rv;
+  int round;
+
+  if (broadcaster_set_transport(b, transport) == -1)
+    return -1;
+  if (b->transport != transport) {
+    printf("  %-24s not available here\n", "io_uring");
+    return 0;
+  }
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    sent = 0;
+    start = bench_now();
+    cpu = bench_cpu();
+    for (i = 0; i < count; i += n) {
+      n = count - i > BENCH_SEND_BATCH ? BENCH_SEND_BATCH : count - i;
+      rv = broadcaster_send_directed(b, msgs + i * MAGIC_PACKET_LEN, n,
+        MAGIC_PACKET_LEN, dests, NULL);
+      if (rv == -1)
+        return -1;
+      sent += rv;
+    }
+    t = bench_now() - start;
+    cpu = bench_cpu() - cpu;
+    if (round == 0 || t < best) {
+      best = t;
+      bestcpu = cpu;
+    }
+  }
+  /* It may have given up on the ring part way through. */
+  printf("  %-24s %8.0f packets/s, %.2f us cpu/packet, %lu sent%s\n",
+    transport == BCAST_URING ? "io_uring" : "udp", count / best,
+    bestcpu * 1e6 / count, (unsigned long) sent,
+    b->transport != transport ? ", fell back" : "");
+
+  return 0;
+}
+
+/*
+ * Sends count magic packets for 02:00:00:00:00:00, a locally
+ * administered address that no card has, to a socket of our own on the
+ * loopback interface, with the blocking path and with io_uring.  The
+ * socket is there so the sends don't fail, and it drops what it has no
+ * room for without the senders knowing.
+ */
+static int bench_send(size_t count)
+{
+  static const unsigned char mac[6] = { 0x02, 0, 0, 0, 0, 0 };
+  struct broadcaster *b = NULL;
+  struct bcast_dest *dests = NULL;
+  char *msgs = NULL;
+  size_t i;
+  int sink, err = -1;
+
+  sink = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sink == -1)
+    return -1;
+  msgs = malloc(count * MAGIC_PACKET_LEN);
+  dests = calloc(BENCH_SEND_BATCH, sizeof(struct bcast_dest));
+  if (msgs == NULL || dests == NULL)
+    goto CLEAN_UP;
+  dests[0].addr.sin_family = AF_INET;
+  dests[0].addr.sin_port = htons(BENCH_PORT);
+  dests[0].addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  dests[0].ifindex = if_nametoindex("lo");
+  if (dests[0].ifindex == 0)
+    goto CLEAN_UP;
+  for (i = 1; i < BENCH_SEND_BATCH; i++)
+    dests[i] = dests[0];
+  if (bind(sink, (struct sockaddr *) &dests[0].addr,
+        sizeof(dests[0].addr)) == -1)
+    goto CLEAN_UP;
+  for (i = 0; i < count; i++)
+    build_magic_packet(mac, msgs + i * MAGIC_PACKET_LEN);
+  b = open_broadcaster(BENCH_PORT);
+  if (b == NULL)
+    goto CLEAN_UP;
+  printf("send: %lu packets to 127.0.0.1 port %d\n", (unsigned long) count,
+    BENCH_PORT);
+
+  if (time_send(b, BCAST_UDP, msgs, count, dests) == 0
+      && time_send(b, BCAST_URING, msgs, count, dests) == 0)
+    err = 0;
+
+ CLEAN_UP:
+  if (b != NULL)
+    close_broadcaster(b);
+  free(dests);
+  free(msgs);
+  close(sink);
+  return err;
+}
+
+int main(int argc, char **argv)
+{
+  const char *which = argc > 1 ? argv[1] : NULL;
+  unsigned long count = 0;
+  char *end;
+  size_t i;
+  int ran = 0;
+
+  if (argc > 3 || (argc > 1 && strcmp(which, "mac") != 0
+                   && strcmp(which, "sort") != 0
+                   && strcmp(which, "send") != 0)) {
+    fprintf(stderr, "usage: wakebench [mac|sort|send] [COUNT]\n");
+    return EINVAL;
+  }
+  if (argc > 2) {
+    count = strtoul(argv[2], &end, 10);
+    if (*end != '\0' || count == 0) {
+      fprintf(stderr, "Invalid count: %s\n", argv[2]);
+      return EINVAL;
+    }
+  }
+
+  if (which == NULL || strcmp(which, "mac") == 0) {
+    if (bench_mac(count > 0 ? count : BENCH_MACS) == -1) {
+      fprintf(stderr, "mac: %s\n", strerror(errno));
+      return errno;
+    }
+    ran++;
+  }
+
+  if (which == NULL || strcmp(which, "sort") == 0) {
+    for (i = 0; i < sizeof(bench_sorts) / sizeof(bench_sorts[0]); i++) {
+      errno = 0;
+      if (bench_sort(count > 0 ? count : bench_sorts[i]) == -1) {
+        fprintf(stderr, "sort: %s\n", strerror(errno));
+        return errno;
+      }
+      if (count > 0)
+        break;
+    }
+    ran++;
+  }
+
+  if (which == NULL || strcmp(which, "send") == 0) {
+    if (bench_send(count > 0 ? count : BENCH_PACKETS) == -1) {
+      fprintf(stderr, "send: %s\n", strerror(errno));
+      return errno;
+    }
+    ran++;
+  }
+
+  return ran > 0 ? 0 : EINVAL;
+}